@@ -12,6 +12,20 @@
 //
 //  Resolves common UB and incorrect typings in C and C++ code.
 //
+//  Rules record their edits in a ledger instead of touching the Rewriter. The
+//  ledger is put in canonical order (see sortCanonically) before being
+//  applied, so neither the output nor which of two conflicting edits wins
+//  depends on the order declarations were matched in.
+//
+//  Matching stays on one thread: the matchers write to the ASTContext (the
+//  ParentMapContext's traversal kind, its lazily built parent map) and to
+//  the SourceManager's FileID lookup cache, so concurrent MatchFinders over
+//  one TU would race.
+//
+//  With `--stream-decls`, non-template functions and variables are matched
+//  from HandleTopLevelDecl, as soon as the parser is done with them and while
+//  their AST is still in cache; the rest of the TU is matched at its end.
+//
 // USAGE:
 //    * clang -cc1 -load <BUILD_DIR>/lib/libTypeCorrect.dylib `\`
 //        -plugin TypeCorrect test/MBA_add_int.cpp
@@ -19,12 +33,16 @@
 // License: CC0
 //==============================================================================
 
+#include <algorithm>
+#include <tuple>
+
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Frontend/FrontendPluginRegistry.h>
 #include <llvm/Support/CommandLine.h>
 
 #include "TypeCorrect.h"
+#include "TypeCorrectApply.h"
 
 //-----------------------------------------------------------------------------
 // TypeCorrect - implementation
@@ -63,8 +81,15 @@ void TypeCorrectMatcher::run(
 
   // For each argument match it with the callee parameter. If it is an integer,
   // float, boolean, character or string literal insert a comment.
+  if (!Editable)
+    Editable = std::make_shared<TypeCorrectEditableFiles>(
+        *Result.SourceManager, /*Filter=*/nullptr);
+
   for (unsigned Idx = 0; Idx < NumArgs; Idx++) {
     const clang::Expr *AE = Args[Idx]->IgnoreParenCasts();
+    // An edit here would never be written
+    if (!Editable->isEditable(AE->getBeginLoc()))
+      continue;
     /*llvm::outs() << "Args[" << Idx << "] = ";
     Args[Idx]->dump();
     llvm::outs() << ';';*/
@@ -84,60 +109,228 @@ void TypeCorrectMatcher::run(
         Ctx->getFullLoc(ParamDecl->getBeginLoc());
     clang::FullSourceLoc ArgLoc = Ctx->getFullLoc(AE->getBeginLoc());
 
-    if (ParamLocation.isValid() && !ParamDecl->getDeclName().isEmpty() &&
-        EditedLocations.insert(ArgLoc).second)
-      // Insert the comment immediately before the argument
-      LACRewriter.InsertText(
-          ArgLoc,
-          (llvm::Twine("/*") + ParamDecl->getDeclName().getAsString() + "=*/")
-              .str());
+    if (!ParamLocation.isValid() || ParamDecl->getDeclName().isEmpty())
+      continue;
+
+    // Already annotated, e.g. by an earlier run
+    if (!Comments)
+      Comments = std::make_shared<TypeCorrectCommentIndex>(
+          *Result.SourceManager, Ctx->getLangOpts());
+    if (Comments->hasArgumentComment(ArgLoc))
+      continue;
+
+    // Insert the comment immediately before the argument
+    addEdit(
+        ArgLoc,
+        (llvm::Twine("/*") + ParamDecl->getDeclName().getAsString() + "=*/")
+            .str(),
+        AE->getType().getAsString(Ctx->getPrintingPolicy()),
+        ParamDecl->getType().getAsString(Ctx->getPrintingPolicy()));
   }
 }
 
+void TypeCorrectMatcher::addEdit(clang::SourceLocation Loc, std::string Text,
+                                 std::string FromType, std::string ToType) {
+  Edits.push_back({Loc, std::move(Text), "literal-argument-comment",
+                   std::move(FromType), std::move(ToType)});
+}
+
+std::vector<TypeCorrectEdit> TypeCorrectMatcher::takeEdits() {
+  std::vector<TypeCorrectEdit> Taken;
+  Taken.swap(Edits);
+  return Taken;
+}
+
+void sortCanonically(std::vector<TypeCorrectEdit> &Edits,
+                     const clang::SourceManager &SM) {
+  const auto Key = [&](const TypeCorrectEdit &Edit) {
+    const std::pair<clang::FileID, unsigned> Decomposed =
+        SM.getDecomposedLoc(Edit.Loc);
+    return std::make_tuple(Decomposed.first, Decomposed.second, Edit.Rule,
+                           llvm::StringRef(Edit.Text));
+  };
+  std::sort(Edits.begin(), Edits.end(),
+            [&](const TypeCorrectEdit &L, const TypeCorrectEdit &R) {
+              return Key(L) < Key(R);
+            });
+}
+
 void TypeCorrectMatcher::onEndOfTranslationUnit() {
   // Replace in place
   // LACRewriter.overwriteChangedFiles();
 
-  // Output to stdout
-  LACRewriter.getEditBuffer(LACRewriter.getSourceMgr().getMainFileID())
-      .write(llvm::outs());
+  if (OnPhase)
+    OnPhase(TypeCorrectPhase::Write);
+
+  // One edit per location: the first in canonical order
+  const clang::SourceManager &SM = LACRewriter.getSourceMgr();
+  const clang::FileID MainFileID = SM.getMainFileID();
+  std::vector<TypeCorrectEdit> Ledger = takeEdits();
+  sortCanonically(Ledger, SM);
+
+  // Something else already edited the main file through the Rewriter: add
+  // to its edits
+  if (LACRewriter.getRewriteBufferFor(MainFileID)) {
+    for (size_t Idx = 0; Idx < Ledger.size(); Idx++) {
+      if (Idx != 0 && Ledger[Idx].Loc == Ledger[Idx - 1].Loc)
+        continue;
+      // InsertText returns true on failure, e.g. inside a macro expansion
+      if (!LACRewriter.InsertText(Ledger[Idx].Loc, Ledger[Idx].Text) &&
+          OnEdit && SM.getFileID(Ledger[Idx].Loc) == MainFileID)
+        OnEdit(Ledger[Idx], SM);
+    }
+    LACRewriter.getEditBuffer(MainFileID).write(Out);
+    return;
+  }
+
+  // Otherwise only the main file is written, and the ledger is already
+  // sorted by offset within it: apply its edits in one linear pass. As with
+  // the Rewriter, edits inside macro expansions are dropped.
+  std::vector<TypeCorrectInsertion> Insertions;
+  for (size_t Idx = 0; Idx < Ledger.size(); Idx++) {
+    const TypeCorrectEdit &Edit = Ledger[Idx];
+    if ((Idx != 0 && Edit.Loc == Ledger[Idx - 1].Loc) || !Edit.Loc.isFileID())
+      continue;
+    const std::pair<clang::FileID, unsigned> Decomposed =
+        SM.getDecomposedLoc(Edit.Loc);
+    if (Decomposed.first != MainFileID)
+      continue;
+    Insertions.push_back({Decomposed.second, Edit.Text});
+    if (OnEdit)
+      OnEdit(Edit, SM);
+  }
+
+  // Output to stdout, streamed from the original buffer
+  writeInsertions(Out, SM.getBufferData(MainFileID), Insertions);
 }
 
-TypeCorrectASTConsumer::TypeCorrectASTConsumer(clang::Rewriter &R)
-    : TCHandler(R) {
-  const clang::ast_matchers::StatementMatcher CallSiteMatcher =
-      clang::ast_matchers::callExpr(
-          clang::ast_matchers::allOf(
-              clang::ast_matchers::callee(
-                  clang::ast_matchers::functionDecl(
-                      clang::ast_matchers::unless(
-                          clang::ast_matchers::isVariadic()))
-                      .bind("callee")),
-              clang::ast_matchers::unless(
-                  clang::ast_matchers::cxxMemberCallExpr(
-                      clang::ast_matchers::on(clang::ast_matchers::hasType(
-                          clang::ast_matchers::substTemplateTypeParmType())))),
-              clang::ast_matchers::anyOf(
-                  clang::ast_matchers::hasAnyArgument(
-                      clang::ast_matchers::ignoringParenCasts(
-                          clang::ast_matchers::cxxBoolLiteral())),
-                  clang::ast_matchers::hasAnyArgument(
-                      clang::ast_matchers::ignoringParenCasts(
-                          clang::ast_matchers::integerLiteral())),
-                  clang::ast_matchers::hasAnyArgument(
-                      clang::ast_matchers::ignoringParenCasts(
-                          clang::ast_matchers::stringLiteral())),
-                  clang::ast_matchers::hasAnyArgument(
-                      clang::ast_matchers::ignoringParenCasts(
-                          clang::ast_matchers::characterLiteral())),
-                  clang::ast_matchers::hasAnyArgument(
-                      clang::ast_matchers::ignoringParenCasts(
-                          clang::ast_matchers::floatLiteral())))))
-          .bind("caller");
+// Calls to a non-variadic function with a literal argument
+static clang::ast_matchers::StatementMatcher getCallSiteMatcher() {
+  return clang::ast_matchers::callExpr(
+      clang::ast_matchers::allOf(
+          clang::ast_matchers::callee(
+              clang::ast_matchers::functionDecl(
+                  clang::ast_matchers::unless(
+                      clang::ast_matchers::isVariadic()))
+                  .bind("callee")),
+          clang::ast_matchers::unless(
+              clang::ast_matchers::cxxMemberCallExpr(
+                  clang::ast_matchers::on(clang::ast_matchers::hasType(
+                      clang::ast_matchers::substTemplateTypeParmType())))),
+          clang::ast_matchers::anyOf(
+              clang::ast_matchers::hasAnyArgument(
+                  clang::ast_matchers::ignoringParenCasts(
+                      clang::ast_matchers::cxxBoolLiteral())),
+              clang::ast_matchers::hasAnyArgument(
+                  clang::ast_matchers::ignoringParenCasts(
+                      clang::ast_matchers::integerLiteral())),
+              clang::ast_matchers::hasAnyArgument(
+                  clang::ast_matchers::ignoringParenCasts(
+                      clang::ast_matchers::stringLiteral())),
+              clang::ast_matchers::hasAnyArgument(
+                  clang::ast_matchers::ignoringParenCasts(
+                      clang::ast_matchers::characterLiteral())),
+              clang::ast_matchers::hasAnyArgument(
+                  clang::ast_matchers::ignoringParenCasts(
+                      clang::ast_matchers::floatLiteral())))))
+      .bind("caller");
+}
 
+TypeCorrectASTConsumer::TypeCorrectASTConsumer(
+    clang::Rewriter &R, llvm::raw_ostream &Out, TypeCorrectPhaseFn OnPhase,
+    TypeCorrectEditFn OnEdit, const TypeCorrectPathFilter *EditFilter,
+    bool StreamDecls)
+    : OnPhase(OnPhase), EditFilter(EditFilter), StreamDecls(StreamDecls),
+      TCHandler(R, Out, OnPhase, std::move(OnEdit)) {
   // LAC is the callback that will run when the ASTMatcher finds the pattern
-  // above.
-  Finder.addMatcher(CallSiteMatcher, &TCHandler);
+  // of getCallSiteMatcher.
+  Finder.addMatcher(getCallSiteMatcher(), &TCHandler);
+  DeclFinder.addMatcher(
+      clang::ast_matchers::decl(
+          clang::ast_matchers::forEachDescendant(getCallSiteMatcher())),
+      &TCHandler);
+}
+
+// The units of streamed work: top-level declarations, looking
+// through namespaces and `extern "C"` blocks so that a TU wrapped in one
+// still splits
+static void collectTopLevelDecls(const clang::Decl *D,
+                                 std::vector<const clang::Decl *> &Decls) {
+  if (isa<clang::NamespaceDecl>(D) || isa<clang::LinkageSpecDecl>(D)) {
+    for (const clang::Decl *Child : cast<clang::DeclContext>(D)->decls())
+      collectTopLevelDecls(Child, Decls);
+    return;
+  }
+  Decls.push_back(D);
+}
+
+namespace {
+// Finds generic lambdas, whose call operators are templates even inside a
+// function that isn't one
+class GenericLambdaFinder
+    : public clang::RecursiveASTVisitor<GenericLambdaFinder> {
+public:
+  bool VisitLambdaExpr(clang::LambdaExpr *E) {
+    Found = E->isGenericLambda();
+    return !Found;
+  }
+  bool Found = false;
+};
+} // namespace
+
+// Whether `D` can be matched as soon as it's parsed. Template instantiations
+// are only added at the end of the TU, so templates, classes (which may have
+// member templates) and whatever contains a generic lambda have to wait.
+static bool isStreamable(const clang::Decl *D) {
+  if ((!isa<clang::FunctionDecl>(D) && !isa<clang::VarDecl>(D)) ||
+      D->isTemplated())
+    return false;
+  GenericLambdaFinder Finder;
+  Finder.TraverseDecl(const_cast<clang::Decl *>(D));
+  return !Finder.Found;
+}
+
+bool TypeCorrectASTConsumer::HandleTopLevelDecl(clang::DeclGroupRef DG) {
+  if (!StreamDecls || !Context)
+    return true;
+  std::vector<const clang::Decl *> Decls;
+  for (const clang::Decl *D : DG)
+    collectTopLevelDecls(D, Decls);
+  for (const clang::Decl *D : Decls) {
+    if (!isStreamable(D))
+      continue;
+    if (!Editable) {
+      Editable = std::make_shared<TypeCorrectEditableFiles>(
+          Context->getSourceManager(), EditFilter);
+      TCHandler.shareEditableFiles(Editable);
+    }
+    DeclFinder.match(*D, *Context);
+    Streamed.insert(D);
+  }
+  return true;
+}
+
+void TypeCorrectASTConsumer::HandleTranslationUnit(clang::ASTContext &Ctx) {
+  if (OnPhase)
+    OnPhase(TypeCorrectPhase::Match);
+  if (!Editable) {
+    Editable = std::make_shared<TypeCorrectEditableFiles>(
+        Ctx.getSourceManager(), EditFilter);
+    TCHandler.shareEditableFiles(Editable);
+  }
+  if (Streamed.empty()) {
+    Finder.matchAST(Ctx);
+    return;
+  }
+
+  std::vector<const clang::Decl *> Decls;
+  for (const clang::Decl *D : Ctx.getTranslationUnitDecl()->decls())
+    collectTopLevelDecls(D, Decls);
+  llvm::erase_if(Decls,
+                 [&](const clang::Decl *D) { return Streamed.count(D); });
+  for (const clang::Decl *D : Decls)
+    DeclFinder.match(*D, Ctx);
+  TCHandler.onEndOfTranslationUnit();
 }
 
 //-----------------------------------------------------------------------------
@@ -10,29 +10,89 @@
 #ifndef TYPE_CORRECT_H
 #define TYPE_CORRECT_H
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <clang/AST/ASTConsumer.h>
 #include <clang/ASTMatchers/ASTMatchFinder.h>
 #include <clang/ASTMatchers/ASTMatchers.h>
 #include <clang/Rewrite/Core/Rewriter.h>
+#include <llvm/ADT/DenseSet.h>
+
+#include "TypeCorrectComments.h"
+#include "TypeCorrectEditable.h"
+#include "TypeCorrectPhase.h"
 
 #include "type_correct_export.h"
 
+//-----------------------------------------------------------------------------
+// Edit ledger
+//-----------------------------------------------------------------------------
+// An insertion found by a rule. Rules only record these; they are applied to
+// the Rewriter at the end of the TU, in canonical order.
+struct TypeCorrectEdit {
+  clang::SourceLocation Loc;
+  std::string Text;
+  // Name of the rule that found it (a string literal)
+  llvm::StringRef Rule;
+  // The type change behind it, for reports: for an argument comment, the
+  // literal's type and the parameter's
+  std::string FromType, ToType;
+};
+
+// Called with each edit that makes it into the rewritten main file, in
+// canonical order
+using TypeCorrectEditFn =
+    std::function<void(const TypeCorrectEdit &, const clang::SourceManager &)>;
+
+// Sort `Edits` into canonical order: by file (in FileID order, i.e. the order
+// the TU entered them), then offset, then rule name, then text. Applying the
+// first edit of each location in this order gives the same result however the
+// edits were found; of two edits at one location, the rule whose name sorts
+// first wins.
+TYPE_CORRECT_EXPORT void sortCanonically(std::vector<TypeCorrectEdit> &Edits,
+                                         const clang::SourceManager &SM);
+
 //-----------------------------------------------------------------------------
 // ASTMatcher callback
 //-----------------------------------------------------------------------------
 class TYPE_CORRECT_EXPORT TypeCorrectMatcher
     : public clang::ast_matchers::MatchFinder::MatchCallback {
 public:
-  explicit TypeCorrectMatcher(clang::Rewriter &LACRewriter) : LACRewriter(LACRewriter) {}
+  explicit TypeCorrectMatcher(clang::Rewriter &LACRewriter,
+                              llvm::raw_ostream &Out,
+                              TypeCorrectPhaseFn OnPhase = nullptr,
+                              TypeCorrectEditFn OnEdit = nullptr)
+      : LACRewriter(LACRewriter), Out(Out), OnPhase(std::move(OnPhase)),
+        OnEdit(std::move(OnEdit)) {}
   // Callback that's executed whenever the Matcher in TypeCorrectASTConsumer
   // matches.
   void run(const clang::ast_matchers::MatchFinder::MatchResult &) override;
   // Callback that's executed at the end of the translation unit
   void onEndOfTranslationUnit() override;
 
+  // Hand over the edits recorded by run() so far, in the order they were
+  // matched
+  std::vector<TypeCorrectEdit> takeEdits();
+  // Only record edits in these files (by default: the main file)
+  void shareEditableFiles(std::shared_ptr<TypeCorrectEditableFiles> Files) {
+    Editable = std::move(Files);
+  }
+
 private:
+  void addEdit(clang::SourceLocation Loc, std::string Text,
+               std::string FromType, std::string ToType);
+
   clang::Rewriter LACRewriter;
-  llvm::SmallSet<clang::FullSourceLoc, 8> EditedLocations;
+  // Where the rewritten main file is written at the end of the TU
+  llvm::raw_ostream &Out;
+  TypeCorrectPhaseFn OnPhase;
+  TypeCorrectEditFn OnEdit;
+  std::vector<TypeCorrectEdit> Edits;
+  // Built on the first match
+  std::shared_ptr<TypeCorrectCommentIndex> Comments;
+  std::shared_ptr<TypeCorrectEditableFiles> Editable;
 };
 
 //-----------------------------------------------------------------------------
@@ -40,14 +100,34 @@ private:
 //-----------------------------------------------------------------------------
 class TYPE_CORRECT_EXPORT TypeCorrectASTConsumer : public clang::ASTConsumer {
 public:
-  TypeCorrectASTConsumer(clang::Rewriter &R);
-  void HandleTranslationUnit(clang::ASTContext &Ctx) override {
-    Finder.matchAST(Ctx);
-  }
+  // `OnPhase`, if set, is told when matching and writing start. `OnEdit`, if
+  // set, sees every edit written to `Out`. `EditFilter`, if set, must outlive
+  // the consumer; matches in files it rejects are skipped. With
+  // `StreamDecls`, top-level declarations that can't change once parsed are
+  // matched as the parser hands them over, while the rest of the TU is still
+  // being parsed; the others (templates, and whatever contains them) wait for
+  // the end of the TU, when their instantiations exist.
+  explicit TypeCorrectASTConsumer(
+      clang::Rewriter &R, llvm::raw_ostream &Out = llvm::outs(),
+      TypeCorrectPhaseFn OnPhase = nullptr, TypeCorrectEditFn OnEdit = nullptr,
+      const TypeCorrectPathFilter *EditFilter = nullptr,
+      bool StreamDecls = false);
+  void Initialize(clang::ASTContext &Ctx) override { Context = &Ctx; }
+  bool HandleTopLevelDecl(clang::DeclGroupRef DG) override;
+  void HandleTranslationUnit(clang::ASTContext &Ctx) override;
 
 private:
+  TypeCorrectPhaseFn OnPhase;
+  const TypeCorrectPathFilter *EditFilter;
+  bool StreamDecls;
+  clang::ASTContext *Context = nullptr;
   clang::ast_matchers::MatchFinder Finder;
+  // Matches within one declaration, for those matched one at a time
+  clang::ast_matchers::MatchFinder DeclFinder;
   TypeCorrectMatcher TCHandler;
+  std::shared_ptr<TypeCorrectEditableFiles> Editable;
+  // Top-level declarations already matched as they were parsed
+  llvm::DenseSet<const clang::Decl *> Streamed;
 };
 
 #endif /* TYPE_CORRECT_H */
@@ -0,0 +1,62 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectASTFile.cpp
+//
+// DESCRIPTION:
+//    Load `-emit-ast` artifacts produced by the build with
+//    `ASTUnit::LoadFromASTFile` and run TypeCorrectASTConsumer on the
+//    deserialized AST, instead of reparsing the translation unit.
+//
+// USAGE:
+//    * clang -emit-ast a.c -o a.ast && type_correct_cli a.ast
+//
+// License: CC0
+//==============================================================================
+
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrect.h"
+#include "TypeCorrectASTFile.h"
+
+bool isSerializedASTFile(llvm::StringRef Path) {
+  return llvm::sys::path::extension(Path).equals_insensitive(".ast");
+}
+
+bool typeCorrectASTFile(llvm::StringRef ASTPath, llvm::raw_ostream &Out,
+                        llvm::raw_ostream &Errs,
+                        const TypeCorrectPhaseFn &OnPhase,
+                        const TypeCorrectEditFn &OnEdit,
+                        const TypeCorrectPathFilter *EditFilter) {
+  // Deserialization stands in for parsing
+  if (OnPhase)
+    OnPhase(TypeCorrectPhase::Parse);
+
+  clang::IntrusiveRefCntPtr<clang::DiagnosticsEngine> Diags =
+      clang::CompilerInstance::createDiagnostics(
+          new clang::DiagnosticOptions());
+
+  // `-emit-ast` writes a raw (not object-file wrapped) AST
+  const std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps =
+      std::make_shared<clang::PCHContainerOperations>();
+
+  std::unique_ptr<clang::ASTUnit> AST = clang::ASTUnit::LoadFromASTFile(
+      ASTPath.str(), PCHContainerOps->getRawReader(),
+      clang::ASTUnit::LoadEverything, Diags, clang::FileSystemOptions(),
+      /*UseDebugInfo=*/false, /*OnlyLocalDecls=*/false);
+  if (!AST) {
+    Errs << "Problem loading serialized AST " << ASTPath << '\n';
+    return false;
+  }
+
+  // The ASTReader restores the main FileID, so the consumer's end of TU
+  // output works just as it does after a regular parse.
+  clang::Rewriter RewriterForTypeCorrect(AST->getSourceManager(),
+                                         AST->getLangOpts());
+  TypeCorrectASTConsumer Consumer(RewriterForTypeCorrect, Out, OnPhase,
+                                  OnEdit, EditFilter);
+  Consumer.HandleTranslationUnit(AST->getASTContext());
+  return true;
+}
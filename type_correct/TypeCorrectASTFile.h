@@ -0,0 +1,36 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectASTFile.h
+//
+// DESCRIPTION: Header for TypeCorrectASTFile.cpp (run TypeCorrect over
+// serialized ASTs, i.e., the output of `clang -emit-ast`)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTASTFILE_H
+#define TYPECORRECT_TYPECORRECTASTFILE_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "TypeCorrect.h"
+#include "TypeCorrectPhase.h"
+
+#include "type_correct_export.h"
+
+// Whether `Path` names a serialized AST (`.ast`) rather than a source file
+TYPE_CORRECT_EXPORT bool isSerializedASTFile(llvm::StringRef Path);
+
+// Deserialize the AST at `ASTPath` and run TypeCorrectASTConsumer over it.
+// Preprocessing and Sema are skipped entirely; the cost is deserialization
+// plus matching. The rewritten main file goes to `Out`. Returns false (after
+// reporting to `Errs`) if the file could not be loaded.
+TYPE_CORRECT_EXPORT bool
+typeCorrectASTFile(llvm::StringRef ASTPath, llvm::raw_ostream &Out,
+                   llvm::raw_ostream &Errs,
+                   const TypeCorrectPhaseFn &OnPhase = nullptr,
+                   const TypeCorrectEditFn &OnEdit = nullptr,
+                   const TypeCorrectPathFilter *EditFilter = nullptr);
+
+#endif /* TYPECORRECT_TYPECORRECTASTFILE_H */
@@ -0,0 +1,163 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectApply.cpp
+//
+// DESCRIPTION:
+//    Bulk application of a file's edits. Generated sources can get tens of
+//    thousands of argument comments each, and inserting them one at a time
+//    into a RewriteRope dominates the write phase; with the edits sorted,
+//    the output is just the buffer's slices interleaved with their texts.
+//    Those can be written as they are, so that a 50 MB generated file isn't
+//    copied into a second 50 MB buffer only to be written out.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <vector>
+
+#include <llvm/Config/llvm-config.h>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "TypeCorrectApply.h"
+
+static void
+sortByOffset(llvm::MutableArrayRef<TypeCorrectInsertion> Insertions) {
+  const auto ByOffset = [](const TypeCorrectInsertion &L,
+                           const TypeCorrectInsertion &R) {
+    return L.Offset < R.Offset;
+  };
+  if (!std::is_sorted(Insertions.begin(), Insertions.end(), ByOffset))
+    std::stable_sort(Insertions.begin(), Insertions.end(), ByOffset);
+}
+
+// Call `Fn` with the pieces of the output in order: slices of `Buffer`
+// interleaved with the texts of the sorted `Insertions`, skipping empty ones
+template <typename FnT>
+static void forEachPiece(llvm::StringRef Buffer,
+                         llvm::ArrayRef<TypeCorrectInsertion> Insertions,
+                         FnT Fn) {
+  size_t Copied = 0;
+  for (const TypeCorrectInsertion &Insertion : Insertions) {
+    assert(Insertion.Offset <= Buffer.size() && "Insertion past the buffer");
+    if (Insertion.Offset != Copied)
+      Fn(Buffer.slice(Copied, Insertion.Offset));
+    if (!Insertion.Text.empty())
+      Fn(Insertion.Text);
+    Copied = Insertion.Offset;
+  }
+  if (Copied != Buffer.size())
+    Fn(Buffer.drop_front(Copied));
+}
+
+std::string
+applyInsertions(llvm::StringRef Buffer,
+                llvm::MutableArrayRef<TypeCorrectInsertion> Insertions) {
+  sortByOffset(Insertions);
+
+  size_t Size = Buffer.size();
+  for (const TypeCorrectInsertion &Insertion : Insertions)
+    Size += Insertion.Text.size();
+
+  std::string Result;
+  Result.reserve(Size);
+  forEachPiece(Buffer, Insertions, [&](llvm::StringRef Piece) {
+    Result.append(Piece.data(), Piece.size());
+  });
+  assert(Result.size() == Size);
+  return Result;
+}
+
+#ifdef LLVM_ON_UNIX
+namespace {
+// Gathers pieces and writes them to a file descriptor, up to IOV_MAX per
+// writev(2). After a failed write the rest goes through `Fallback`, which
+// then reports the error the way the stream does.
+class VectoredWriter {
+public:
+  VectoredWriter(int FD, llvm::raw_ostream &Fallback)
+      : FD(FD), Fallback(Fallback) {}
+  ~VectoredWriter() { flush(); }
+
+  void add(llvm::StringRef Piece) {
+    if (Failed) {
+      Fallback << Piece;
+      return;
+    }
+    Pending.push_back({const_cast<char *>(Piece.data()), Piece.size()});
+    if (Pending.size() == MaxIOVs)
+      flush();
+  }
+
+  void flush() {
+    size_t Next = 0;
+    while (Next < Pending.size()) {
+      const ssize_t Written =
+          ::writev(FD, &Pending[Next],
+                   static_cast<int>(std::min(Pending.size() - Next, MaxIOVs)));
+      if (Written < 0) {
+        if (errno == EINTR)
+          continue;
+        Failed = true;
+        for (; Next < Pending.size(); Next++)
+          Fallback.write(static_cast<const char *>(Pending[Next].iov_base),
+                         Pending[Next].iov_len);
+        break;
+      }
+      // Skip what was written; a short write can end inside a piece
+      for (size_t Left = static_cast<size_t>(Written); Left;) {
+        iovec &IOV = Pending[Next];
+        if (Left < IOV.iov_len) {
+          IOV.iov_base = static_cast<char *>(IOV.iov_base) + Left;
+          IOV.iov_len -= Left;
+          break;
+        }
+        Left -= IOV.iov_len;
+        Next++;
+      }
+    }
+    Pending.clear();
+  }
+
+private:
+#ifdef IOV_MAX
+  static constexpr size_t MaxIOVs = IOV_MAX;
+#else
+  static constexpr size_t MaxIOVs = 16; // _XOPEN_IOV_MAX
+#endif
+
+  int FD;
+  llvm::raw_ostream &Fallback;
+  std::vector<iovec> Pending;
+  bool Failed = false;
+};
+} // namespace
+#endif /* LLVM_ON_UNIX */
+
+void writeInsertions(llvm::raw_ostream &Out, llvm::StringRef Buffer,
+                     llvm::MutableArrayRef<TypeCorrectInsertion> Insertions) {
+  sortByOffset(Insertions);
+
+#ifdef LLVM_ON_UNIX
+  // raw_fd_ostream doesn't expose its descriptor to a plain raw_ostream, but
+  // outs() is the one fd stream output is written to. Its position count
+  // doesn't include what's written around it, which nothing here uses.
+  if (&Out == &llvm::outs()) {
+    Out.flush();
+    VectoredWriter Writer(STDOUT_FILENO, Out);
+    forEachPiece(Buffer, Insertions,
+                 [&](llvm::StringRef Piece) { Writer.add(Piece); });
+    return;
+  }
+#endif
+
+  forEachPiece(Buffer, Insertions,
+               [&](llvm::StringRef Piece) { Out << Piece; });
+}
@@ -0,0 +1,50 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectApply.h
+//
+// DESCRIPTION: Header for TypeCorrectApply.cpp (applies a file's insertions
+// in one linear pass, instead of one Rewriter::InsertText each, either into
+// a new buffer or streamed straight to the output)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTAPPLY_H
+#define TYPECORRECT_TYPECORRECTAPPLY_H
+
+#include <cstddef>
+#include <string>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+// `Text` inserted before the byte at `Offset` (the buffer's size for the end)
+struct TypeCorrectInsertion {
+  size_t Offset;
+  llvm::StringRef Text;
+};
+
+// `Buffer` with `Insertions` applied. They are sorted by offset first (a
+// stable sort, skipped when they already are), so insertions at the same
+// offset appear in the order given; then the result is built by a single
+// copy pass into a buffer sized up front. Unlike clang::Rewriter's
+// RewriteRope, the cost is linear in the size of the output however many
+// insertions there are.
+TYPE_CORRECT_EXPORT std::string
+applyInsertions(llvm::StringRef Buffer,
+                llvm::MutableArrayRef<TypeCorrectInsertion> Insertions);
+
+// Write what applyInsertions would return to `Out`, without building it:
+// slices of `Buffer` are written interleaved with the inserted texts. For
+// llvm::outs() they go to the file descriptor with writev(2), straight from
+// `Buffer` (for a large file, clang's mmap of it), bypassing the stream's
+// buffer.
+TYPE_CORRECT_EXPORT void
+writeInsertions(llvm::raw_ostream &Out, llvm::StringRef Buffer,
+                llvm::MutableArrayRef<TypeCorrectInsertion> Insertions);
+
+#endif /* TYPECORRECT_TYPECORRECTAPPLY_H */
@@ -0,0 +1,70 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectComments.cpp
+//
+// DESCRIPTION:
+//    Comment ranges per FileID, for the literal-argument rule: an argument
+//    that already has a `/*name=*/` comment in front of it (from an earlier
+//    run, or written by hand) is left alone, so running TypeCorrect over its
+//    own output changes nothing. Lexing each file once up front replaces a
+//    lexer scan backwards from every argument.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+
+#include <clang/Basic/CharInfo.h>
+#include <clang/Lex/Lexer.h>
+
+#include "TypeCorrectComments.h"
+
+bool isArgumentComment(llvm::StringRef Comment) {
+  if (!Comment.consume_front("/*") || !Comment.consume_back("=*/"))
+    return false;
+  Comment = Comment.trim();
+  return !Comment.empty() && llvm::all_of(Comment, [](char C) {
+    return clang::isIdentifierBody(static_cast<unsigned char>(C));
+  });
+}
+
+const std::vector<TypeCorrectCommentIndex::CommentRange> &
+TypeCorrectCommentIndex::getComments(clang::FileID FID) {
+  std::unique_ptr<std::vector<CommentRange>> &Ranges = Comments[FID];
+  if (Ranges)
+    return *Ranges;
+
+  Ranges = std::make_unique<std::vector<CommentRange>>();
+  clang::Lexer Lex(FID, SM.getBufferOrFake(FID), SM, LangOpts);
+  Lex.SetCommentRetentionState(true);
+  clang::Token Tok;
+  do {
+    Lex.LexFromRawLexer(Tok);
+    if (Tok.is(clang::tok::comment)) {
+      const unsigned Begin = SM.getFileOffset(Tok.getLocation());
+      Ranges->push_back({Begin, Begin + Tok.getLength()});
+    }
+  } while (Tok.isNot(clang::tok::eof));
+  return *Ranges;
+}
+
+bool TypeCorrectCommentIndex::hasArgumentComment(clang::SourceLocation Loc) {
+  if (!Loc.isFileID())
+    return false;
+  const std::pair<clang::FileID, unsigned> Decomposed =
+      SM.getDecomposedLoc(Loc);
+  const std::vector<CommentRange> &Ranges = getComments(Decomposed.first);
+
+  // The last comment that ends before the token
+  const auto After = std::upper_bound(
+      Ranges.begin(), Ranges.end(), Decomposed.second,
+      [](unsigned Offset, const CommentRange &R) { return Offset < R.End; });
+  if (After == Ranges.begin())
+    return false;
+  const CommentRange &Before = *std::prev(After);
+
+  const llvm::StringRef Buffer = SM.getBufferData(Decomposed.first);
+  return Buffer.slice(Before.End, Decomposed.second)
+                 .find_first_not_of(" \t\n\v\f\r") == llvm::StringRef::npos &&
+         isArgumentComment(Buffer.slice(Before.Begin, Before.End));
+}
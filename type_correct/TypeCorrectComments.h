@@ -0,0 +1,54 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectComments.h
+//
+// DESCRIPTION: Header for TypeCorrectComments.cpp (per-file index of comment
+// ranges, to tell arguments that already carry a `/*name=*/` comment)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTCOMMENTS_H
+#define TYPECORRECT_TYPECORRECTCOMMENTS_H
+
+#include <memory>
+#include <vector>
+
+#include <clang/Basic/LangOptions.h>
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "type_correct_export.h"
+
+// Whether `Comment` (including its delimiters) is an argument comment:
+// `/*name=*/`, with optional spaces around the name
+TYPE_CORRECT_EXPORT bool isArgumentComment(llvm::StringRef Comment);
+
+// The comments of each file, found by one raw lexer pass over the file the
+// first time it is asked about, and kept sorted by offset so that a lookup
+// is a binary search. Not thread-safe: lookups go through the SourceManager,
+// which updates its FileID cache.
+class TYPE_CORRECT_EXPORT TypeCorrectCommentIndex {
+public:
+  TypeCorrectCommentIndex(const clang::SourceManager &SM,
+                          const clang::LangOptions &LangOpts)
+      : SM(SM), LangOpts(LangOpts) {}
+
+  // Whether the token at `Loc` is preceded, bar whitespace, by an argument
+  // comment. Always false inside macro expansions.
+  bool hasArgumentComment(clang::SourceLocation Loc);
+
+private:
+  struct CommentRange {
+    unsigned Begin, End;
+  };
+  const std::vector<CommentRange> &getComments(clang::FileID FID);
+
+  const clang::SourceManager &SM;
+  const clang::LangOptions &LangOpts;
+  llvm::DenseMap<clang::FileID, std::unique_ptr<std::vector<CommentRange>>>
+      Comments;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTCOMMENTS_H */
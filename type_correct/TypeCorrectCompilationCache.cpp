@@ -0,0 +1,422 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectCompilationCache.cpp
+//
+// DESCRIPTION:
+//    A generated build's compile_commands.json can run to hundreds of MB, and
+//    parsing it takes seconds before the first TU starts, on every run. The
+//    JSON is parsed once instead, into an image that is mmapped by later
+//    runs. The image is tagged with a hash of the JSON's contents, so any
+//    change to the database rebuilds it.
+//
+//    A file is also indexed by its real path, when that differs, so that a
+//    lookup through a symlinked checkout finds it. Lookups that miss try
+//    the real path of the path asked for, which covers the reverse.
+//
+//    Layout, all integers little-endian:
+//      header    magic[8], version, #files, JSON hash (u64), #buckets,
+//                #commands, #args, size of the string table, #aliases
+//      buckets   u32[#buckets]: 1 + index of the file hashing there, or 0;
+//                linear probing, at most half full
+//      files     {path, first command, #commands} per file, then per alias
+//                (a real path, sharing the commands of its file)
+//      commands  {directory, file name, output, first arg, #args} each
+//      args      u32[#args]
+//      strings   {u32 length, bytes} each; the other tables refer to
+//                strings by their offset in here
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+
+#include <clang/Tooling/JSONCompilationDatabase.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/EndianStream.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include "TypeCorrectCompilationCache.h"
+
+static constexpr char CacheMagic[8] = {'T', 'C', 'C', 'D', 'B', '\r', '\n', 0};
+static constexpr uint32_t CacheVersion = 2;
+static constexpr size_t HeaderSize = 44;
+static constexpr size_t FileSize = 3 * 4;
+static constexpr size_t CommandSize = 5 * 4;
+
+// How JSONCompilationDatabase indexes a command's file: relative names are
+// resolved against the command's directory
+static std::string getFileKey(const clang::tooling::CompileCommand &Command) {
+  llvm::SmallString<128> NativePath;
+  if (llvm::sys::path::is_relative(Command.Filename)) {
+    llvm::SmallString<128> AbsolutePath(Command.Directory);
+    llvm::sys::path::append(AbsolutePath, Command.Filename);
+    llvm::sys::path::remove_dots(AbsolutePath, /*remove_dot_dot=*/true);
+    llvm::sys::path::native(AbsolutePath, NativePath);
+  } else {
+    llvm::sys::path::native(Command.Filename, NativePath);
+  }
+  return std::string(NativePath);
+}
+
+std::string
+TypeCorrectCompilationCache::getDefaultPath(llvm::StringRef BuildDir) {
+  llvm::SmallString<128> AbsoluteDir(BuildDir);
+  llvm::sys::fs::make_absolute(AbsoluteDir);
+  llvm::sys::path::remove_dots(AbsoluteDir, /*remove_dot_dot=*/true);
+
+  llvm::SmallString<128> Path;
+  if (!llvm::sys::path::cache_directory(Path))
+    llvm::sys::path::system_temp_directory(/*erasedOnReboot=*/false, Path);
+  std::string Name;
+  llvm::raw_string_ostream OS(Name);
+  OS << "compdb-" << llvm::format_hex_no_prefix(llvm::xxHash64(AbsoluteDir), 16)
+     << ".bin";
+  llvm::sys::path::append(Path, "type_correct", OS.str());
+  return std::string(Path);
+}
+
+//===----------------------------------------------------------------------===//
+// Writing
+//===----------------------------------------------------------------------===//
+llvm::Optional<std::string> TypeCorrectCompilationCache::serialize(
+    llvm::ArrayRef<clang::tooling::CompileCommand> AllCommands,
+    uint64_t JSONHash) {
+  // Strings are interned: most arguments are shared by most commands
+  std::string StringTable;
+  llvm::StringMap<uint32_t> Interned;
+  bool Overflow = false;
+  const auto Intern = [&](llvm::StringRef S) -> uint32_t {
+    const auto It = Interned.find(S);
+    if (It != Interned.end())
+      return It->second;
+    if (StringTable.size() + 4 + S.size() > UINT32_MAX) {
+      Overflow = true;
+      return 0;
+    }
+    const uint32_t Offset = static_cast<uint32_t>(StringTable.size());
+    char Length[4];
+    llvm::support::endian::write32le(Length, static_cast<uint32_t>(S.size()));
+    StringTable.append(Length, 4);
+    StringTable.append(S.data(), S.size());
+    Interned[S] = Offset;
+    return Offset;
+  };
+
+  // Group the commands by file, files in order of first appearance
+  llvm::StringMap<uint32_t> FileIndex;
+  std::vector<std::string> FileKeys;
+  std::vector<std::vector<uint32_t>> FileCommands;
+  for (uint32_t Idx = 0; Idx < AllCommands.size(); Idx++) {
+    std::string Key = getFileKey(AllCommands[Idx]);
+    const auto Inserted =
+        FileIndex.try_emplace(Key, static_cast<uint32_t>(FileKeys.size()));
+    if (Inserted.second) {
+      FileKeys.push_back(std::move(Key));
+      FileCommands.emplace_back();
+    }
+    FileCommands[Inserted.first->second].push_back(Idx);
+  }
+
+  // Real paths that differ from every key, and the file each resolves from
+  const size_t NumKeys = FileKeys.size();
+  std::vector<uint32_t> AliasOf;
+  for (uint32_t File = 0; File < NumKeys; File++) {
+    llvm::SmallString<128> RealPath;
+    if (llvm::sys::fs::real_path(FileKeys[File], RealPath))
+      continue;
+    const uint32_t Alias = static_cast<uint32_t>(FileKeys.size());
+    if (!FileIndex.try_emplace(RealPath, Alias).second)
+      continue;
+    FileKeys.push_back(std::string(RealPath));
+    AliasOf.push_back(File);
+  }
+
+  uint32_t NumBuckets = 1;
+  while (NumBuckets < 2 * FileKeys.size())
+    NumBuckets *= 2;
+  std::vector<uint32_t> Buckets(NumBuckets, 0);
+  for (uint32_t File = 0; File < FileKeys.size(); File++) {
+    uint64_t Slot = llvm::xxHash64(FileKeys[File]);
+    while (Buckets[Slot & (NumBuckets - 1)])
+      Slot++;
+    Buckets[Slot & (NumBuckets - 1)] = File + 1;
+  }
+
+  std::string Tables;
+  llvm::raw_string_ostream OS(Tables);
+  llvm::support::endian::Writer W(OS, llvm::support::little);
+  for (const uint32_t Bucket : Buckets)
+    W.write<uint32_t>(Bucket);
+  uint32_t NumCommands = 0;
+  std::vector<uint32_t> FirstCommand;
+  for (uint32_t File = 0; File < NumKeys; File++) {
+    FirstCommand.push_back(NumCommands);
+    W.write<uint32_t>(Intern(FileKeys[File]));
+    W.write<uint32_t>(NumCommands);
+    W.write<uint32_t>(static_cast<uint32_t>(FileCommands[File].size()));
+    NumCommands += static_cast<uint32_t>(FileCommands[File].size());
+  }
+  for (uint32_t Alias = 0; Alias < AliasOf.size(); Alias++) {
+    const uint32_t File = AliasOf[Alias];
+    W.write<uint32_t>(Intern(FileKeys[NumKeys + Alias]));
+    W.write<uint32_t>(FirstCommand[File]);
+    W.write<uint32_t>(static_cast<uint32_t>(FileCommands[File].size()));
+  }
+  std::vector<uint32_t> Args;
+  for (const std::vector<uint32_t> &Indices : FileCommands)
+    for (const uint32_t Idx : Indices) {
+      const clang::tooling::CompileCommand &Command = AllCommands[Idx];
+      W.write<uint32_t>(Intern(Command.Directory));
+      W.write<uint32_t>(Intern(Command.Filename));
+      W.write<uint32_t>(Intern(Command.Output));
+      W.write<uint32_t>(static_cast<uint32_t>(Args.size()));
+      W.write<uint32_t>(static_cast<uint32_t>(Command.CommandLine.size()));
+      for (const std::string &Arg : Command.CommandLine)
+        Args.push_back(Intern(Arg));
+    }
+  for (const uint32_t Arg : Args)
+    W.write<uint32_t>(Arg);
+  if (Overflow || Args.size() > UINT32_MAX)
+    return llvm::None;
+
+  std::string Image;
+  llvm::raw_string_ostream ImageOS(Image);
+  ImageOS.write(CacheMagic, sizeof(CacheMagic));
+  llvm::support::endian::Writer H(ImageOS, llvm::support::little);
+  H.write<uint32_t>(CacheVersion);
+  H.write<uint32_t>(static_cast<uint32_t>(NumKeys));
+  H.write<uint64_t>(JSONHash);
+  H.write<uint32_t>(NumBuckets);
+  H.write<uint32_t>(NumCommands);
+  H.write<uint32_t>(static_cast<uint32_t>(Args.size()));
+  H.write<uint32_t>(static_cast<uint32_t>(StringTable.size()));
+  H.write<uint32_t>(static_cast<uint32_t>(AliasOf.size()));
+  ImageOS << OS.str() << StringTable;
+  return std::move(ImageOS.str());
+}
+
+// Write `Image` to `Path` atomically, so that a concurrent run mapping the
+// old cache keeps its (unlinked) copy
+static bool writeImage(llvm::StringRef Image, llvm::StringRef Path) {
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Path));
+  int FD;
+  llvm::SmallString<256> TempPath;
+  if (llvm::sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TempPath))
+    return false;
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Image;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(TempPath);
+      return false;
+    }
+  }
+  return !llvm::sys::fs::rename(TempPath, Path);
+}
+
+//===----------------------------------------------------------------------===//
+// Reading
+//===----------------------------------------------------------------------===//
+bool TypeCorrectCompilationCache::parseHeader(uint64_t JSONHash) {
+  const llvm::StringRef Data = Image->getBuffer();
+  if (Data.size() < HeaderSize ||
+      !Data.startswith(llvm::StringRef(CacheMagic, sizeof(CacheMagic))))
+    return false;
+  const char *P = Data.data();
+  using namespace llvm::support::endian;
+  if (read32le(P + 8) != CacheVersion || read64le(P + 16) != JSONHash)
+    return false;
+  NumFiles = read32le(P + 12);
+  NumBuckets = read32le(P + 24);
+  NumCommands = read32le(P + 28);
+  NumArgs = read32le(P + 32);
+  const uint64_t StringsSize = read32le(P + 36);
+  NumAliases = read32le(P + 40);
+  const uint64_t NumEntries = uint64_t(NumFiles) + NumAliases;
+  if (NumBuckets == 0 || (NumBuckets & (NumBuckets - 1)) ||
+      NumEntries >= NumBuckets)
+    return false;
+
+  const uint64_t Size = HeaderSize + 4ull * NumBuckets +
+                        FileSize * NumEntries + CommandSize * NumCommands +
+                        4ull * NumArgs + StringsSize;
+  if (Size != Data.size())
+    return false;
+  Buckets = P + HeaderSize;
+  Files = Buckets + 4ull * NumBuckets;
+  Commands = Files + FileSize * NumEntries;
+  Args = Commands + CommandSize * NumCommands;
+  Strings = Data.take_back(StringsSize);
+  return true;
+}
+
+std::unique_ptr<TypeCorrectCompilationCache>
+TypeCorrectCompilationCache::create(std::unique_ptr<llvm::MemoryBuffer> Image,
+                                    uint64_t JSONHash) {
+  std::unique_ptr<TypeCorrectCompilationCache> Cache(
+      new TypeCorrectCompilationCache(std::move(Image)));
+  if (!Cache->parseHeader(JSONHash))
+    return nullptr;
+  return Cache;
+}
+
+std::unique_ptr<TypeCorrectCompilationCache>
+TypeCorrectCompilationCache::load(llvm::StringRef CachePath,
+                                  uint64_t JSONHash) {
+  // No null terminator needed, so that the file is mapped rather than read
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(CachePath, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!Buffer)
+    return nullptr;
+  return create(std::move(*Buffer), JSONHash);
+}
+
+std::unique_ptr<TypeCorrectCompilationCache>
+TypeCorrectCompilationCache::loadOrBuild(llvm::StringRef BuildDir,
+                                         llvm::StringRef CachePath,
+                                         std::string &ErrorMessage) {
+  llvm::SmallString<128> JSONPath(BuildDir);
+  llvm::sys::path::append(JSONPath, "compile_commands.json");
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> JSON =
+      llvm::MemoryBuffer::getFile(JSONPath, /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!JSON) {
+    ErrorMessage = ("Could not read " + JSONPath + ": " +
+                    JSON.getError().message())
+                       .str();
+    return nullptr;
+  }
+  const uint64_t JSONHash = llvm::xxHash64((*JSON)->getBuffer());
+  if (std::unique_ptr<TypeCorrectCompilationCache> Cache =
+          load(CachePath, JSONHash))
+    return Cache;
+
+  std::unique_ptr<clang::tooling::JSONCompilationDatabase> Database =
+      clang::tooling::JSONCompilationDatabase::loadFromBuffer(
+          (*JSON)->getBuffer(), ErrorMessage,
+          clang::tooling::JSONCommandLineSyntax::AutoDetect);
+  if (!Database)
+    return nullptr;
+  llvm::Optional<std::string> Image =
+      serialize(Database->getAllCompileCommands(), JSONHash);
+  if (!Image) {
+    ErrorMessage = (JSONPath + " is too large to cache").str();
+    return nullptr;
+  }
+  writeImage(*Image, CachePath);
+  return create(llvm::MemoryBuffer::getMemBufferCopy(*Image), JSONHash);
+}
+
+uint32_t TypeCorrectCompilationCache::read32(const char *Table,
+                                             uint64_t Index) const {
+  return llvm::support::endian::read32le(Table + 4 * Index);
+}
+
+// Offsets come from the file: a corrupt one gives an empty string rather
+// than a read out of bounds
+llvm::StringRef TypeCorrectCompilationCache::getString(uint32_t Offset) const {
+  if (uint64_t(Offset) + 4 > Strings.size())
+    return llvm::StringRef();
+  const uint32_t Length =
+      llvm::support::endian::read32le(Strings.data() + Offset);
+  if (uint64_t(Offset) + 4 + Length > Strings.size())
+    return llvm::StringRef();
+  return Strings.substr(Offset + 4, Length);
+}
+
+llvm::Optional<uint32_t>
+TypeCorrectCompilationCache::findFile(llvm::StringRef Path) const {
+  uint64_t Slot = llvm::xxHash64(Path);
+  for (uint32_t Probe = 0; Probe < NumBuckets; Probe++, Slot++) {
+    const uint32_t Entry = read32(Buckets, Slot & (NumBuckets - 1));
+    if (!Entry || Entry > uint64_t(NumFiles) + NumAliases)
+      return llvm::None;
+    if (getString(read32(Files, 3ull * (Entry - 1))) == Path)
+      return Entry - 1;
+  }
+  return llvm::None;
+}
+
+void TypeCorrectCompilationCache::appendCommands(
+    uint32_t File, std::vector<clang::tooling::CompileCommand> &Out) const {
+  const uint32_t First = read32(Files, 3ull * File + 1);
+  const uint32_t Count = read32(Files, 3ull * File + 2);
+  for (uint64_t Idx = First; Idx < uint64_t(First) + Count &&
+                             Idx < NumCommands;
+       Idx++) {
+    const uint32_t FirstArg = read32(Commands, 5 * Idx + 3);
+    const uint32_t NumCommandArgs = read32(Commands, 5 * Idx + 4);
+    std::vector<std::string> CommandLine;
+    CommandLine.reserve(NumCommandArgs);
+    for (uint64_t Arg = FirstArg;
+         Arg < uint64_t(FirstArg) + NumCommandArgs && Arg < NumArgs; Arg++)
+      CommandLine.push_back(getString(read32(Args, Arg)).str());
+    Out.emplace_back(getString(read32(Commands, 5 * Idx)),
+                     getString(read32(Commands, 5 * Idx + 1)),
+                     std::move(CommandLine),
+                     getString(read32(Commands, 5 * Idx + 2)));
+  }
+}
+
+std::vector<clang::tooling::CompileCommand>
+TypeCorrectCompilationCache::getCompileCommands(
+    llvm::StringRef FilePath) const {
+  std::vector<clang::tooling::CompileCommand> Result;
+  llvm::SmallString<128> NativePath;
+  llvm::sys::path::native(FilePath, NativePath);
+  llvm::Optional<uint32_t> File = findFile(NativePath);
+  if (!File) {
+    llvm::sys::path::remove_dots(NativePath, /*remove_dot_dot=*/true);
+    File = findFile(NativePath);
+  }
+  // E.g. asked through a symlinked checkout, for a database written with
+  // the real paths
+  llvm::SmallString<128> RealPath;
+  if (!File && !llvm::sys::fs::real_path(FilePath, RealPath))
+    File = findFile(RealPath);
+  if (File)
+    appendCommands(*File, Result);
+  return Result;
+}
+
+std::vector<std::string> TypeCorrectCompilationCache::getAllFiles() const {
+  std::vector<std::string> Result;
+  Result.reserve(NumFiles);
+  for (uint32_t File = 0; File < NumFiles; File++)
+    Result.push_back(getString(read32(Files, 3ull * File)).str());
+  return Result;
+}
+
+std::vector<clang::tooling::CompileCommand>
+TypeCorrectCompilationCache::getAllCompileCommands() const {
+  std::vector<clang::tooling::CompileCommand> Result;
+  Result.reserve(NumCommands);
+  for (uint32_t File = 0; File < NumFiles; File++)
+    appendCommands(File, Result);
+  return Result;
+}
+
+std::unique_ptr<clang::tooling::CompilationDatabase>
+loadCachedCompilationDatabase(llvm::StringRef BuildDir,
+                              llvm::StringRef CachePath,
+                              std::string &ErrorMessage) {
+  std::unique_ptr<clang::tooling::CompilationDatabase> Cache =
+      TypeCorrectCompilationCache::loadOrBuild(BuildDir, CachePath,
+                                               ErrorMessage);
+  if (!Cache)
+    return nullptr;
+  return clang::tooling::inferTargetAndDriverMode(
+      clang::tooling::inferMissingCompileCommands(
+          clang::tooling::expandResponseFiles(
+              std::move(Cache), llvm::vfs::getRealFileSystem())));
+}
@@ -0,0 +1,96 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectCompilationCache.h
+//
+// DESCRIPTION: Header for TypeCorrectCompilationCache.cpp (a binary index of
+// compile_commands.json, mmapped instead of parsing the JSON on every run)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTCOMPILATIONCACHE_H
+#define TYPECORRECT_TYPECORRECTCOMPILATIONCACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "type_correct_export.h"
+
+// The compile commands of a compile_commands.json, in a flat binary image:
+// a hash table from each file's absolute path (and real path, where that
+// differs) to its commands, and the commands' strings, interned. Nothing is
+// decoded up front; a lookup is a hash probe and only the commands asked for
+// are materialized.
+class TYPE_CORRECT_EXPORT TypeCorrectCompilationCache
+    : public clang::tooling::CompilationDatabase {
+public:
+  // Default location of the cache for `BuildDir`:
+  // <user cache dir>/type_correct/compdb-<hash of BuildDir>.bin
+  static std::string getDefaultPath(llvm::StringRef BuildDir);
+
+  // The cache of `BuildDir`/compile_commands.json at `CachePath`, rebuilt
+  // (from one parse of the JSON) if it is missing or was built from
+  // different JSON contents. If the cache can't be written, the image built
+  // is used from memory. Returns null, with `ErrorMessage` set, if there is
+  // no valid compile_commands.json.
+  static std::unique_ptr<TypeCorrectCompilationCache>
+  loadOrBuild(llvm::StringRef BuildDir, llvm::StringRef CachePath,
+              std::string &ErrorMessage);
+
+  // The cache at `CachePath` if it is valid and was built from JSON
+  // contents hashing to `JSONHash`
+  static std::unique_ptr<TypeCorrectCompilationCache>
+  load(llvm::StringRef CachePath, uint64_t JSONHash);
+
+  // Build the image of `Commands`, tagged with `JSONHash`. Returns None if
+  // the strings don't fit the format (4 GiB).
+  static llvm::Optional<std::string>
+  serialize(llvm::ArrayRef<clang::tooling::CompileCommand> Commands,
+            uint64_t JSONHash);
+  // Use an image in memory
+  static std::unique_ptr<TypeCorrectCompilationCache>
+  create(std::unique_ptr<llvm::MemoryBuffer> Image, uint64_t JSONHash);
+
+  std::vector<clang::tooling::CompileCommand>
+  getCompileCommands(llvm::StringRef FilePath) const override;
+  std::vector<std::string> getAllFiles() const override;
+  std::vector<clang::tooling::CompileCommand>
+  getAllCompileCommands() const override;
+
+private:
+  explicit TypeCorrectCompilationCache(std::unique_ptr<llvm::MemoryBuffer> B)
+      : Image(std::move(B)) {}
+  bool parseHeader(uint64_t JSONHash);
+
+  uint32_t read32(const char *Table, uint64_t Index) const;
+  llvm::StringRef getString(uint32_t Offset) const;
+  llvm::Optional<uint32_t> findFile(llvm::StringRef Path) const;
+  void appendCommands(uint32_t File,
+                      std::vector<clang::tooling::CompileCommand> &Out) const;
+
+  std::unique_ptr<llvm::MemoryBuffer> Image;
+  uint32_t NumFiles = 0, NumAliases = 0, NumBuckets = 0, NumCommands = 0,
+           NumArgs = 0;
+  const char *Buckets = nullptr, *Files = nullptr, *Commands = nullptr,
+             *Args = nullptr;
+  llvm::StringRef Strings;
+};
+
+// Load `BuildDir`'s compilation database through its cache at `CachePath`,
+// with the same wrapping as clang's JSON database plugin (response file
+// expansion, commands inferred for files not in the database, target and
+// driver mode from the compiler name)
+TYPE_CORRECT_EXPORT std::unique_ptr<clang::tooling::CompilationDatabase>
+loadCachedCompilationDatabase(llvm::StringRef BuildDir,
+                              llvm::StringRef CachePath,
+                              std::string &ErrorMessage);
+
+#endif /* TYPECORRECT_TYPECORRECTCOMPILATIONCACHE_H */
@@ -0,0 +1,65 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectCounters.cpp
+//
+// DESCRIPTION:
+//    Named counts that workers report instead of (or alongside) rewritten
+//    text, and that the parent reduces as results arrive. The wire form is
+//    plain text, one "<count> <key>" line per key, which stays small (a line
+//    per distinct key, not per edit) and is trivial to inspect.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+
+#include "TypeCorrectCounters.h"
+
+void TypeCorrectCounters::merge(const TypeCorrectCounters &Other) {
+  for (const auto &KV : Other.Counts)
+    Counts[KV.getKey()] += KV.getValue();
+}
+
+uint64_t TypeCorrectCounters::get(llvm::StringRef Key) const {
+  const auto It = Counts.find(Key);
+  return It == Counts.end() ? 0 : It->getValue();
+}
+
+uint64_t TypeCorrectCounters::total(llvm::StringRef Prefix) const {
+  uint64_t Total = 0;
+  for (const auto &KV : Counts)
+    if (KV.getKey().startswith(Prefix))
+      Total += KV.getValue();
+  return Total;
+}
+
+std::vector<llvm::StringRef>
+TypeCorrectCounters::keys(llvm::StringRef Prefix) const {
+  std::vector<llvm::StringRef> Keys;
+  for (const auto &KV : Counts)
+    if (KV.getKey().startswith(Prefix))
+      Keys.push_back(KV.getKey());
+  std::sort(Keys.begin(), Keys.end());
+  return Keys;
+}
+
+void TypeCorrectCounters::write(llvm::raw_ostream &OS) const {
+  for (const llvm::StringRef Key : keys())
+    OS << get(Key) << ' ' << Key << '\n';
+}
+
+bool TypeCorrectCounters::read(llvm::StringRef Text) {
+  while (!Text.empty()) {
+    llvm::StringRef Line;
+    std::tie(Line, Text) = Text.split('\n');
+    if (Line.empty())
+      continue;
+    const std::pair<llvm::StringRef, llvm::StringRef> CountAndKey =
+        Line.split(' ');
+    uint64_t Count;
+    if (CountAndKey.first.getAsInteger(10, Count) || CountAndKey.second.empty())
+      return false;
+    add(CountAndKey.second, Count);
+  }
+  return true;
+}
@@ -0,0 +1,52 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectCounters.h
+//
+// DESCRIPTION: Header for TypeCorrectCounters.cpp (named counts, e.g. edits
+// per rule, compact enough to send from a worker process per TU)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTCOUNTERS_H
+#define TYPECORRECT_TYPECORRECTCOUNTERS_H
+
+#include <cstdint>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+// Keys of the counters reported per TU: "rule\t<rule>" counts edits per
+// rule, and "change\t<rule>\t<from type>\t<to type>" edits per type change
+constexpr llvm::StringLiteral RuleCounterPrefix("rule\t");
+constexpr llvm::StringLiteral ChangeCounterPrefix("change\t");
+
+class TYPE_CORRECT_EXPORT TypeCorrectCounters {
+public:
+  void add(llvm::StringRef Key, uint64_t N = 1) { Counts[Key] += N; }
+  void merge(const TypeCorrectCounters &Other);
+  // 0 for a key never added
+  uint64_t get(llvm::StringRef Key) const;
+  // Sum over every key starting with `Prefix`
+  uint64_t total(llvm::StringRef Prefix = llvm::StringRef()) const;
+
+  bool empty() const { return Counts.empty(); }
+  // Every key starting with `Prefix`, sorted
+  std::vector<llvm::StringRef>
+  keys(llvm::StringRef Prefix = llvm::StringRef()) const;
+
+  // One "<count> <key>" line per key, sorted by key; keys must not contain
+  // newlines
+  void write(llvm::raw_ostream &OS) const;
+  // Add the counts written by write(); returns false on a malformed line
+  bool read(llvm::StringRef Text);
+
+private:
+  llvm::StringMap<uint64_t> Counts;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTCOUNTERS_H */
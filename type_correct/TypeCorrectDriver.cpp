@@ -0,0 +1,1001 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectDriver.cpp
+//
+// DESCRIPTION:
+//    Runs TypeCorrect over every TU of a run. By default everything happens in
+//    this process through a TypeCorrectTool, with each TU's output written
+//    by a TypeCorrectOutputPipeline while the next TU is parsed. With
+//    `--isolate`, `-j N` or `--tu-timeout`, TUs are instead handed to a
+//    TypeCorrectWorkerPool, so a clang crash or assertion only loses the
+//    offending TU: it is recorded, along with a reproducer (see
+//    TypeCorrectReproducer), and the run carries on. TUs that blow their
+//    `--tu-timeout` budget are likewise killed and recorded as skipped, with
+//    the phase (parse, match or write) they were in. TUs that take longer
+//    than `--reproduce-slower-than` or peak above `--reproduce-above-rss`
+//    run to completion, but get a reproducer too.
+//
+//    Isolated runs are scheduled longest-processing-time-first from the costs
+//    recorded by earlier runs (see TypeCorrectHistory), so that a huge TU
+//    doesn't start last and set the makespan. With `--memory-budget`, the
+//    recorded peak RSS of each TU also caps how many run at once.
+//
+//    Whatever the parallelism, output is in canonical order: TUs in byte-wise
+//    order of their paths as given (ties keep their command-line order), and
+//    within a TU, edits by file, offset, rule name and text (see
+//    sortCanonically). Worker results arrive in completion order, so they
+//    pass through a reorder buffer that streams each TU out as soon as every
+//    TU before it has been written.
+//
+//    With `--sample` or `--summary`, workers send back edit counts per rule
+//    and type change (TypeCorrectCounters) instead of rewritten text, which
+//    are reduced as they arrive. `--sample` only runs a stratified sample of
+//    the TUs and extrapolates (see TypeCorrectSample); `--summary` reports
+//    the totals (see TypeCorrectSummary).
+//
+//    With `--journal` or `--resume`, each file is recorded in a journal as
+//    it completes (see TypeCorrectJournal); `--resume` passes over the files
+//    recorded there whose inputs haven't changed, writing their recorded
+//    output in their place. In-process runs then take one source at a time.
+//
+//    With `--metrics`, phase latencies, outcomes, cache hit rates and edits
+//    per rule are kept in a TypeCorrectMetrics shared with the workers, and
+//    written out as a Prometheus textfile while the run goes on.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/xxhash.h>
+
+#include "TypeCorrectASTFile.h"
+#include "TypeCorrectCounters.h"
+#include "TypeCorrectDriver.h"
+#include "TypeCorrectEditable.h"
+#include "TypeCorrectFileCache.h"
+#include "TypeCorrectFileWriter.h"
+#include "TypeCorrectHistory.h"
+#include "TypeCorrectJournal.h"
+#include "TypeCorrectMain.h"
+#include "TypeCorrectMetrics.h"
+#include "TypeCorrectModules.h"
+#include "TypeCorrectPipeline.h"
+#include "TypeCorrectProgress.h"
+#include "TypeCorrectReproducer.h"
+#include "TypeCorrectSample.h"
+#include "TypeCorrectSummary.h"
+#include "TypeCorrectTool.h"
+#include "TypeCorrectWorkerPool.h"
+
+// Time allowed to inline a TU's includes for its reproducer when there's no
+// `--tu-timeout`
+static constexpr unsigned DefaultReproducerTimeoutSeconds = 300;
+
+//===----------------------------------------------------------------------===//
+// Skipped TUs
+//===----------------------------------------------------------------------===//
+static void writeSkippedReport(
+    llvm::StringRef Path,
+    llvm::ArrayRef<std::pair<std::string, TypeCorrectWorkerPool::JobResult>>
+        Skipped,
+    llvm::raw_ostream &Errs) {
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Text);
+  if (EC) {
+    Errs << "type_correct: unable to write " << Path << ": " << EC.message()
+         << '\n';
+    return;
+  }
+
+  llvm::json::OStream J(OS, /*IndentSize=*/2);
+  J.array([&] {
+    for (const auto &Entry : Skipped)
+      J.object([&] {
+        const TypeCorrectWorkerPool::JobResult &Result = Entry.second;
+        J.attribute("file", Entry.first);
+        J.attribute("phase", getPhaseName(Result.Phase));
+        J.attribute("seconds", Result.Seconds);
+        J.attributeObject("phase_seconds", [&] {
+          for (unsigned Idx = 0; Idx < NumTypeCorrectPhases; Idx++)
+            J.attribute(getPhaseName(static_cast<TypeCorrectPhase>(Idx)),
+                        Result.PhaseSeconds[Idx]);
+        });
+      });
+  });
+  OS << '\n';
+}
+
+//===----------------------------------------------------------------------===//
+// Canonical output order
+//===----------------------------------------------------------------------===//
+// Indices into `Files`, in canonical order
+static std::vector<unsigned>
+getCanonicalOrder(llvm::ArrayRef<std::string> Files) {
+  std::vector<unsigned> Order(Files.size());
+  for (unsigned Idx = 0; Idx < Order.size(); Idx++)
+    Order[Idx] = Idx;
+  std::stable_sort(Order.begin(), Order.end(), [&](unsigned L, unsigned R) {
+    return Files[L] < Files[R];
+  });
+  return Order;
+}
+
+namespace {
+// Writes per-TU outputs, added in any order, in canonical order. Only the
+// outputs that are ahead of a TU still in flight are held back.
+class ReorderBuffer {
+public:
+  ReorderBuffer(llvm::ArrayRef<unsigned> CanonicalOrder, llvm::raw_ostream &Out)
+      : Position(CanonicalOrder.size()), Pending(CanonicalOrder.size()),
+        Out(Out) {
+    for (unsigned Pos = 0; Pos < CanonicalOrder.size(); Pos++)
+      Position[CanonicalOrder[Pos]] = Pos;
+  }
+
+  // `Index` is the TU's index into the files the order was computed for
+  void add(unsigned Index, std::string Output) {
+    Pending[Position[Index]] = std::move(Output);
+    for (; Next < Pending.size() && Pending[Next]; Next++) {
+      Out << *Pending[Next];
+      Pending[Next].reset();
+    }
+  }
+
+private:
+  std::vector<unsigned> Position;
+  std::vector<llvm::Optional<std::string>> Pending;
+  unsigned Next = 0;
+  llvm::raw_ostream &Out;
+};
+} // namespace
+
+//===----------------------------------------------------------------------===//
+// Per-TU output
+//===----------------------------------------------------------------------===//
+namespace {
+// Runs each TU through `Inner`, then tells `OnDone` which main file it was
+// (absolute) and whether it succeeded, e.g. to hand its output on. If set,
+// `OnStart` is told the main file beforehand.
+class AfterEachTU : public clang::tooling::ToolAction {
+public:
+  using StartFn = llvm::function_ref<void(llvm::StringRef)>;
+  using DoneFn = llvm::function_ref<void(llvm::StringRef, bool)>;
+  AfterEachTU(clang::tooling::ToolAction &Inner, DoneFn OnDone,
+              StartFn OnStart = nullptr)
+      : Inner(Inner), OnDone(OnDone), OnStart(OnStart) {}
+
+  bool
+  runInvocation(std::shared_ptr<clang::CompilerInvocation> Invocation,
+                clang::FileManager *Files,
+                std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps,
+                clang::DiagnosticConsumer *DiagConsumer) override {
+    // Relative to the compile command's directory, the FileSystem's working
+    // directory for the TU
+    llvm::SmallString<256> MainFile;
+    const auto &Inputs = Invocation->getFrontendOpts().Inputs;
+    if (!Inputs.empty() && Inputs.front().isFile()) {
+      MainFile = Inputs.front().getFile();
+      Files->getVirtualFileSystem().makeAbsolute(MainFile);
+    }
+    if (OnStart)
+      OnStart(MainFile);
+    const bool Succeeded =
+        Inner.runInvocation(std::move(Invocation), Files,
+                            std::move(PCHContainerOps), DiagConsumer);
+    OnDone(MainFile, Succeeded);
+    return Succeeded;
+  }
+
+private:
+  clang::tooling::ToolAction &Inner;
+  DoneFn OnDone;
+  StartFn OnStart;
+};
+
+// Collects the rewritten main file of the TUs it's passed to, keeping it if
+// it has edits and compiled (for --in-place)
+class RewrittenFile {
+public:
+  RewrittenFile() : OS(Text) {}
+
+  llvm::raw_ostream &getStream() { return OS; }
+  TypeCorrectEditFn getEditCounter() {
+    return [this](const TypeCorrectEdit &, const clang::SourceManager &) {
+      NumEdits++;
+    };
+  }
+  // The TU written to the stream since the last call is over. Returns true
+  // if its file should be saved, as takeText().
+  bool endTU(bool Succeeded) {
+    OS.flush();
+    const bool Keep = Succeeded && NumEdits;
+    if (Keep)
+      Kept = std::move(Text);
+    Text.clear();
+    NumEdits = 0;
+    return Keep;
+  }
+  std::string takeText() { return std::move(Kept); }
+
+private:
+  std::string Text, Kept;
+  llvm::raw_string_ostream OS;
+  unsigned NumEdits = 0;
+};
+} // namespace
+
+// Reports the files `Writer` couldn't save; false if there were any
+static bool reportUnsaved(TypeCorrectFileWriter &Writer,
+                          llvm::raw_ostream &Errs) {
+  const std::vector<std::pair<std::string, std::error_code>> Failures =
+      Writer.flush();
+  for (const auto &Failure : Failures)
+    Errs << "type_correct: unable to save " << Failure.first << ": "
+         << Failure.second.message() << '\n';
+  return Failures.empty();
+}
+
+// Rewriting a serialized AST's main file in place would overwrite the AST,
+// so --in-place passes serialized ASTs over
+static void warnNotSavingAST(llvm::StringRef File, llvm::raw_ostream &Errs) {
+  Errs << "type_correct: not saving " << File
+       << " in place: it's a serialized AST\n";
+}
+
+//===----------------------------------------------------------------------===//
+// Journal
+//===----------------------------------------------------------------------===//
+// What of the options changes a file's output; a journal recorded with
+// other options is started afresh
+static uint64_t getJournalConfig(const TypeCorrectDriverOptions &Options) {
+  std::string Config = Options.InPlace ? "in-place" : "rewrite";
+  for (const std::vector<std::string> *Patterns :
+       {&Options.EditableRoots, &Options.EditIncludes, &Options.EditExcludes}) {
+    Config += '\n';
+    for (const std::string &Pattern : *Patterns) {
+      Config += Pattern;
+      Config += '\0';
+    }
+  }
+  return llvm::xxHash64(Config);
+}
+
+// Record `File` as done, with `Output` and the files read through `Reads`.
+// With --in-place, `SavedPath` (if set) is the main file, saved with
+// `SavedText`: that, not what was read, is what a resumed run should find.
+static void recordDone(TypeCorrectJournal &Journal,
+                       const clang::tooling::CompilationDatabase &Compilations,
+                       llvm::StringRef File,
+                       TypeCorrectRecordingFileSystem &Reads,
+                       llvm::StringRef Output, llvm::StringRef SavedPath,
+                       llvm::StringRef SavedText, llvm::raw_ostream &Errs) {
+  // Describing the inputs reads them through `Reads` again
+  const std::vector<std::string> Paths(Reads.getReads().begin(),
+                                       Reads.getReads().end());
+  std::vector<TypeCorrectJournal::Input> Inputs =
+      TypeCorrectJournal::describeInputs(Reads, Paths);
+  if (!SavedPath.empty()) {
+    llvm::SmallString<256> Saved(SavedPath);
+    llvm::sys::path::remove_dots(Saved, /*remove_dot_dot=*/false);
+    auto It = std::find_if(Inputs.begin(), Inputs.end(),
+                           [&](const TypeCorrectJournal::Input &I) {
+                             return I.Path == Saved;
+                           });
+    if (It == Inputs.end()) {
+      Inputs.emplace_back();
+      It = std::prev(Inputs.end());
+      It->Path = std::string(Saved);
+    }
+    It->Size = SavedText.size();
+    It->MTime = -1;
+    It->Hash = llvm::xxHash64(SavedText);
+  }
+  if (!Journal.record(File,
+                      TypeCorrectJournal::hashCommands(Compilations, File),
+                      Inputs, Output))
+    Errs << "type_correct: unable to record " << File << " in the journal\n";
+}
+
+//===----------------------------------------------------------------------===//
+// Metrics
+//===----------------------------------------------------------------------===//
+// `OnEdit`, also counting each edit by rule in `Metrics` (if set)
+static TypeCorrectEditFn countEdits(TypeCorrectMetrics *Metrics,
+                                    TypeCorrectEditFn OnEdit) {
+  if (!Metrics)
+    return OnEdit;
+  return [Metrics, OnEdit](const TypeCorrectEdit &Edit,
+                           const clang::SourceManager &SM) {
+    Metrics->addEdit(Edit.Rule);
+    if (OnEdit)
+      OnEdit(Edit, SM);
+  };
+}
+
+namespace {
+// Times the phases of the TUs run in this process (workers time their own
+// for the pool), for the history and, if set, the latency histograms
+class PhaseClock {
+public:
+  explicit PhaseClock(TypeCorrectMetrics *Metrics) : Metrics(Metrics) {}
+
+  void start() {
+    Started = PhaseStarted = std::chrono::steady_clock::now();
+    Phase = TypeCorrectPhase::Parse;
+    PhaseSeconds.fill(0);
+  }
+  TypeCorrectPhaseFn getPhaseFn() {
+    return [this](TypeCorrectPhase Next) { enter(Next); };
+  }
+  void stop() {
+    const auto Now = endPhase();
+    if (Metrics)
+      Metrics->observe(TypeCorrectMetrics::Histogram::TUSeconds,
+                       std::chrono::duration<double>(Now - Started).count());
+  }
+  // Time spent in `P` by the TU last stopped
+  double getSeconds(TypeCorrectPhase P) const {
+    return PhaseSeconds[static_cast<unsigned>(P)];
+  }
+
+private:
+  void enter(TypeCorrectPhase Next) {
+    if (Next == Phase)
+      return;
+    PhaseStarted = endPhase();
+    Phase = Next;
+  }
+  std::chrono::steady_clock::time_point endPhase() {
+    const auto Now = std::chrono::steady_clock::now();
+    const double Seconds =
+        std::chrono::duration<double>(Now - PhaseStarted).count();
+    PhaseSeconds[static_cast<unsigned>(Phase)] += Seconds;
+    if (!Metrics)
+      return Now;
+    if (Phase == TypeCorrectPhase::Parse)
+      Metrics->observe(TypeCorrectMetrics::Histogram::ParseSeconds, Seconds);
+    else if (Phase == TypeCorrectPhase::Match)
+      Metrics->observe(TypeCorrectMetrics::Histogram::MatchSeconds, Seconds);
+    return Now;
+  }
+
+  TypeCorrectMetrics *Metrics;
+  std::chrono::steady_clock::time_point Started, PhaseStarted;
+  TypeCorrectPhase Phase = TypeCorrectPhase::Parse;
+  std::array<double, NumTypeCorrectPhases> PhaseSeconds{};
+};
+} // namespace
+
+// Save `History` to `Path`, if set
+static void saveHistory(const TypeCorrectHistory &History,
+                        llvm::StringRef Path, llvm::raw_ostream &Errs) {
+  if (!Path.empty() && !History.save(Path))
+    Errs << "type_correct: unable to save history to " << Path << '\n';
+}
+
+// Add the hits and misses of this process's caches since `Since`, which is
+// then brought up to date
+static void addCacheLookups(TypeCorrectMetrics &Metrics,
+                            const TypeCorrectFileCache &FileCache,
+                            const TypeCorrectInvocationCache &Invocations,
+                            std::array<unsigned, 4> &Since) {
+  const std::array<unsigned, 4> Now = {
+      FileCache.getNumHits(), FileCache.getNumMisses(),
+      Invocations.getNumHits(), Invocations.getNumMisses()};
+  const TypeCorrectMetrics::Counter Counters[] = {
+      TypeCorrectMetrics::Counter::FileCacheHits,
+      TypeCorrectMetrics::Counter::FileCacheMisses,
+      TypeCorrectMetrics::Counter::InvocationCacheHits,
+      TypeCorrectMetrics::Counter::InvocationCacheMisses};
+  for (unsigned Idx = 0; Idx < Now.size(); Idx++)
+    Metrics.add(Counters[Idx], Now[Idx] - Since[Idx]);
+  Since = Now;
+}
+
+// Count a TU a worker was given, timed by the pool
+static void countResult(TypeCorrectMetrics &Metrics,
+                        const TypeCorrectWorkerPool::JobResult &Result) {
+  using Histogram = TypeCorrectMetrics::Histogram;
+  using Counter = TypeCorrectMetrics::Counter;
+  Metrics.observe(
+      Histogram::ParseSeconds,
+      Result.PhaseSeconds[static_cast<unsigned>(TypeCorrectPhase::Parse)]);
+  if (Result.Phase != TypeCorrectPhase::Parse)
+    Metrics.observe(
+        Histogram::MatchSeconds,
+        Result.PhaseSeconds[static_cast<unsigned>(TypeCorrectPhase::Match)]);
+  Metrics.observe(Histogram::TUSeconds, Result.Seconds);
+  switch (Result.Status) {
+  case TypeCorrectWorkerPool::JobStatus::Succeeded:
+    Metrics.add(Counter::TUsSucceeded);
+    break;
+  case TypeCorrectWorkerPool::JobStatus::Failed:
+    Metrics.add(Counter::TUsFailed);
+    break;
+  // Restarts are counted by the pool, which only re-forks a worker when
+  // there is more work for it
+  case TypeCorrectWorkerPool::JobStatus::Crashed:
+    Metrics.add(Counter::TUsCrashed);
+    break;
+  case TypeCorrectWorkerPool::JobStatus::TimedOut:
+    Metrics.add(Counter::TUsTimedOut);
+    break;
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Progress
+//===----------------------------------------------------------------------===//
+namespace {
+// The driver's stderr: whole lines go through `Progress` while it draws a
+// status line, so that they neither race with its thread nor land in the
+// middle of the line, and straight to `OS` otherwise
+class ProgressErrs : public llvm::raw_ostream {
+public:
+  ProgressErrs(llvm::raw_ostream &OS,
+               llvm::Optional<TypeCorrectProgress> &Progress, bool StatusLine)
+      : OS(OS), Progress(Progress), StatusLine(StatusLine) {
+    SetUnbuffered();
+  }
+  ~ProgressErrs() override {
+    if (!Pending.empty())
+      emit(Pending + '\n');
+  }
+
+private:
+  void write_impl(const char *Ptr, size_t Size) override {
+    Pending.append(Ptr, Size);
+    Written += Size;
+    const size_t End = Pending.rfind('\n');
+    if (End == std::string::npos)
+      return;
+    emit(llvm::StringRef(Pending).take_front(End + 1));
+    Pending.erase(0, End + 1);
+  }
+  uint64_t current_pos() const override { return Written; }
+
+  void emit(llvm::StringRef Lines) {
+    if (StatusLine && Progress)
+      Progress->print(Lines);
+    else
+      OS << Lines;
+  }
+
+  llvm::raw_ostream &OS;
+  llvm::Optional<TypeCorrectProgress> &Progress;
+  const bool StatusLine;
+  // Written, but short of the end of a line
+  std::string Pending;
+  uint64_t Written = 0;
+};
+} // namespace
+
+//===----------------------------------------------------------------------===//
+// Driver
+//===----------------------------------------------------------------------===//
+int runTypeCorrect(const clang::tooling::CompilationDatabase &Compilations,
+                   llvm::ArrayRef<std::string> SourcePaths,
+                   const TypeCorrectDriverOptions &Options,
+                   llvm::raw_ostream &Out, llvm::raw_ostream &DirectErrs) {
+  // Started once it's known which files run
+  llvm::Optional<TypeCorrectProgress> Progress;
+  ProgressErrs Errs(DirectErrs, Progress, Options.ProgressLine);
+
+  const clang::tooling::ArgumentsAdjuster ModuleAdjuster =
+      getModuleCacheAdjuster(Options.ModuleCachePath,
+                             Options.PrebuiltModulePaths);
+  // TUs built with the same flags share one driver run (per worker, when
+  // there are workers)
+  TypeCorrectInvocationCache Invocations;
+  // Likewise for header stats and contents
+  TypeCorrectFileCache FileCache;
+
+  llvm::Expected<TypeCorrectPathFilter> EditFilter =
+      TypeCorrectPathFilter::create(Options.EditableRoots,
+                                    Options.EditIncludes, Options.EditExcludes);
+  if (!EditFilter) {
+    Errs << "type_correct: " << llvm::toString(EditFilter.takeError())
+         << '\n';
+    return EXIT_FAILURE;
+  }
+
+  // With --sample, `Files` is the sample and `SourcePaths` the population
+  const bool Sampling = Options.SampleFraction > 0;
+  std::vector<unsigned> SampleIndices;
+  std::vector<std::string> SampleFiles;
+  if (Sampling) {
+    SampleIndices = selectStratifiedSample(
+        SourcePaths, Options.SampleFraction, Options.SampleSeed);
+    for (const unsigned Idx : SampleIndices)
+      SampleFiles.push_back(SourcePaths[Idx]);
+  }
+  const llvm::ArrayRef<std::string> Files =
+      Sampling ? llvm::makeArrayRef(SampleFiles) : SourcePaths;
+
+  const std::vector<unsigned> CanonicalOrder = getCanonicalOrder(Files);
+
+  // Whether TUs report counters rather than rewritten text
+  const bool Counting = Sampling || Options.Summary;
+
+  // With --in-place, rewritten files with edits are saved over the
+  // originals instead of written to `Out`
+  const bool InPlace = Options.InPlace && !Counting;
+  llvm::Optional<TypeCorrectFileWriter> Writer;
+  if (InPlace)
+    Writer.emplace();
+
+  // With --journal or --resume, every file that completes is recorded; with
+  // --resume, the files the journal has up to date are passed over, their
+  // recorded output standing in for theirs
+  std::unique_ptr<TypeCorrectJournal> Journal;
+  if (!Options.JournalPath.empty() && !Counting) {
+    std::string Error;
+    Journal = TypeCorrectJournal::open(
+        Options.JournalPath, getJournalConfig(Options), Options.Resume, Error);
+    if (!Journal) {
+      Errs << "type_correct: " << Error << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+  const auto LookupDone =
+      [&](llvm::StringRef File) -> llvm::Optional<llvm::StringRef> {
+    if (!Journal)
+      return llvm::None;
+    return Journal->lookup(
+        File, TypeCorrectJournal::hashCommands(Compilations, File));
+  };
+
+  // Recorded costs, for the order of isolated runs and the progress ETA
+  TypeCorrectHistory History;
+  if (!Options.HistoryPath.empty())
+    History = TypeCorrectHistory::load(Options.HistoryPath);
+
+  // Created before any worker is forked, so that workers share it
+  llvm::Optional<TypeCorrectMetrics> Metrics;
+  if (!Options.MetricsPath.empty()) {
+    Metrics.emplace();
+    Metrics->startWriting(Options.MetricsPath, /*IntervalSeconds=*/15);
+  }
+  TypeCorrectMetrics *const MetricsOrNull = Metrics ? &*Metrics : nullptr;
+  std::array<unsigned, 4> CacheLookups{};
+
+  const auto StartProgress = [&](llvm::ArrayRef<std::string> ToRun,
+                                 unsigned Parallelism) {
+    if (Options.ProgressLine || !Options.ProgressJSONPath.empty())
+      Progress.emplace(ToRun, History.getSecondsEstimates(ToRun), Parallelism,
+                       Options.ProgressLine ? &DirectErrs : nullptr,
+                       Options.ProgressJSONPath);
+  };
+
+  // Reproducer thresholds need each TU's time and peak RSS, which the pool
+  // measures
+  const bool Thresholds =
+      Options.ReproduceSlowerThanSeconds || Options.ReproduceAboveRSSMB;
+  if (Options.Jobs <= 1 && !Options.Isolate && !Options.TUTimeoutSeconds &&
+      !Thresholds && !Counting) {
+    // Unless disabled, TUs are written by the pipeline's thread while the
+    // next ones are parsed
+    llvm::Optional<TypeCorrectOutputPipeline> Pipeline;
+    if (Options.Pipeline && !InPlace)
+      Pipeline.emplace(Out);
+    StartProgress(Files, 1);
+    llvm::raw_ostream &Printed = Pipeline ? *Pipeline : Out;
+    RewrittenFile Rewritten;
+    // With a journal, each source runs on its own, and its output is held
+    // back until it has been recorded
+    std::string Held;
+    llvm::raw_string_ostream HeldOS(Held);
+    llvm::raw_ostream &TUOut = InPlace   ? Rewritten.getStream()
+                               : Journal ? HeldOS
+                                         : Printed;
+    const TypeCorrectEditFn OnEdit = countEdits(
+        MetricsOrNull, InPlace ? Rewritten.getEditCounter() : nullptr);
+    // Times each TU for the history, as the pool does
+    PhaseClock Clock(MetricsOrNull);
+    const TypeCorrectPhaseFn OnPhase = Clock.getPhaseFn();
+    std::string SavedPath, SavedText;
+    const auto OnTUStart = [&](llvm::StringRef MainFile) {
+      Clock.start();
+      if (Progress && !MainFile.empty())
+        Progress->started(MainFile);
+    };
+    // For a source, its main file is read ahead of clang, which gets the
+    // same buffer from the cache: the TU's chunk then refers to it instead
+    // of copying the output
+    const auto OnSourceStart = [&](llvm::StringRef MainFile) {
+      OnTUStart(MainFile);
+      if (Pipeline && !Journal && !MainFile.empty())
+        if (llvm::ErrorOr<std::shared_ptr<const llvm::MemoryBuffer>> Source =
+                FileCache.getContents(MainFile,
+                                      *llvm::vfs::getRealFileSystem()))
+          Pipeline->setSource(std::move(*Source));
+    };
+    const auto CountTU = [&](llvm::StringRef MainFile, bool Succeeded) {
+      Clock.stop();
+      if (!MainFile.empty())
+        History.record(MainFile, Clock.getSeconds(TypeCorrectPhase::Parse),
+                       Clock.getSeconds(TypeCorrectPhase::Match));
+      if (Metrics)
+        Metrics->add(Succeeded ? TypeCorrectMetrics::Counter::TUsSucceeded
+                               : TypeCorrectMetrics::Counter::TUsFailed);
+    };
+    const auto OnTUDone = [&](llvm::StringRef MainFile, bool Succeeded) {
+      CountTU(MainFile, Succeeded);
+      // No other TU reads it
+      FileCache.dropContents(MainFile);
+      if (Progress && !MainFile.empty())
+        Progress->finished(MainFile, Succeeded);
+      if (Pipeline && !Journal)
+        Pipeline->endChunk();
+      if (!InPlace || !Rewritten.endTU(Succeeded) || MainFile.empty())
+        return;
+      std::string Text = Rewritten.takeText();
+      if (Journal) {
+        SavedPath = MainFile.str();
+        SavedText = Text;
+      }
+      Writer->add(MainFile.str(), std::move(Text));
+    };
+    const auto EndJournaled = [&](llvm::StringRef Path,
+                                  TypeCorrectRecordingFileSystem &Reads,
+                                  bool Succeeded) {
+      HeldOS.flush();
+      Printed << Held;
+      if (Pipeline)
+        Pipeline->endChunk();
+      if (Succeeded)
+        recordDone(*Journal, Compilations, Path, Reads, Held, SavedPath,
+                   SavedText, Errs);
+      Held.clear();
+      SavedPath.clear();
+      SavedText.clear();
+    };
+
+    // Consecutive sources share a TypeCorrectTool (and so its FileManager)
+    int Status = EXIT_SUCCESS;
+    std::vector<std::string> Sources;
+    const auto RunSources = [&] {
+      if (Sources.empty())
+        return;
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS =
+          new TypeCorrectCachingFileSystem(FileCache);
+      llvm::IntrusiveRefCntPtr<TypeCorrectRecordingFileSystem> Reads;
+      if (Journal) {
+        Reads = new TypeCorrectRecordingFileSystem(FS);
+        FS = Reads;
+      }
+      TypeCorrectTool Tool(Compilations, Sources, Invocations, FS);
+      Tool.appendArgumentsAdjuster(ModuleAdjuster);
+      TypeCorrectActionFactory Factory(TUOut, OnPhase, OnEdit, &*EditFilter,
+                                       Options.StreamDecls);
+      AfterEachTU Action(Factory, OnTUDone, OnSourceStart);
+      const bool Succeeded = Tool.run(&Action) == EXIT_SUCCESS;
+      if (!Succeeded)
+        Status = EXIT_FAILURE;
+      if (Journal)
+        EndJournaled(Sources.front(), *Reads, Succeeded);
+      Sources.clear();
+    };
+    for (const unsigned Idx : CanonicalOrder) {
+      const std::string &Path = Files[Idx];
+      if (const llvm::Optional<llvm::StringRef> Output = LookupDone(Path)) {
+        if (Progress)
+          Progress->passOver(Path);
+        RunSources();
+        Printed << *Output;
+        if (Pipeline)
+          Pipeline->endChunk();
+        continue;
+      }
+      if (!isSerializedASTFile(Path)) {
+        Sources.push_back(Path);
+        if (Journal)
+          RunSources();
+        continue;
+      }
+      if (InPlace) {
+        warnNotSavingAST(Path, Errs);
+        if (Progress)
+          Progress->passOver(Path);
+        continue;
+      }
+      // Serialized ASTs skip the driver, preprocessor and Sema entirely
+      RunSources();
+      OnTUStart(Path);
+      const bool Succeeded = typeCorrectASTFile(Path, TUOut, Errs, OnPhase,
+                                                OnEdit, &*EditFilter);
+      CountTU(Path, Succeeded);
+      if (Progress)
+        Progress->finished(Path, Succeeded);
+      if (!Succeeded)
+        Status = EXIT_FAILURE;
+      if (Journal) {
+        TypeCorrectRecordingFileSystem Reads(llvm::vfs::getRealFileSystem());
+        Reads.addRead(Path);
+        EndJournaled(Path, Reads, Succeeded);
+      } else if (Pipeline) {
+        Pipeline->endChunk();
+      }
+    }
+    RunSources();
+    if (Progress)
+      Progress->finish();
+    if (Pipeline)
+      Pipeline->finish();
+    if (Writer && !reportUnsaved(*Writer, Errs))
+      Status = EXIT_FAILURE;
+    if (Metrics) {
+      addCacheLookups(*Metrics, FileCache, Invocations, CacheLookups);
+      Metrics->stopWriting();
+    }
+    saveHistory(History, Options.HistoryPath, Errs);
+    return Status;
+  }
+
+  // Runs in a worker process, one TU at a time. When counting, the TU's
+  // output is its counters rather than its rewritten text.
+  const auto RunOne = [&](llvm::StringRef File, llvm::raw_ostream &TUOut,
+                          const TypeCorrectPhaseFn &OnPhase) {
+    TypeCorrectCounters Counts;
+    TypeCorrectEditFn OnEdit;
+    if (Counting)
+      OnEdit = [&](const TypeCorrectEdit &Edit, const clang::SourceManager &) {
+        Counts.add((RuleCounterPrefix + Edit.Rule).str());
+        Counts.add((ChangeCounterPrefix + Edit.Rule + "\t" + Edit.FromType +
+                    "\t" + Edit.ToType)
+                       .str());
+      };
+    // With --in-place, the TU's output is its rewritten file if it's to be
+    // saved (of the last of its compile commands that is), else nothing
+    RewrittenFile Rewritten;
+    if (InPlace)
+      OnEdit = Rewritten.getEditCounter();
+    OnEdit = countEdits(MetricsOrNull, std::move(OnEdit));
+    // With a journal, the output is held back until it has been recorded
+    std::string Held;
+    llvm::raw_string_ostream HeldOS(Held);
+    llvm::raw_ostream &TextOut = Counting  ? llvm::nulls()
+                                 : InPlace ? Rewritten.getStream()
+                                 : Journal ? HeldOS
+                                           : TUOut;
+    std::string SavedPath, Saved;
+    const auto OnTUDone = [&](llvm::StringRef MainFile, bool Succeeded) {
+      FileCache.dropContents(MainFile);
+      if (InPlace && Rewritten.endTU(Succeeded)) {
+        SavedPath = MainFile.str();
+        Saved = Rewritten.takeText();
+      }
+    };
+
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS =
+        new TypeCorrectCachingFileSystem(FileCache);
+    llvm::IntrusiveRefCntPtr<TypeCorrectRecordingFileSystem> Reads;
+    if (Journal) {
+      Reads = new TypeCorrectRecordingFileSystem(FS);
+      FS = Reads;
+    }
+    // Straight to stderr, as the compiler's diagnostics are: the status
+    // line's lock may have been held when this worker was forked
+    bool Succeeded;
+    if (isSerializedASTFile(File)) {
+      Succeeded = typeCorrectASTFile(File, TextOut, DirectErrs, OnPhase, OnEdit,
+                                     &*EditFilter);
+      if (Reads)
+        Reads->addRead(File);
+    } else {
+      TypeCorrectTool Tool(Compilations, {File.str()}, Invocations, FS);
+      Tool.appendArgumentsAdjuster(ModuleAdjuster);
+      TypeCorrectActionFactory Factory(TextOut, OnPhase, OnEdit, &*EditFilter,
+                                       Options.StreamDecls);
+      AfterEachTU Action(Factory, OnTUDone);
+      Succeeded = Tool.run(&Action) == EXIT_SUCCESS;
+    }
+    // The pool times and counts the TU itself; only the caches are this
+    // worker's to report
+    if (Metrics)
+      addCacheLookups(*Metrics, FileCache, Invocations, CacheLookups);
+    if (Counting)
+      Counts.write(TUOut);
+    if (InPlace)
+      TUOut << Saved;
+    if (Journal) {
+      HeldOS.flush();
+      TUOut << Held;
+      if (Succeeded)
+        recordDone(*Journal, Compilations, File, *Reads, Held, SavedPath,
+                   Saved, DirectErrs);
+    }
+    return Succeeded;
+  };
+
+  TypeCorrectWorkerPool::Options PoolOpts;
+  PoolOpts.NumWorkers = Options.Jobs;
+  PoolOpts.TimeoutSeconds = Options.TUTimeoutSeconds;
+  PoolOpts.MemoryBudgetBytes = static_cast<uint64_t>(Options.MemoryBudgetMB)
+                               << 20;
+  if (Metrics)
+    PoolOpts.OnRestart = [&] {
+      Metrics->add(TypeCorrectMetrics::Counter::WorkerRestarts);
+    };
+  TypeCorrectWorkerPool Pool(PoolOpts, RunOne);
+
+  // Indices into `Files` of the files to run: with --resume, those the
+  // journal has up to date are done already. With --in-place, serialized
+  // ASTs are passed over here rather than sent to a worker.
+  std::vector<unsigned> Pending;
+  std::vector<std::string> PendingFiles;
+  std::vector<std::pair<unsigned, llvm::StringRef>> Done;
+  for (unsigned Idx = 0; Idx < Files.size(); Idx++) {
+    if (const llvm::Optional<llvm::StringRef> Output =
+            LookupDone(Files[Idx])) {
+      Done.emplace_back(Idx, *Output);
+      continue;
+    }
+    if (InPlace && isSerializedASTFile(Files[Idx])) {
+      warnNotSavingAST(Files[Idx], Errs);
+      continue;
+    }
+    Pending.push_back(Idx);
+    PendingFiles.push_back(Files[Idx]);
+  }
+
+  const std::vector<unsigned> Order = History.orderLongestFirst(PendingFiles);
+  const std::vector<uint64_t> PeakRSS =
+      Options.MemoryBudgetMB ? History.getPeakRSSEstimates(PendingFiles)
+                             : std::vector<uint64_t>();
+
+  int Status = EXIT_SUCCESS;
+  std::vector<std::pair<std::string, TypeCorrectWorkerPool::JobResult>>
+      Skipped;
+  // TUs to write a reproducer for, and why
+  struct ReproduceEntry {
+    std::string File;
+    std::string Reason;
+    TypeCorrectWorkerPool::JobResult Result;
+  };
+  std::vector<ReproduceEntry> Reproduce;
+  ReorderBuffer Merged(CanonicalOrder, Out);
+  if (!InPlace)
+    for (const auto &File : Done)
+      Merged.add(File.first, File.second.str());
+  TypeCorrectSampleEstimate Estimate(
+      Sampling ? SourcePaths : llvm::ArrayRef<std::string>(),
+      Options.SampleFraction);
+  TypeCorrectSummary Summary;
+  StartProgress(PendingFiles, Options.Jobs);
+  const auto OnStart = [&](llvm::StringRef File) {
+    if (Progress)
+      Progress->started(File);
+  };
+  const auto OnResult = [&](llvm::StringRef File,
+                            const TypeCorrectWorkerPool::JobResult &Result) {
+    if (Progress)
+      Progress->finished(
+          File, Result.Status == TypeCorrectWorkerPool::JobStatus::Succeeded);
+    if (Metrics)
+      countResult(*Metrics, Result);
+    const unsigned Index = Pending[Result.Index];
+    if (InPlace) {
+      if (Result.Status == TypeCorrectWorkerPool::JobStatus::Succeeded &&
+          !Result.Output.empty())
+        Writer->add(File.str(), Result.Output);
+    } else if (!Counting) {
+      Merged.add(Index, Result.Output);
+    } else if (Result.Status == TypeCorrectWorkerPool::JobStatus::Succeeded ||
+               Result.Status == TypeCorrectWorkerPool::JobStatus::Failed) {
+      TypeCorrectCounters Counts;
+      if (Counts.read(Result.Output)) {
+        if (Sampling)
+          Estimate.record(SampleIndices[Index], Counts);
+        if (Options.Summary)
+          Summary.add(File, Counts);
+      }
+    }
+    // A skipped TU's costs are lower bounds, which still moves it forward
+    if (Result.Status != TypeCorrectWorkerPool::JobStatus::Crashed)
+      History.record(
+          File,
+          Result.PhaseSeconds[static_cast<unsigned>(TypeCorrectPhase::Parse)],
+          Result.PhaseSeconds[static_cast<unsigned>(TypeCorrectPhase::Match)],
+          Result.PeakRSSBytes);
+
+    std::string Reason;
+    llvm::raw_string_ostream ReasonOS(Reason);
+    switch (Result.Status) {
+    case TypeCorrectWorkerPool::JobStatus::Succeeded:
+    case TypeCorrectWorkerPool::JobStatus::Failed:
+      if (Result.Status == TypeCorrectWorkerPool::JobStatus::Failed)
+        Status = EXIT_FAILURE;
+      // Done, but over a threshold: reproduced for the record
+      if (Options.ReproduceSlowerThanSeconds &&
+          Result.Seconds > Options.ReproduceSlowerThanSeconds)
+        ReasonOS << "slow TU " << File << ": took "
+                 << llvm::format("%.1f", Result.Seconds) << "s, over "
+                 << Options.ReproduceSlowerThanSeconds << 's';
+      else if (Options.ReproduceAboveRSSMB &&
+               Result.PeakRSSBytes >
+                   static_cast<uint64_t>(Options.ReproduceAboveRSSMB) << 20)
+        ReasonOS << "memory-hungry TU " << File << ": peak RSS of "
+                 << (Result.PeakRSSBytes >> 20) << " MiB, over "
+                 << Options.ReproduceAboveRSSMB << " MiB";
+      else
+        return;
+      break;
+    case TypeCorrectWorkerPool::JobStatus::TimedOut:
+      Skipped.emplace_back(File.str(), Result);
+      ReasonOS << "skipped " << File << ": exceeded the "
+               << Options.TUTimeoutSeconds << "s time budget in the "
+               << getPhaseName(Result.Phase) << " phase";
+      break;
+    case TypeCorrectWorkerPool::JobStatus::Crashed:
+      Status = EXIT_FAILURE;
+      ReasonOS << "crashed on " << File << " in the "
+               << getPhaseName(Result.Phase) << " phase";
+      if (Result.TermSignal)
+        ReasonOS << " (signal " << Result.TermSignal << ')';
+      ReasonOS << " after " << llvm::format("%.1f", Result.Seconds) << 's';
+      break;
+    }
+
+    Errs << "type_correct: " << ReasonOS.str() << '\n';
+    Reproduce.push_back({File.str(), ReasonOS.str(), Result});
+    // Not part of the bundle
+    Reproduce.back().Result.Output = std::string();
+  };
+  Pool.run(PendingFiles, OnResult, Order, PeakRSS, OnStart);
+
+  if (Progress)
+    Progress->finish();
+  // Bundled once the pool is done, so that inlining a TU's includes holds up
+  // neither the workers waiting for jobs nor the watchdog. It only
+  // preprocesses, so the TU's budget is plenty.
+  for (const ReproduceEntry &Entry : Reproduce) {
+    const std::string Reproducer = writeReproducer(
+        Compilations, Entry.File, Options.ReproducerDir, Entry.Reason,
+        Entry.Result,
+        Options.TUTimeoutSeconds ? Options.TUTimeoutSeconds
+                                 : DefaultReproducerTimeoutSeconds);
+    if (!Reproducer.empty())
+      Errs << "type_correct: reproducer for " << Entry.File << ": "
+           << Reproducer << '\n';
+  }
+  if (Metrics)
+    Metrics->stopWriting();
+  if (Writer && !reportUnsaved(*Writer, Errs))
+    Status = EXIT_FAILURE;
+  if (Sampling)
+    Estimate.print(Out);
+  if (Options.Summary) {
+    Summary.printTable(Out);
+    if (!Options.SummaryJSONPath.empty()) {
+      std::error_code EC;
+      llvm::raw_fd_ostream JSON(Options.SummaryJSONPath, EC,
+                                llvm::sys::fs::OF_Text);
+      if (EC)
+        Errs << "type_correct: unable to write " << Options.SummaryJSONPath
+             << ": " << EC.message() << '\n';
+      else
+        Summary.writeJSON(JSON);
+    }
+  }
+
+  saveHistory(History, Options.HistoryPath, Errs);
+  if (!Options.SkippedReportPath.empty()) {
+    std::stable_sort(Skipped.begin(), Skipped.end(),
+                     [](const auto &L, const auto &R) {
+                       return L.first < R.first;
+                     });
+    writeSkippedReport(Options.SkippedReportPath, Skipped, Errs);
+  }
+  return Status;
+}
@@ -0,0 +1,110 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectDriver.h
+//
+// DESCRIPTION: Header for TypeCorrectDriver.cpp (runs TypeCorrect over a set
+// of TUs, in-process or in crash-isolated worker processes)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTDRIVER_H
+#define TYPECORRECT_TYPECORRECTDRIVER_H
+
+#include <string>
+#include <vector>
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+struct TYPE_CORRECT_EXPORT TypeCorrectDriverOptions {
+  // Number of worker processes; more than one implies `Isolate`
+  unsigned Jobs = 1;
+  // Run every TU in a forked worker, so a crash only loses that one TU
+  bool Isolate = false;
+  // Match each top-level function and variable as soon as it's parsed,
+  // rather than the whole TU once it's parsed (see TypeCorrectASTConsumer)
+  bool StreamDecls = false;
+  // In-process runs only: write each TU's output on a thread of its own
+  // while the next TU is parsed (see TypeCorrectOutputPipeline)
+  bool Pipeline = true;
+  // Per-TU time budget in seconds, enforced by a watchdog that kills the
+  // worker; the TU is recorded as skipped, along with the phase it was in.
+  // 0 means no limit. Implies `Isolate`.
+  unsigned TUTimeoutSeconds = 0;
+  // If set, a JSON array of the TUs skipped for exceeding their time budget
+  // is written here
+  std::string SkippedReportPath;
+  // Per-file parse and match costs from earlier runs, used to dispatch the
+  // longest TUs first, and updated with this run's costs; empty disables
+  std::string HistoryPath;
+  // Only start another TU while the predicted peak RSS of every TU in flight
+  // stays within this many MiB (predictions come from the history, or from
+  // file size); 0 means unlimited
+  unsigned MemoryBudgetMB = 0;
+  // Besides crashed and hung TUs, those that take longer than this many
+  // seconds or peak above this many MiB of RSS get a reproducer (see
+  // writeReproducer); 0 means no threshold. Either implies `Isolate`.
+  unsigned ReproduceSlowerThanSeconds = 0;
+  unsigned ReproduceAboveRSSMB = 0;
+  // Where reproducers are written; empty means the system temporary
+  // directory
+  std::string ReproducerDir;
+  // If in (0, 1], only a stratified random sample of this fraction of the TUs
+  // is processed (see selectStratifiedSample), and instead of rewritten
+  // output, estimated edit counts for all TUs are written
+  double SampleFraction = 0;
+  uint64_t SampleSeed = 0;
+  // Instead of rewritten output, write a table of edit counts per rule, type
+  // change and directory (see TypeCorrectSummary), and its JSON form to
+  // `SummaryJSONPath` if set
+  bool Summary = false;
+  std::string SummaryJSONPath;
+  // Instead of writing rewritten output, save each main file that has edits
+  // over the original (see TypeCorrectFileWriter); TUs that fail to compile
+  // are left alone. Ignored with `SampleFraction` or `Summary`.
+  bool InPlace = false;
+  // If set, each file that completes is recorded in the journal there (see
+  // TypeCorrectJournal), started afresh. With `Resume`, the journal's
+  // entries are kept instead, and the files they show to be up to date
+  // aren't run again: their recorded output is used. Ignored with
+  // `SampleFraction` or `Summary`.
+  std::string JournalPath;
+  bool Resume = false;
+  // Report progress (files done, throughput, the slowest file in flight and
+  // an ETA; see TypeCorrectProgress) on a status line written to `Errs`,
+  // which should then be a terminal, and/or as JSON rewritten at
+  // `ProgressJSONPath`. The driver's own messages are written above the
+  // status line; compiler diagnostics aren't, and break into it.
+  bool ProgressLine = false;
+  std::string ProgressJSONPath;
+  // If set, latency histograms and counters for the run (see
+  // TypeCorrectMetrics) are kept in this Prometheus textfile, rewritten
+  // every 15 seconds and at the end
+  std::string MetricsPath;
+  // Only files under one of these directories (if any), matching one of the
+  // include globs (if any) and none of the exclude globs are edited; see
+  // TypeCorrectPathFilter
+  std::vector<std::string> EditableRoots;
+  std::vector<std::string> EditIncludes;
+  std::vector<std::string> EditExcludes;
+  // See getModuleCacheAdjuster
+  std::string ModuleCachePath;
+  std::vector<std::string> PrebuiltModulePaths;
+};
+
+// Run TypeCorrect over every file of `SourcePaths` (sources or `.ast` files),
+// writing rewritten output to `Out` (unless saving it in place), in byte-wise
+// order of the paths whatever the parallelism, and diagnostics to `Errs`. Returns
+// EXIT_SUCCESS or EXIT_FAILURE; TUs skipped for exceeding their time budget
+// are reported but don't fail the run.
+TYPE_CORRECT_EXPORT int
+runTypeCorrect(const clang::tooling::CompilationDatabase &Compilations,
+               llvm::ArrayRef<std::string> SourcePaths,
+               const TypeCorrectDriverOptions &Options, llvm::raw_ostream &Out,
+               llvm::raw_ostream &Errs);
+
+#endif /* TYPECORRECT_TYPECORRECTDRIVER_H */
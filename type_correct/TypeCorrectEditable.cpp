@@ -0,0 +1,98 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectEditable.cpp
+//
+// DESCRIPTION:
+//    Editable roots and include/exclude globs. A TU's matches are mostly in
+//    headers, and often in code that will never be written (system and
+//    third-party headers, generated code); rules check a match's location
+//    against the main file's offsets before doing any work on it, so such
+//    matches cost two comparisons.
+//
+// License: CC0
+//==============================================================================
+
+#include <clang/Basic/FileManager.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/StringSaver.h>
+
+#include "TypeCorrectEditable.h"
+#include "TypeCorrectPath.h"
+
+llvm::Expected<TypeCorrectPathFilter>
+TypeCorrectPathFilter::create(llvm::ArrayRef<std::string> Roots,
+                              llvm::ArrayRef<std::string> Includes,
+                              llvm::ArrayRef<std::string> Excludes) {
+  TypeCorrectPathFilter Filter;
+  for (const std::string &Root : Roots) {
+    std::string Normalized = getNormalizedPath(Root);
+    while (Normalized.size() > 1 &&
+           llvm::sys::path::is_separator(Normalized.back()))
+      Normalized.pop_back();
+    Filter.Roots.push_back(std::move(Normalized));
+  }
+
+  llvm::StringSaver Saver(Filter.PatternText);
+  const auto AddGlobs = [&](llvm::ArrayRef<std::string> Patterns,
+                            std::vector<llvm::GlobPattern> &Globs)
+      -> llvm::Error {
+    for (const std::string &Pattern : Patterns) {
+      llvm::Expected<llvm::GlobPattern> Glob =
+          llvm::GlobPattern::create(Saver.save(Pattern));
+      if (!Glob)
+        return llvm::createStringError(
+            llvm::inconvertibleErrorCode(), "invalid glob '%s': %s",
+            Pattern.c_str(), llvm::toString(Glob.takeError()).c_str());
+      Globs.push_back(std::move(*Glob));
+    }
+    return llvm::Error::success();
+  };
+  if (llvm::Error E = AddGlobs(Includes, Filter.Includes))
+    return E;
+  if (llvm::Error E = AddGlobs(Excludes, Filter.Excludes))
+    return E;
+  return Filter;
+}
+
+bool TypeCorrectPathFilter::isEditable(llvm::StringRef Path) const {
+  if (empty())
+    return true;
+  const std::string Normalized = getNormalizedPath(Path);
+  const llvm::StringRef P = Normalized;
+
+  if (!Roots.empty() && llvm::none_of(Roots, [&](llvm::StringRef Root) {
+        return P.startswith(Root) &&
+               (P.size() == Root.size() ||
+                llvm::sys::path::is_separator(Root.back()) ||
+                llvm::sys::path::is_separator(P[Root.size()]));
+      }))
+    return false;
+  const auto Matches = [&](const llvm::GlobPattern &Glob) {
+    return Glob.match(P);
+  };
+  if (!Includes.empty() && llvm::none_of(Includes, Matches))
+    return false;
+  return llvm::none_of(Excludes, Matches);
+}
+
+TypeCorrectEditableFiles::TypeCorrectEditableFiles(
+    const clang::SourceManager &SM, const TypeCorrectPathFilter *Filter)
+    : MainFID(SM.getMainFileID()) {
+  if (MainFID.isInvalid())
+    return;
+  MainBegin = SM.getLocForStartOfFile(MainFID).getOffset();
+  MainEnd = MainBegin + SM.getFileIDSize(MainFID);
+  if (!Filter || Filter->empty()) {
+    MainEditable = true;
+    return;
+  }
+  const clang::FileEntry *Entry = SM.getFileEntryForID(MainFID);
+  if (!Entry)
+    return;
+  // Relative to the compile command's directory, not ours
+  llvm::SmallString<256> Path(Entry->getName());
+  SM.getFileManager().makeAbsolutePath(Path);
+  MainEditable = Filter->isEditable(Path);
+}
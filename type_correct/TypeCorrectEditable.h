@@ -0,0 +1,80 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectEditable.h
+//
+// DESCRIPTION: Header for TypeCorrectEditable.cpp (which files may be edited:
+// editable roots and include/exclude globs, and a per-TU check that lets
+// rules skip read-only code at the cost of a comparison)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTEDITABLE_H
+#define TYPECORRECT_TYPECORRECTEDITABLE_H
+
+#include <string>
+#include <vector>
+
+#include <clang/Basic/SourceManager.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/GlobPattern.h>
+
+#include "type_correct_export.h"
+
+// Which paths may be edited: those under one of the roots (if any are
+// given), matching one of the include globs (if any) and none of the
+// exclude globs. Roots and globs are matched against the absolute path with
+// `.` and `..` removed; in a glob, `*` also matches `/`.
+class TYPE_CORRECT_EXPORT TypeCorrectPathFilter {
+public:
+  // Fails on a malformed glob
+  static llvm::Expected<TypeCorrectPathFilter>
+  create(llvm::ArrayRef<std::string> Roots,
+         llvm::ArrayRef<std::string> Includes,
+         llvm::ArrayRef<std::string> Excludes);
+
+  // True if nothing is filtered out
+  bool empty() const {
+    return Roots.empty() && Includes.empty() && Excludes.empty();
+  }
+  bool isEditable(llvm::StringRef Path) const;
+
+private:
+  std::vector<std::string> Roots;
+  std::vector<llvm::GlobPattern> Includes, Excludes;
+  // A GlobPattern refers into its pattern text
+  llvm::BumpPtrAllocator PatternText;
+};
+
+// Which locations of a TU may be edited. A file is editable if TypeCorrect
+// writes it and its path passes the filter; only the main file is written, so
+// that is decided once, and a location is checked against the main file's
+// range of source offsets without looking its FileID up.
+class TYPE_CORRECT_EXPORT TypeCorrectEditableFiles {
+public:
+  // Without `Filter`, every path passes
+  TypeCorrectEditableFiles(const clang::SourceManager &SM,
+                           const TypeCorrectPathFilter *Filter);
+
+  bool isEditable(clang::FileID FID) const {
+    return MainEditable && FID == MainFID;
+  }
+  // False for locations inside macro expansions, which can't be edited
+  bool isEditable(clang::SourceLocation Loc) const {
+    return MainEditable && Loc.isFileID() && Loc.getOffset() >= MainBegin &&
+           Loc.getOffset() <= MainEnd;
+  }
+
+private:
+  clang::FileID MainFID;
+  bool MainEditable = false;
+  // The offsets of the main file's first and end-of-file locations; a
+  // FileID's locations are a contiguous range of offsets, shared with no
+  // other FileID
+  unsigned MainBegin = 0, MainEnd = 0;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTEDITABLE_H */
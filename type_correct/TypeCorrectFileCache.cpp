@@ -0,0 +1,195 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectFileCache.cpp
+//
+// DESCRIPTION:
+//    Each TU gets a fresh FileManager, so without help every TU of a run
+//    re-stats the include path for every header and re-reads every header it
+//    finds. TypeCorrectFileCache keeps both for the run, along the lines of
+//    clang's dependency-scanning filesystem: the I/O for a header is paid
+//    once, by whichever TU includes it first. A main file is only read by
+//    its own TU, so the driver drops its contents when the TU ends rather
+//    than keep every source of the run resident (in each worker, too).
+//
+// License: CC0
+//==============================================================================
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectFileCache.h"
+
+//===----------------------------------------------------------------------===//
+// Cache
+//===----------------------------------------------------------------------===//
+TypeCorrectFileCache::Shard &
+TypeCorrectFileCache::getShard(llvm::StringRef AbsPath) {
+  return Shards[llvm::hash_value(AbsPath) % Shards.size()];
+}
+
+TypeCorrectFileCache::Entry &
+TypeCorrectFileCache::getEntry(llvm::StringRef AbsPath,
+                               llvm::vfs::FileSystem &Underlying) {
+  Shard &S = getShard(AbsPath);
+  {
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+    const auto It = S.Entries.find(AbsPath);
+    if (It != S.Entries.end()) {
+      Hits++;
+      return It->second;
+    }
+  }
+
+  // Stat without the lock; if another thread got there first, its result
+  // stands (StringMap entries don't move, so references stay valid)
+  Misses++;
+  Entry New;
+  New.Stat = Underlying.status(AbsPath);
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+  return S.Entries.try_emplace(AbsPath, std::move(New)).first->second;
+}
+
+llvm::ErrorOr<std::shared_ptr<const llvm::MemoryBuffer>>
+TypeCorrectFileCache::getContents(Entry &E, llvm::StringRef AbsPath,
+                                  llvm::vfs::FileSystem &Underlying) {
+  if (!E.Stat)
+    return E.Stat.getError();
+  if (!E.Stat->isRegularFile())
+    return std::make_error_code(std::errc::invalid_argument);
+
+  Shard &S = getShard(AbsPath);
+  {
+    std::lock_guard<std::mutex> Lock(S.Mutex);
+    if (E.Contents) {
+      Hits++;
+      return E.Contents;
+    }
+  }
+
+  Misses++;
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> File =
+      Underlying.openFileForRead(AbsPath);
+  if (!File)
+    return File.getError();
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      (*File)->getBuffer(AbsPath, E.Stat->getSize(),
+                         /*RequiresNullTerminator=*/true,
+                         /*IsVolatile=*/false);
+  if (!Buffer)
+    return Buffer.getError();
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+  if (!E.Contents)
+    E.Contents = std::move(*Buffer);
+  return E.Contents;
+}
+
+// `AbsPath` keyed as TypeCorrectCachingFileSystem keys it
+static llvm::SmallString<256> getKey(llvm::StringRef AbsPath) {
+  llvm::SmallString<256> Key(AbsPath);
+  llvm::sys::path::remove_dots(Key, /*remove_dot_dot=*/false);
+  return Key;
+}
+
+llvm::ErrorOr<std::shared_ptr<const llvm::MemoryBuffer>>
+TypeCorrectFileCache::getContents(llvm::StringRef AbsPath,
+                                  llvm::vfs::FileSystem &Underlying) {
+  const llvm::SmallString<256> Key = getKey(AbsPath);
+  return getContents(getEntry(Key, Underlying), Key, Underlying);
+}
+
+void TypeCorrectFileCache::dropContents(llvm::StringRef AbsPath) {
+  const llvm::SmallString<256> Key = getKey(AbsPath);
+  Shard &S = getShard(Key);
+  std::lock_guard<std::mutex> Lock(S.Mutex);
+  const auto It = S.Entries.find(Key);
+  if (It != S.Entries.end())
+    It->second.Contents.reset();
+}
+
+//===----------------------------------------------------------------------===//
+// Filesystem
+//===----------------------------------------------------------------------===//
+namespace {
+// A view of cached contents under another name, which keeps them alive
+class SharedBuffer : public llvm::MemoryBuffer {
+public:
+  SharedBuffer(std::shared_ptr<const llvm::MemoryBuffer> Contents,
+               std::string Name, bool RequiresNullTerminator)
+      : Contents(std::move(Contents)), Name(std::move(Name)) {
+    init(this->Contents->getBufferStart(), this->Contents->getBufferEnd(),
+         RequiresNullTerminator);
+  }
+
+  llvm::StringRef getBufferIdentifier() const override { return Name; }
+  BufferKind getBufferKind() const override {
+    return Contents->getBufferKind();
+  }
+
+private:
+  std::shared_ptr<const llvm::MemoryBuffer> Contents;
+  std::string Name;
+};
+
+// A file whose contents live in the cache. Buffers handed out refer to them
+// rather than copy them.
+class CachedFile : public llvm::vfs::File {
+public:
+  CachedFile(llvm::vfs::Status Stat,
+             std::shared_ptr<const llvm::MemoryBuffer> Contents)
+      : Stat(std::move(Stat)), Contents(std::move(Contents)) {}
+
+  llvm::ErrorOr<llvm::vfs::Status> status() override { return Stat; }
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+  getBuffer(const llvm::Twine &Name, int64_t, bool RequiresNullTerminator,
+            bool) override {
+    return std::unique_ptr<llvm::MemoryBuffer>(
+        new SharedBuffer(Contents, Name.str(), RequiresNullTerminator));
+  }
+  std::error_code close() override { return std::error_code(); }
+
+private:
+  llvm::vfs::Status Stat;
+  std::shared_ptr<const llvm::MemoryBuffer> Contents;
+};
+} // namespace
+
+TypeCorrectCachingFileSystem::TypeCorrectCachingFileSystem(
+    TypeCorrectFileCache &Cache,
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> Underlying)
+    : ProxyFileSystem(std::move(Underlying)), Cache(Cache) {}
+
+// `Path` made absolute against the working directory, without `.`
+// components. `..` is kept, as it can't be resolved without following
+// symlinks.
+static llvm::SmallString<256> getCacheKey(llvm::vfs::FileSystem &FS,
+                                          const llvm::Twine &Path) {
+  llvm::SmallString<256> AbsPath;
+  Path.toVector(AbsPath);
+  FS.makeAbsolute(AbsPath);
+  return getKey(AbsPath);
+}
+
+llvm::ErrorOr<llvm::vfs::Status>
+TypeCorrectCachingFileSystem::status(const llvm::Twine &Path) {
+  const llvm::SmallString<256> Key = getCacheKey(*this, Path);
+  const TypeCorrectFileCache::Entry &E =
+      Cache.getEntry(Key, getUnderlyingFS());
+  if (!E.Stat)
+    return E.Stat.getError();
+  // Under the name it was asked for, as the FileManager expects
+  return llvm::vfs::Status::copyWithNewName(*E.Stat, Path);
+}
+
+llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+TypeCorrectCachingFileSystem::openFileForRead(const llvm::Twine &Path) {
+  const llvm::SmallString<256> Key = getCacheKey(*this, Path);
+  TypeCorrectFileCache::Entry &E = Cache.getEntry(Key, getUnderlyingFS());
+  llvm::ErrorOr<std::shared_ptr<const llvm::MemoryBuffer>> Contents =
+      Cache.getContents(E, Key, getUnderlyingFS());
+  if (!Contents)
+    return Contents.getError();
+  return std::unique_ptr<llvm::vfs::File>(new CachedFile(
+      llvm::vfs::Status::copyWithNewName(*E.Stat, Path),
+      std::move(*Contents)));
+}
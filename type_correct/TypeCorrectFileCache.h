@@ -0,0 +1,98 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectFileCache.h
+//
+// DESCRIPTION: Header for TypeCorrectFileCache.cpp (a run-wide, thread-safe
+// cache of stat results and file contents, and the per-tool filesystem that
+// reads through it)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTFILECACHE_H
+#define TYPECORRECT_TYPECORRECTFILECACHE_H
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <system_error>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include "type_correct_export.h"
+
+// Stat results (failures included, as header search mostly probes paths
+// that don't exist) and file contents, by absolute path, for the whole run:
+// files are assumed not to change while TypeCorrect runs. Stat results are
+// never evicted; contents are kept until dropContents(), and the buffers
+// handed out share ownership of them. Thread-safe; the lock is sharded by
+// path.
+class TYPE_CORRECT_EXPORT TypeCorrectFileCache {
+public:
+  struct Entry {
+    llvm::ErrorOr<llvm::vfs::Status> Stat = std::error_code();
+    // Set when the file is first read, and again after dropContents()
+    std::shared_ptr<const llvm::MemoryBuffer> Contents;
+  };
+
+  // The entry for `AbsPath`, with its stat result filled in by `Underlying`
+  // if it's new
+  Entry &getEntry(llvm::StringRef AbsPath, llvm::vfs::FileSystem &Underlying);
+  // The contents of the (regular) file at `AbsPath`, read by `Underlying` the
+  // first time they're asked for
+  llvm::ErrorOr<std::shared_ptr<const llvm::MemoryBuffer>>
+  getContents(Entry &E, llvm::StringRef AbsPath,
+              llvm::vfs::FileSystem &Underlying);
+  // The same, for an absolute path as TypeCorrectCachingFileSystem would be
+  // asked for it (`.` components and all)
+  llvm::ErrorOr<std::shared_ptr<const llvm::MemoryBuffer>>
+  getContents(llvm::StringRef AbsPath, llvm::vfs::FileSystem &Underlying);
+  // Let go of the contents of `AbsPath`, once no other TU is expected to
+  // read them: a main file, when its TU is over. Buffers handed out keep
+  // them alive; a later read goes to the filesystem again.
+  void dropContents(llvm::StringRef AbsPath);
+
+  // Lookups answered from the cache, and those that went to the filesystem
+  unsigned getNumHits() const { return Hits; }
+  unsigned getNumMisses() const { return Misses; }
+
+private:
+  struct Shard {
+    std::mutex Mutex;
+    llvm::StringMap<Entry> Entries;
+  };
+  Shard &getShard(llvm::StringRef AbsPath);
+
+  std::array<Shard, 64> Shards;
+  std::atomic<unsigned> Hits{0}, Misses{0};
+};
+
+// A filesystem with its own working directory that answers status() and
+// openFileForRead() from a shared TypeCorrectFileCache, so that the headers
+// every TU includes are stat'ed and read once per run. Everything else
+// (directory iteration, real paths, ...) goes to the underlying filesystem.
+// Like any VFS with a working directory, one instance shouldn't be used by
+// several threads at once; they share the cache instead.
+class TYPE_CORRECT_EXPORT TypeCorrectCachingFileSystem
+    : public llvm::vfs::ProxyFileSystem {
+public:
+  // `Cache` must outlive the filesystem
+  TypeCorrectCachingFileSystem(
+      TypeCorrectFileCache &Cache,
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> Underlying =
+          llvm::vfs::createPhysicalFileSystem().release());
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &Path) override;
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+  openFileForRead(const llvm::Twine &Path) override;
+
+private:
+  TypeCorrectFileCache &Cache;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTFILECACHE_H */
@@ -0,0 +1,427 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectFileWriter.cpp
+//
+// DESCRIPTION:
+//    Saving a rewritten file safely takes a stat, a create, one or more
+//    writes, a close and a rename. Done one file after the other that's five
+//    round trips into the kernel per file, which dominates a rewrite of tens
+//    of thousands of files. The io_uring backend instead submits each step
+//    for a whole batch of files at once and waits for the batch; it talks to
+//    the kernel directly (io_uring_setup/enter/register), so there's no
+//    liburing dependency. It needs Linux 5.11 (for renameat and unlinkat);
+//    where those or io_uring itself are missing, or io_uring is disabled,
+//    the batch's files are saved in parallel by a thread pool instead.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/raw_ostream.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define TYPE_CORRECT_HAVE_IO_URING 1
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "TypeCorrectFileWriter.h"
+
+//===----------------------------------------------------------------------===//
+// io_uring
+//===----------------------------------------------------------------------===//
+#ifdef TYPE_CORRECT_HAVE_IO_URING
+class TypeCorrectFileWriter::IOUring {
+public:
+  // Null if io_uring can't be set up, or lacks one of the operations used
+  static std::unique_ptr<IOUring> create(unsigned Entries);
+  ~IOUring();
+
+  // Runs `Ops`, as many at a time as the ring holds, and returns the result
+  // of each (a completion's `res`: negated errno on failure), in order
+  std::vector<int> run(llvm::ArrayRef<io_uring_sqe> Ops);
+
+private:
+  IOUring() = default;
+
+  int Fd = -1;
+  void *SQRing = MAP_FAILED, *CQRing = MAP_FAILED;
+  size_t SQRingSize = 0, CQRingSize = 0;
+  io_uring_sqe *SQEs = static_cast<io_uring_sqe *>(MAP_FAILED);
+  size_t SQEsSize = 0;
+  unsigned NumEntries = 0;
+  unsigned *SQHead, *SQTail, *SQMask, *SQArray;
+  unsigned *CQHead, *CQTail, *CQMask;
+  io_uring_cqe *CQEs;
+};
+
+std::unique_ptr<TypeCorrectFileWriter::IOUring>
+TypeCorrectFileWriter::IOUring::create(unsigned Entries) {
+  io_uring_params Params;
+  std::memset(&Params, 0, sizeof(Params));
+  const int Fd =
+      static_cast<int>(::syscall(__NR_io_uring_setup, Entries, &Params));
+  // ENOSYS, or EPERM under a seccomp filter or io_uring_disabled
+  if (Fd < 0)
+    return nullptr;
+  std::unique_ptr<IOUring> Ring(new IOUring);
+  Ring->Fd = Fd;
+
+  constexpr unsigned MaxOps = 256;
+  std::vector<char> ProbeStorage(sizeof(io_uring_probe) +
+                                 MaxOps * sizeof(io_uring_probe_op));
+  auto *Probe = reinterpret_cast<io_uring_probe *>(ProbeStorage.data());
+  if (::syscall(__NR_io_uring_register, Fd, IORING_REGISTER_PROBE, Probe,
+                MaxOps) < 0)
+    return nullptr;
+  for (const unsigned Op :
+       {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE,
+        IORING_OP_RENAMEAT, IORING_OP_UNLINKAT})
+    if (Op > Probe->last_op ||
+        !(Probe->ops[Op].flags & IO_URING_OP_SUPPORTED))
+      return nullptr;
+
+  Ring->NumEntries = Params.sq_entries;
+  Ring->SQRingSize = Params.sq_off.array + Params.sq_entries * sizeof(unsigned);
+  Ring->CQRingSize =
+      Params.cq_off.cqes + Params.cq_entries * sizeof(io_uring_cqe);
+  const bool SingleMap = Params.features & IORING_FEAT_SINGLE_MMAP;
+  if (SingleMap)
+    Ring->SQRingSize = Ring->CQRingSize =
+        std::max(Ring->SQRingSize, Ring->CQRingSize);
+  Ring->SQRing = ::mmap(nullptr, Ring->SQRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+  if (Ring->SQRing == MAP_FAILED)
+    return nullptr;
+  if (SingleMap) {
+    Ring->CQRing = Ring->SQRing;
+  } else {
+    Ring->CQRing = ::mmap(nullptr, Ring->CQRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+    if (Ring->CQRing == MAP_FAILED)
+      return nullptr;
+  }
+  Ring->SQEsSize = Params.sq_entries * sizeof(io_uring_sqe);
+  Ring->SQEs = static_cast<io_uring_sqe *>(
+      ::mmap(nullptr, Ring->SQEsSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES));
+  if (Ring->SQEs == MAP_FAILED)
+    return nullptr;
+
+  char *SQ = static_cast<char *>(Ring->SQRing);
+  Ring->SQHead = reinterpret_cast<unsigned *>(SQ + Params.sq_off.head);
+  Ring->SQTail = reinterpret_cast<unsigned *>(SQ + Params.sq_off.tail);
+  Ring->SQMask = reinterpret_cast<unsigned *>(SQ + Params.sq_off.ring_mask);
+  Ring->SQArray = reinterpret_cast<unsigned *>(SQ + Params.sq_off.array);
+  char *CQ = static_cast<char *>(Ring->CQRing);
+  Ring->CQHead = reinterpret_cast<unsigned *>(CQ + Params.cq_off.head);
+  Ring->CQTail = reinterpret_cast<unsigned *>(CQ + Params.cq_off.tail);
+  Ring->CQMask = reinterpret_cast<unsigned *>(CQ + Params.cq_off.ring_mask);
+  Ring->CQEs = reinterpret_cast<io_uring_cqe *>(CQ + Params.cq_off.cqes);
+  return Ring;
+}
+
+TypeCorrectFileWriter::IOUring::~IOUring() {
+  if (SQEs != MAP_FAILED)
+    ::munmap(SQEs, SQEsSize);
+  if (CQRing != MAP_FAILED && CQRing != SQRing)
+    ::munmap(CQRing, CQRingSize);
+  if (SQRing != MAP_FAILED)
+    ::munmap(SQRing, SQRingSize);
+  ::close(Fd);
+}
+
+std::vector<int>
+TypeCorrectFileWriter::IOUring::run(llvm::ArrayRef<io_uring_sqe> Ops) {
+  std::vector<int> Results(Ops.size());
+  std::vector<bool> Done(Ops.size());
+  for (size_t Begin = 0; Begin < Ops.size();) {
+    const unsigned Count =
+        std::min<size_t>(Ops.size() - Begin, NumEntries);
+
+    // Every earlier entry has completed, so the whole ring is free
+    unsigned Tail = *SQTail;
+    for (unsigned Idx = 0; Idx < Count; Idx++, Tail++) {
+      const unsigned Slot = Tail & *SQMask;
+      SQEs[Slot] = Ops[Begin + Idx];
+      SQEs[Slot].user_data = Begin + Idx;
+      SQArray[Slot] = Slot;
+    }
+    std::atomic_ref<unsigned>(*SQTail).store(Tail,
+                                             std::memory_order_release);
+
+    unsigned Submitted = 0, Completed = 0;
+    while (Completed < Count) {
+      const long Ret =
+          ::syscall(__NR_io_uring_enter, Fd, Count - Submitted,
+                    Count - Completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (Ret < 0) {
+        if (errno == EINTR)
+          continue;
+        // Only if the ring itself is broken: fail what's left
+        const int Error = -errno;
+        for (unsigned Idx = 0; Idx < Count; Idx++)
+          if (!Done[Begin + Idx])
+            Results[Begin + Idx] = Error;
+        break;
+      }
+      Submitted += static_cast<unsigned>(Ret);
+
+      unsigned Head = *CQHead;
+      const unsigned CQTailNow =
+          std::atomic_ref<unsigned>(*CQTail).load(std::memory_order_acquire);
+      for (; Head != CQTailNow; Head++, Completed++) {
+        const io_uring_cqe &CQE = CQEs[Head & *CQMask];
+        Results[CQE.user_data] = CQE.res;
+        Done[CQE.user_data] = true;
+      }
+      std::atomic_ref<unsigned>(*CQHead).store(Head,
+                                               std::memory_order_release);
+    }
+    Begin += Count;
+  }
+  return Results;
+}
+
+// An entry for `Opcode`, laid out as liburing's io_uring_prep_rw does
+static io_uring_sqe prepare(uint8_t Opcode, int Fd, const void *Addr,
+                            uint32_t Len, uint64_t Offset) {
+  io_uring_sqe SQE;
+  std::memset(&SQE, 0, sizeof(SQE));
+  SQE.opcode = Opcode;
+  SQE.fd = Fd;
+  SQE.addr = reinterpret_cast<uintptr_t>(Addr);
+  SQE.len = Len;
+  SQE.off = Offset;
+  return SQE;
+}
+
+void TypeCorrectFileWriter::saveWithRing() {
+  const size_t NumFiles = Batch.size();
+  // Indices into `Batch` of the files still on track, for the step at hand
+  std::vector<size_t> Live(NumFiles);
+  for (size_t Idx = 0; Idx < NumFiles; Idx++)
+    Live[Idx] = Idx;
+  std::vector<io_uring_sqe> Ops;
+  const auto Fail = [&](size_t Idx, int Res) {
+    if (!Batch[Idx].EC)
+      Batch[Idx].EC = std::error_code(-Res, std::generic_category());
+  };
+  // Runs `Ops`, one per file of `Live`, keeping the files whose operation
+  // succeeded
+  const auto Step = [&](llvm::function_ref<void(size_t, int)> OnResult) {
+    const std::vector<int> Results = Ring->run(Ops);
+    std::vector<size_t> StillLive;
+    for (size_t Op = 0; Op < Results.size(); Op++) {
+      if (Results[Op] < 0) {
+        Fail(Live[Op], Results[Op]);
+        continue;
+      }
+      OnResult(Live[Op], Results[Op]);
+      StillLive.push_back(Live[Op]);
+    }
+    Ops.clear();
+    Live.swap(StillLive);
+  };
+
+  // The originals' permissions
+  std::vector<struct statx> Stats(NumFiles);
+  for (const size_t Idx : Live)
+    Ops.push_back(prepare(IORING_OP_STATX, AT_FDCWD,
+                          Batch[Idx].Target.c_str(), STATX_MODE,
+                          reinterpret_cast<uintptr_t>(&Stats[Idx])));
+  Step([](size_t, int) {});
+
+  // Temporary files, which must not exist yet
+  std::vector<int> Fds(NumFiles, -1);
+  for (const size_t Idx : Live) {
+    Ops.push_back(prepare(IORING_OP_OPENAT, AT_FDCWD,
+                          Batch[Idx].TempPath.c_str(),
+                          Stats[Idx].stx_mode & 07777, 0));
+    Ops.back().open_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+  }
+  Step([&](size_t Idx, int Fd) { Fds[Idx] = Fd; });
+  std::vector<size_t> Created = Live;
+
+  // Writes, resubmitting the rest of any short write
+  std::vector<size_t> Written(NumFiles, 0);
+  std::vector<size_t> Writing;
+  for (const size_t Idx : Live)
+    if (!Batch[Idx].Contents.empty())
+      Writing.push_back(Idx);
+  while (!Writing.empty()) {
+    Live.swap(Writing);
+    for (const size_t Idx : Live) {
+      const std::string &Contents = Batch[Idx].Contents;
+      const size_t Size =
+          std::min<size_t>(Contents.size() - Written[Idx], 1u << 30);
+      Ops.push_back(prepare(IORING_OP_WRITE, Fds[Idx],
+                            Contents.data() + Written[Idx],
+                            static_cast<uint32_t>(Size), Written[Idx]));
+    }
+    Step([&](size_t Idx, int Res) {
+      if (Res == 0)
+        Fail(Idx, -EIO);
+      Written[Idx] += static_cast<size_t>(Res);
+    });
+    Writing.clear();
+    for (const size_t Idx : Live)
+      if (!Batch[Idx].EC && Written[Idx] < Batch[Idx].Contents.size())
+        Writing.push_back(Idx);
+  }
+
+  // Close everything created, successful or not (an error here can still
+  // mean the data didn't make it)
+  Live = Created;
+  for (const size_t Idx : Live)
+    Ops.push_back(prepare(IORING_OP_CLOSE, Fds[Idx], nullptr, 0, 0));
+  Step([](size_t, int) {});
+
+  // Rename the complete ones over their originals, and remove the others
+  std::vector<size_t> Renaming, Removing;
+  for (const size_t Idx : Created)
+    (Batch[Idx].EC ? Removing : Renaming).push_back(Idx);
+  Live = Renaming;
+  for (const size_t Idx : Live)
+    Ops.push_back(prepare(
+        IORING_OP_RENAMEAT, AT_FDCWD, Batch[Idx].TempPath.c_str(),
+        static_cast<uint32_t>(AT_FDCWD),
+        reinterpret_cast<uintptr_t>(Batch[Idx].Target.c_str())));
+  Step([](size_t, int) {});
+  for (const size_t Idx : Renaming)
+    if (Batch[Idx].EC)
+      Removing.push_back(Idx);
+
+  Live = Removing;
+  for (const size_t Idx : Live)
+    Ops.push_back(prepare(IORING_OP_UNLINKAT, AT_FDCWD,
+                          Batch[Idx].TempPath.c_str(), 0, 0));
+  Ring->run(Ops);
+  Ops.clear();
+}
+#else
+class TypeCorrectFileWriter::IOUring {
+public:
+  static std::unique_ptr<IOUring> create(unsigned) { return nullptr; }
+};
+
+void TypeCorrectFileWriter::saveWithRing() {
+  llvm_unreachable("io_uring isn't available on this platform");
+}
+#endif
+
+//===----------------------------------------------------------------------===//
+// Thread pool
+//===----------------------------------------------------------------------===//
+static std::error_code saveFile(const std::string &Target,
+                                const std::string &TempPath,
+                                llvm::StringRef Contents) {
+  llvm::sys::fs::file_status Status;
+  if (std::error_code EC = llvm::sys::fs::status(Target, Status))
+    return EC;
+  int FD;
+  if (std::error_code EC = llvm::sys::fs::openFileForWrite(
+          TempPath, FD, llvm::sys::fs::CD_CreateNew, llvm::sys::fs::OF_None,
+          Status.permissions() & llvm::sys::fs::all_perms))
+    return EC;
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Contents;
+    OS.close();
+    if (OS.has_error()) {
+      const std::error_code EC = OS.error();
+      OS.clear_error();
+      llvm::sys::fs::remove(TempPath);
+      return EC;
+    }
+  }
+  if (std::error_code EC = llvm::sys::fs::rename(TempPath, Target)) {
+    llvm::sys::fs::remove(TempPath);
+    return EC;
+  }
+  return std::error_code();
+}
+
+void TypeCorrectFileWriter::saveWithThreads() {
+  llvm::ThreadPool Pool(llvm::hardware_concurrency(Threads));
+  for (PendingFile &File : Batch)
+    Pool.async([&File] {
+      File.EC = saveFile(File.Target, File.TempPath, File.Contents);
+    });
+  Pool.wait();
+}
+
+//===----------------------------------------------------------------------===//
+// Writer
+//===----------------------------------------------------------------------===//
+TypeCorrectFileWriter::TypeCorrectFileWriter(Backend Preferred,
+                                             unsigned BatchSize,
+                                             unsigned Threads)
+    : BatchSize(std::max(BatchSize, 1u)), Threads(Threads) {
+  if (Preferred == Backend::IOUring)
+    Ring = IOUring::create(std::min(this->BatchSize, 4096u));
+}
+
+TypeCorrectFileWriter::~TypeCorrectFileWriter() { flush(); }
+
+llvm::StringRef TypeCorrectFileWriter::getBackendName(Backend B) {
+  switch (B) {
+  case Backend::IOUring:
+    return "io_uring";
+  case Backend::ThreadPool:
+    return "thread pool";
+  }
+  llvm_unreachable("Unknown backend");
+}
+
+void TypeCorrectFileWriter::add(std::string Path, std::string Contents) {
+  // Renaming over a symlink would replace the link, not the file. A path
+  // that can't be resolved is kept, to fail in the stat with the reason.
+  llvm::SmallString<128> Target;
+  if (llvm::sys::fs::real_path(Path, Target))
+    Target = Path;
+  // Next to the original, so that the rename stays within its filesystem
+  static std::atomic<unsigned> NumTempFiles{0};
+  std::string TempPath = (Target + ".tmp-" +
+                          llvm::Twine(llvm::sys::Process::getProcessId()) +
+                          "-" + llvm::Twine(NumTempFiles++))
+                             .str();
+  Batch.push_back({std::move(Path), std::move(Contents), std::string(Target),
+                   std::move(TempPath), {}});
+  if (Batch.size() >= BatchSize)
+    saveBatch();
+}
+
+void TypeCorrectFileWriter::saveBatch() {
+  if (Batch.empty())
+    return;
+  if (Ring)
+    saveWithRing();
+  else
+    saveWithThreads();
+  for (PendingFile &File : Batch)
+    if (File.EC)
+      Failures.emplace_back(std::move(File.Path), File.EC);
+  Batch.clear();
+}
+
+std::vector<std::pair<std::string, std::error_code>>
+TypeCorrectFileWriter::flush() {
+  saveBatch();
+  std::vector<std::pair<std::string, std::error_code>> Flushed;
+  Flushed.swap(Failures);
+  return Flushed;
+}
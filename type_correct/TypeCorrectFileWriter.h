@@ -0,0 +1,85 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectFileWriter.h
+//
+// DESCRIPTION: Header for TypeCorrectFileWriter.cpp (saves rewritten files
+// in place, in batches, through io_uring where the kernel has it and a
+// thread pool otherwise)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTFILEWRITER_H
+#define TYPECORRECT_TYPECORRECTFILEWRITER_H
+
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/StringRef.h>
+
+#include "type_correct_export.h"
+
+// Replaces the contents of files. Each file is written to a new temporary
+// file next to it, created with the original's permission bits (less the
+// umask), which is then renamed over it; a file that can't be saved is left
+// as it was. Files are queued and saved a batch at a time, each step of a
+// batch (stat, create, write, close, rename) submitted for every file at
+// once, so that a large rewrite is bound by the disk rather than by syscall
+// latency. Not thread-safe.
+class TYPE_CORRECT_EXPORT TypeCorrectFileWriter {
+public:
+  enum class Backend {
+    // One io_uring submission per step of a batch (Linux only)
+    IOUring,
+    // Files of a batch saved in parallel with ordinary syscalls
+    ThreadPool,
+  };
+
+  // With `Backend::IOUring`, the thread pool is used where io_uring, or one
+  // of the operations it needs, isn't available. `Threads` (0: one per
+  // hardware thread) only applies to the thread pool.
+  explicit TypeCorrectFileWriter(Backend Preferred = Backend::IOUring,
+                                 unsigned BatchSize = 256,
+                                 unsigned Threads = 0);
+  // Saves what's still queued, dropping any errors; call flush() first to
+  // see them
+  ~TypeCorrectFileWriter();
+
+  // The backend in use
+  Backend getBackend() const {
+    return Ring ? Backend::IOUring : Backend::ThreadPool;
+  }
+  static llvm::StringRef getBackendName(Backend B);
+
+  // Queue `Contents` to replace the contents of `Path`. A symlink is
+  // followed, and the file it points at replaced. Once a batch is full, it's
+  // saved before returning.
+  void add(std::string Path, std::string Contents);
+  // Save everything queued. Returns the files that couldn't be saved since
+  // the last flush(), and why.
+  std::vector<std::pair<std::string, std::error_code>> flush();
+
+private:
+  struct PendingFile {
+    std::string Path, Contents;
+    // `Path` with symlinks resolved, and the file written in its place
+    std::string Target, TempPath;
+    std::error_code EC;
+  };
+  // The io_uring instance, if in use
+  class IOUring;
+
+  void saveBatch();
+  void saveWithRing();
+  void saveWithThreads();
+
+  std::unique_ptr<IOUring> Ring;
+  unsigned BatchSize, Threads;
+  std::vector<PendingFile> Batch;
+  std::vector<std::pair<std::string, std::error_code>> Failures;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTFILEWRITER_H */
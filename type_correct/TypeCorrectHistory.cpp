@@ -0,0 +1,242 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectHistory.cpp
+//
+// DESCRIPTION:
+//    With many workers, the makespan of a run is often set by one huge TU that
+//    happens to be dispatched last. Every isolated run records the parse and
+//    match cost of each TU here; the next run dispatches TUs longest first
+//    (LPT), which bounds that tail. TUs without history are estimated from
+//    their size, scaled by the seconds per byte of the TUs that have one.
+//
+//    The peak RSS of each TU is recorded too, and predicted the same way, so
+//    that `--memory-budget` can keep the worker pool from oversubscribing RAM.
+//
+//    Stored as JSON:
+//      {"version": 1, "files": {"/abs/a.c": {"parse": 1.5, "match": 0.2,
+//                                            "rss": 314572800,
+//                                            "size": 4096, "runs": 3}}}
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectHistory.h"
+#include "TypeCorrectPath.h"
+
+// Bumped whenever the format changes; other versions are ignored
+static constexpr int64_t HistoryVersion = 1;
+// Weight of the newest observation in the smoothed costs
+static constexpr double Smoothing = 0.5;
+// Seconds per byte when there is no history at all; only the relative order
+// of estimates matters then
+static constexpr double DefaultSecondsPerByte = 1e-6;
+// RSS per source byte when there is no history: a 50 KiB TU pulling in the
+// usual headers peaks around 100 MiB
+static constexpr double DefaultRSSPerByte = 2048;
+// No clang TU, however small, fits in less
+static constexpr uint64_t MinPeakRSS = 64ull << 20;
+
+static uint64_t getFileSize(llvm::StringRef File) {
+  uint64_t Size = 0;
+  if (llvm::sys::fs::file_size(File, Size))
+    return 0;
+  return Size;
+}
+
+std::string TypeCorrectHistory::getDefaultPath() {
+  llvm::SmallString<128> Path;
+  if (!llvm::sys::path::cache_directory(Path))
+    llvm::sys::path::system_temp_directory(/*erasedOnReboot=*/false, Path);
+  llvm::sys::path::append(Path, "type_correct", "history.json");
+  return std::string(Path);
+}
+
+TypeCorrectHistory TypeCorrectHistory::load(llvm::StringRef Path) {
+  TypeCorrectHistory History;
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+      llvm::MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return History;
+
+  llvm::Expected<llvm::json::Value> Root =
+      llvm::json::parse((*Buffer)->getBuffer());
+  if (!Root) {
+    llvm::consumeError(Root.takeError());
+    return History;
+  }
+  const llvm::json::Object *RootObj = Root->getAsObject();
+  const llvm::json::Object *Files =
+      RootObj && RootObj->getInteger("version") == HistoryVersion
+          ? RootObj->getObject("files")
+          : nullptr;
+  if (!Files)
+    return History;
+
+  for (const auto &KV : *Files) {
+    const llvm::json::Object *Obj = KV.second.getAsObject();
+    if (!Obj)
+      continue;
+    Entry &E = History.Entries[KV.first.str()];
+    E.ParseSeconds = Obj->getNumber("parse").getValueOr(0);
+    E.MatchSeconds = Obj->getNumber("match").getValueOr(0);
+    E.PeakRSSBytes =
+        static_cast<uint64_t>(Obj->getInteger("rss").getValueOr(0));
+    E.FileSize =
+        static_cast<uint64_t>(Obj->getInteger("size").getValueOr(0));
+    E.Runs = static_cast<unsigned>(Obj->getInteger("runs").getValueOr(1));
+  }
+  return History;
+}
+
+bool TypeCorrectHistory::save(llvm::StringRef Path) const {
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Path));
+
+  int FD;
+  llvm::SmallString<256> TempPath;
+  if (llvm::sys::fs::createUniqueFile(Path + ".tmp-%%%%%%", FD, TempPath))
+    return false;
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    llvm::json::OStream J(OS);
+    J.object([&] {
+      J.attribute("version", HistoryVersion);
+      J.attributeObject("files", [&] {
+        for (const auto &KV : Entries)
+          J.attributeObject(KV.getKey(), [&] {
+            const Entry &E = KV.getValue();
+            J.attribute("parse", E.ParseSeconds);
+            J.attribute("match", E.MatchSeconds);
+            J.attribute("rss", static_cast<int64_t>(E.PeakRSSBytes));
+            J.attribute("size", static_cast<int64_t>(E.FileSize));
+            J.attribute("runs", static_cast<int64_t>(E.Runs));
+          });
+      });
+    });
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(TempPath);
+      return false;
+    }
+  }
+  return !llvm::sys::fs::rename(TempPath, Path);
+}
+
+const TypeCorrectHistory::Entry *
+TypeCorrectHistory::lookup(llvm::StringRef File) const {
+  const auto It = Entries.find(getNormalizedPath(File));
+  return It == Entries.end() ? nullptr : &It->getValue();
+}
+
+void TypeCorrectHistory::record(llvm::StringRef File, double ParseSeconds,
+                                double MatchSeconds, uint64_t PeakRSSBytes) {
+  Entry &E = Entries[getNormalizedPath(File)];
+  if (E.Runs == 0) {
+    E.ParseSeconds = ParseSeconds;
+    E.MatchSeconds = MatchSeconds;
+  } else {
+    E.ParseSeconds += Smoothing * (ParseSeconds - E.ParseSeconds);
+    E.MatchSeconds += Smoothing * (MatchSeconds - E.MatchSeconds);
+  }
+  // Underestimating memory costs an OOM kill, overestimating only some
+  // parallelism: never drop below the newest observation
+  if (PeakRSSBytes)
+    E.PeakRSSBytes =
+        E.PeakRSSBytes <= PeakRSSBytes
+            ? PeakRSSBytes
+            : E.PeakRSSBytes - static_cast<uint64_t>(
+                                   Smoothing * (E.PeakRSSBytes - PeakRSSBytes));
+  E.FileSize = getFileSize(File);
+  E.Runs++;
+}
+
+// Seconds per byte across every entry with a known size
+static double
+getSecondsPerByte(const llvm::StringMap<TypeCorrectHistory::Entry> &Entries) {
+  double Seconds = 0, Bytes = 0;
+  for (const auto &KV : Entries)
+    if (KV.getValue().FileSize) {
+      Seconds += KV.getValue().ParseSeconds + KV.getValue().MatchSeconds;
+      Bytes += static_cast<double>(KV.getValue().FileSize);
+    }
+  return Bytes > 0 && Seconds > 0 ? Seconds / Bytes : DefaultSecondsPerByte;
+}
+
+static double estimate(const TypeCorrectHistory &History,
+                       llvm::StringRef File, double SecondsPerByte) {
+  if (const TypeCorrectHistory::Entry *E = History.lookup(File))
+    return E->ParseSeconds + E->MatchSeconds;
+  return static_cast<double>(getFileSize(File)) * SecondsPerByte;
+}
+
+double TypeCorrectHistory::estimateSeconds(llvm::StringRef File) const {
+  return estimate(*this, File, getSecondsPerByte(Entries));
+}
+
+// Peak RSS per source byte across every entry with a known size and RSS
+static double
+getRSSPerByte(const llvm::StringMap<TypeCorrectHistory::Entry> &Entries) {
+  double RSS = 0, Bytes = 0;
+  for (const auto &KV : Entries)
+    if (KV.getValue().FileSize && KV.getValue().PeakRSSBytes) {
+      RSS += static_cast<double>(KV.getValue().PeakRSSBytes);
+      Bytes += static_cast<double>(KV.getValue().FileSize);
+    }
+  return Bytes > 0 ? RSS / Bytes : DefaultRSSPerByte;
+}
+
+static uint64_t estimateRSS(const TypeCorrectHistory &History,
+                            llvm::StringRef File, double RSSPerByte) {
+  const TypeCorrectHistory::Entry *E = History.lookup(File);
+  if (E && E->PeakRSSBytes)
+    return E->PeakRSSBytes;
+  return std::max(MinPeakRSS, static_cast<uint64_t>(
+                                  static_cast<double>(getFileSize(File)) *
+                                  RSSPerByte));
+}
+
+uint64_t TypeCorrectHistory::estimatePeakRSS(llvm::StringRef File) const {
+  return estimateRSS(*this, File, getRSSPerByte(Entries));
+}
+
+std::vector<uint64_t>
+TypeCorrectHistory::getPeakRSSEstimates(
+    llvm::ArrayRef<std::string> Files) const {
+  const double RSSPerByte = getRSSPerByte(Entries);
+  std::vector<uint64_t> Estimates;
+  Estimates.reserve(Files.size());
+  for (const std::string &File : Files)
+    Estimates.push_back(estimateRSS(*this, File, RSSPerByte));
+  return Estimates;
+}
+
+std::vector<double> TypeCorrectHistory::getSecondsEstimates(
+    llvm::ArrayRef<std::string> Files) const {
+  const double SecondsPerByte = getSecondsPerByte(Entries);
+  std::vector<double> Estimates;
+  Estimates.reserve(Files.size());
+  for (const std::string &File : Files)
+    Estimates.push_back(estimate(*this, File, SecondsPerByte));
+  return Estimates;
+}
+
+std::vector<unsigned>
+TypeCorrectHistory::orderLongestFirst(llvm::ArrayRef<std::string> Files) const {
+  const std::vector<double> Costs = getSecondsEstimates(Files);
+
+  std::vector<unsigned> Order(Files.size());
+  for (unsigned Idx = 0; Idx < Order.size(); Idx++)
+    Order[Idx] = Idx;
+  std::stable_sort(Order.begin(), Order.end(), [&](unsigned L, unsigned R) {
+    return Costs[L] > Costs[R];
+  });
+  return Order;
+}
@@ -0,0 +1,77 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectHistory.h
+//
+// DESCRIPTION: Header for TypeCorrectHistory.cpp (per-file costs recorded by
+// earlier runs, used to schedule the most expensive TUs first and to keep
+// the projected memory use of a run within budget)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTHISTORY_H
+#define TYPECORRECT_TYPECORRECTHISTORY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "type_correct_export.h"
+
+class TYPE_CORRECT_EXPORT TypeCorrectHistory {
+public:
+  struct Entry {
+    // Smoothed wall time of the parse and match phases
+    double ParseSeconds = 0;
+    double MatchSeconds = 0;
+    // Peak resident set size of the worker; tracks increases immediately but
+    // decays slowly, so the prediction errs on the high side
+    uint64_t PeakRSSBytes = 0;
+    // Size of the main file when last recorded
+    uint64_t FileSize = 0;
+    // Number of runs that contributed
+    unsigned Runs = 0;
+  };
+
+  // Default location: <user cache dir>/type_correct/history.json
+  static std::string getDefaultPath();
+
+  // A missing or unreadable history is simply empty
+  static TypeCorrectHistory load(llvm::StringRef Path);
+  // Atomically replace `Path`; returns false on failure
+  bool save(llvm::StringRef Path) const;
+
+  const Entry *lookup(llvm::StringRef File) const;
+  // Fold one observation of `File` into its entry; a `PeakRSSBytes` of 0
+  // means it wasn't measured
+  void record(llvm::StringRef File, double ParseSeconds, double MatchSeconds,
+              uint64_t PeakRSSBytes = 0);
+
+  // Predicted parse + match seconds for `File`: its recorded cost if known,
+  // otherwise its size scaled by the seconds per byte seen across the history
+  double estimateSeconds(llvm::StringRef File) const;
+  // estimateSeconds of each of `Files`
+  std::vector<double>
+  getSecondsEstimates(llvm::ArrayRef<std::string> Files) const;
+  // Predicted peak RSS of a worker processing `File`, likewise
+  uint64_t estimatePeakRSS(llvm::StringRef File) const;
+  // estimatePeakRSS of each of `Files`
+  std::vector<uint64_t>
+  getPeakRSSEstimates(llvm::ArrayRef<std::string> Files) const;
+
+  // Indices into `Files`, most expensive first (longest-processing-time-first
+  // order); ties keep their input order
+  std::vector<unsigned>
+  orderLongestFirst(llvm::ArrayRef<std::string> Files) const;
+
+  size_t size() const { return Entries.size(); }
+
+private:
+  llvm::StringMap<Entry> Entries;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTHISTORY_H */
@@ -0,0 +1,333 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectJournal.cpp
+//
+// DESCRIPTION:
+//    A run over a large codebase can take hours, and a run that is preempted
+//    or OOM-killed near the end shouldn't have to start over. With
+//    `--journal` or `--resume`, every file that completes is appended to a
+//    journal; `--resume` replays the recorded output of the files whose
+//    inputs haven't changed since and only runs the rest.
+//
+//    Inputs are checked the way build systems do: a file with the recorded
+//    size and modification time is taken as unchanged, otherwise its
+//    contents hash decides. Files that were looked for but not found (a
+//    header that would now shadow another on the include path) aren't
+//    inputs, so creating one isn't noticed.
+//
+//    The journal is a header line, then one entry per file: a line of JSON
+//    followed by the output, whose size the JSON gives, a newline, and the
+//    xxHash64 of both (the JSON line with its newline, and the output) in
+//    hex on a line of its own:
+//      {"version": 2, "config": 1234}
+//      {"file": "/abs/a.c", "commands": 5678,
+//       "inputs": [["/abs/a.c", 4096, 1700000000000000000, 42], ...],
+//       "output": 17}
+//      <17 bytes of output>
+//      0123456789abcdef
+//    An entry cut off by a killed run, and followed by those of the next,
+//    fails its checksum however the bytes after it line up.
+//    Recorded outputs are read in place from the mapped journal.
+//
+// License: CC0
+//==============================================================================
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/xxhash.h>
+
+#include "TypeCorrectJournal.h"
+#include "TypeCorrectPath.h"
+
+// Bumped whenever the format changes; journals of other versions are
+// started afresh
+static constexpr int64_t JournalVersion = 2;
+// Hex digits of an entry's checksum
+static constexpr size_t ChecksumSize = 16;
+
+// `Entry` is the JSON line, its newline and the output
+static std::string getChecksum(llvm::StringRef Entry) {
+  std::string Hex;
+  llvm::raw_string_ostream OS(Hex);
+  OS << llvm::format_hex_no_prefix(llvm::xxHash64(Entry), ChecksumSize);
+  return OS.str();
+}
+
+std::string TypeCorrectJournal::getDefaultPath() {
+  llvm::SmallString<128> WorkingDir;
+  llvm::sys::fs::current_path(WorkingDir);
+
+  llvm::SmallString<128> Path;
+  if (!llvm::sys::path::cache_directory(Path))
+    llvm::sys::path::system_temp_directory(/*erasedOnReboot=*/false, Path);
+  std::string Name;
+  llvm::raw_string_ostream OS(Name);
+  OS << "journal-" << llvm::format_hex_no_prefix(llvm::xxHash64(WorkingDir), 16)
+     << ".log";
+  llvm::sys::path::append(Path, "type_correct", OS.str());
+  return std::string(Path);
+}
+
+//===----------------------------------------------------------------------===//
+// Reading
+//===----------------------------------------------------------------------===//
+std::unique_ptr<TypeCorrectJournal>
+TypeCorrectJournal::open(llvm::StringRef Path, uint64_t Config, bool Resume,
+                         std::string &ErrorMessage) {
+  std::unique_ptr<TypeCorrectJournal> Journal(new TypeCorrectJournal());
+  if (Resume) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                    /*RequiresNullTerminator=*/false);
+    if (Buffer) {
+      Journal->Previous = std::move(*Buffer);
+      Journal->parse(Config);
+      // The journal is about to be truncated, which its mapping mustn't see
+      if (Journal->Entries.empty())
+        Journal->Previous.reset();
+    }
+  }
+
+  llvm::sys::fs::create_directories(llvm::sys::path::parent_path(Path));
+  const bool Append = Journal->Previous != nullptr;
+  std::error_code EC;
+  Journal->OS = std::make_unique<llvm::raw_fd_ostream>(
+      Path, EC, Append ? llvm::sys::fs::OF_Append : llvm::sys::fs::OF_None);
+  if (EC) {
+    ErrorMessage =
+        ("unable to open journal " + Path + ": " + EC.message()).str();
+    return nullptr;
+  }
+  Journal->OS->SetUnbuffered();
+  llvm::raw_fd_ostream &OS = *Journal->OS;
+  if (!Append) {
+    llvm::json::OStream J(OS);
+    J.object([&] {
+      J.attribute("version", JournalVersion);
+      J.attribute("config", static_cast<int64_t>(Config));
+    });
+    OS << '\n';
+  } else if (!Journal->Previous->getBuffer().endswith("\n")) {
+    // Cut off mid-entry; what follows mustn't run on from it
+    OS << '\n';
+  }
+  if (OS.has_error()) {
+    ErrorMessage = ("unable to write journal " + Path + ": " +
+                    OS.error().message())
+                       .str();
+    OS.clear_error();
+    return nullptr;
+  }
+  return Journal;
+}
+
+void TypeCorrectJournal::parse(uint64_t Config) {
+  llvm::StringRef Line, Rest;
+  std::tie(Line, Rest) = Previous->getBuffer().split('\n');
+  llvm::Expected<llvm::json::Value> Header = llvm::json::parse(Line);
+  if (!Header) {
+    llvm::consumeError(Header.takeError());
+    return;
+  }
+  const llvm::json::Object *HeaderObj = Header->getAsObject();
+  if (!HeaderObj || HeaderObj->getInteger("version") != JournalVersion ||
+      HeaderObj->getInteger("config") != static_cast<int64_t>(Config))
+    return;
+
+  // An entry that doesn't parse or fails its checksum was cut off by a
+  // killed run: skip to the next line that starts one that doesn't. Later
+  // entries for a file replace earlier ones.
+  while (!Rest.empty()) {
+    std::tie(Line, Rest) = Rest.split('\n');
+    llvm::Expected<llvm::json::Value> Value = llvm::json::parse(Line);
+    if (!Value) {
+      llvm::consumeError(Value.takeError());
+      continue;
+    }
+    const llvm::json::Object *Obj = Value->getAsObject();
+    const llvm::Optional<llvm::StringRef> File =
+        Obj ? Obj->getString("file") : llvm::None;
+    const llvm::Optional<int64_t> Commands =
+        Obj ? Obj->getInteger("commands") : llvm::None;
+    const llvm::Optional<int64_t> OutputSize =
+        Obj ? Obj->getInteger("output") : llvm::None;
+    const llvm::json::Array *Inputs = Obj ? Obj->getArray("inputs") : nullptr;
+    if (!File || !Commands || !OutputSize || !Inputs || *OutputSize < 0 ||
+        Rest.size() < static_cast<uint64_t>(*OutputSize) + ChecksumSize + 2)
+      continue;
+    // The JSON line, and the output after it
+    const size_t EntrySize = Line.size() + 1 + *OutputSize;
+    const llvm::StringRef Trailer = Rest.substr(*OutputSize, ChecksumSize + 2);
+    if (Trailer.front() != '\n' || Trailer.back() != '\n' ||
+        Trailer.substr(1, ChecksumSize) !=
+            getChecksum(llvm::StringRef(Line.data(), EntrySize)))
+      continue;
+
+    Entry E;
+    E.CommandsHash = static_cast<uint64_t>(*Commands);
+    E.Output = Rest.take_front(*OutputSize);
+    bool Valid = true;
+    for (const llvm::json::Value &InputValue : *Inputs) {
+      const llvm::json::Array *Fields = InputValue.getAsArray();
+      if (!Fields || Fields->size() != 4 || !(*Fields)[0].getAsString() ||
+          !(*Fields)[1].getAsInteger() || !(*Fields)[2].getAsInteger() ||
+          !(*Fields)[3].getAsInteger()) {
+        Valid = false;
+        break;
+      }
+      Input I;
+      I.Path = (*Fields)[0].getAsString()->str();
+      I.Size = static_cast<uint64_t>(*(*Fields)[1].getAsInteger());
+      I.MTime = *(*Fields)[2].getAsInteger();
+      I.Hash = static_cast<uint64_t>(*(*Fields)[3].getAsInteger());
+      E.Inputs.push_back(std::move(I));
+    }
+    if (!Valid)
+      continue;
+    Rest = Rest.drop_front(Trailer.end() - Rest.begin());
+    Entries[*File] = std::move(E);
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Lookup
+//===----------------------------------------------------------------------===//
+bool TypeCorrectJournal::isUnchanged(const Input &I) {
+  const auto Inserted = Current.try_emplace(I.Path);
+  FileState &State = Inserted.first->second;
+  if (Inserted.second) {
+    llvm::sys::fs::file_status Status;
+    State.Exists = !llvm::sys::fs::status(I.Path, Status) &&
+                   llvm::sys::fs::is_regular_file(Status);
+    State.Size = Status.getSize();
+    State.MTime = Status.getLastModificationTime().time_since_epoch().count();
+  }
+
+  if (!State.Exists || State.Size != I.Size)
+    return false;
+  if (I.MTime >= 0 && State.MTime == I.MTime)
+    return true;
+  if (!State.Hash) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        llvm::MemoryBuffer::getFile(I.Path, /*IsText=*/false,
+                                    /*RequiresNullTerminator=*/false);
+    if (!Buffer)
+      return false;
+    State.Hash = llvm::xxHash64((*Buffer)->getBuffer());
+  }
+  return *State.Hash == I.Hash;
+}
+
+llvm::Optional<llvm::StringRef>
+TypeCorrectJournal::lookup(llvm::StringRef File, uint64_t CommandsHash) {
+  const auto It = Entries.find(getNormalizedPath(File));
+  if (It == Entries.end() || It->second.CommandsHash != CommandsHash)
+    return llvm::None;
+  for (const Input &I : It->second.Inputs)
+    if (!isUnchanged(I))
+      return llvm::None;
+  return It->second.Output;
+}
+
+//===----------------------------------------------------------------------===//
+// Recording
+//===----------------------------------------------------------------------===//
+bool TypeCorrectJournal::record(llvm::StringRef File, uint64_t CommandsHash,
+                                llvm::ArrayRef<Input> Inputs,
+                                llvm::StringRef Output) {
+  // Built whole, to go out in one write
+  std::string Text;
+  llvm::raw_string_ostream TextOS(Text);
+  {
+    llvm::json::OStream J(TextOS);
+    J.object([&] {
+      J.attribute("file", getNormalizedPath(File));
+      J.attribute("commands", static_cast<int64_t>(CommandsHash));
+      J.attributeArray("inputs", [&] {
+        for (const Input &I : Inputs)
+          J.array([&] {
+            J.value(I.Path);
+            J.value(static_cast<int64_t>(I.Size));
+            J.value(I.MTime);
+            J.value(static_cast<int64_t>(I.Hash));
+          });
+      });
+      J.attribute("output", static_cast<int64_t>(Output.size()));
+    });
+  }
+  TextOS << '\n' << Output;
+  const std::string Checksum = getChecksum(TextOS.str());
+  TextOS << '\n' << Checksum << '\n';
+
+  *OS << TextOS.str();
+  if (OS->has_error()) {
+    OS->clear_error();
+    return false;
+  }
+  return true;
+}
+
+uint64_t TypeCorrectJournal::hashCommands(
+    const clang::tooling::CompilationDatabase &Compilations,
+    llvm::StringRef File) {
+  llvm::SmallString<256> AbsPath(File);
+  llvm::sys::fs::make_absolute(AbsPath);
+  std::string Commands;
+  for (const clang::tooling::CompileCommand &Command :
+       Compilations.getCompileCommands(AbsPath)) {
+    Commands += Command.Directory;
+    for (const std::string &Arg : Command.CommandLine) {
+      Commands += '\0';
+      Commands += Arg;
+    }
+    Commands += '\n';
+  }
+  return llvm::xxHash64(Commands);
+}
+
+std::vector<TypeCorrectJournal::Input>
+TypeCorrectJournal::describeInputs(llvm::vfs::FileSystem &FS,
+                                   llvm::ArrayRef<std::string> Paths) {
+  std::vector<Input> Inputs;
+  for (const std::string &Path : Paths) {
+    llvm::ErrorOr<llvm::vfs::Status> Status = FS.status(Path);
+    if (!Status)
+      continue;
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        FS.getBufferForFile(Path, /*FileSize=*/-1,
+                            /*RequiresNullTerminator=*/false);
+    if (!Buffer)
+      continue;
+    Input I;
+    I.Path = Path;
+    I.Size = (*Buffer)->getBufferSize();
+    I.MTime = Status->getLastModificationTime().time_since_epoch().count();
+    I.Hash = llvm::xxHash64((*Buffer)->getBuffer());
+    Inputs.push_back(std::move(I));
+  }
+  return Inputs;
+}
+
+//===----------------------------------------------------------------------===//
+// Recording filesystem
+//===----------------------------------------------------------------------===//
+llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+TypeCorrectRecordingFileSystem::openFileForRead(const llvm::Twine &Path) {
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> File =
+      ProxyFileSystem::openFileForRead(Path);
+  if (File)
+    addRead(Path);
+  return File;
+}
+
+void TypeCorrectRecordingFileSystem::addRead(const llvm::Twine &Path) {
+  llvm::SmallString<256> AbsPath;
+  Path.toVector(AbsPath);
+  makeAbsolute(AbsPath);
+  llvm::sys::path::remove_dots(AbsPath, /*remove_dot_dot=*/false);
+  if (Seen.insert(AbsPath).second)
+    Reads.push_back(std::string(AbsPath));
+}
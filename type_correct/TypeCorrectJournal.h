@@ -0,0 +1,136 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectJournal.h
+//
+// DESCRIPTION: Header for TypeCorrectJournal.cpp (an append-only record of
+// the files a run has finished, so that an interrupted run can resume)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTJOURNAL_H
+#define TYPECORRECT_TYPECORRECTJOURNAL_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/VirtualFileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+// One entry per source file that ran to completion: its output, and what it
+// was computed from (the hash of its compile commands, and the size,
+// modification time and contents hash of every file its TUs read). A file
+// whose entry is up to date needn't run again; its recorded output stands.
+//
+// Each entry is appended with a single write to a file opened for appending,
+// so worker processes can share the journal, and a run that is killed loses
+// at most the entries being written (which are dropped when the journal is
+// next read).
+class TYPE_CORRECT_EXPORT TypeCorrectJournal {
+public:
+  struct Input {
+    std::string Path;
+    uint64_t Size = 0;
+    // Nanoseconds since the epoch; -1 if unknown, which forces a comparison
+    // of contents
+    int64_t MTime = -1;
+    uint64_t Hash = 0;
+  };
+
+  // Default location of the journal for runs from the working directory:
+  // <user cache dir>/type_correct/journal-<hash of working dir>.log
+  static std::string getDefaultPath();
+
+  // The journal at `Path`, opened for appending. With `Resume`, the entries
+  // already there are kept if they were recorded with the same `Config` (a
+  // hash of whatever options affect the output); otherwise, or if there were
+  // none, the journal starts afresh. Returns null, with `ErrorMessage` set,
+  // if it can't be written.
+  static std::unique_ptr<TypeCorrectJournal>
+  open(llvm::StringRef Path, uint64_t Config, bool Resume,
+       std::string &ErrorMessage);
+
+  // The output recorded for `File` if it's up to date: recorded with the
+  // compile commands hashing to `CommandsHash`, and none of its inputs have
+  // changed since
+  llvm::Optional<llvm::StringRef> lookup(llvm::StringRef File,
+                                         uint64_t CommandsHash);
+  // Record `File` as done. False if the entry couldn't be written.
+  bool record(llvm::StringRef File, uint64_t CommandsHash,
+              llvm::ArrayRef<Input> Inputs, llvm::StringRef Output);
+
+  // The hash of `File`'s compile commands in `Compilations`
+  static uint64_t
+  hashCommands(const clang::tooling::CompilationDatabase &Compilations,
+               llvm::StringRef File);
+  // The inputs at `Paths`, as `FS` sees them; those it can't read are left
+  // out
+  static std::vector<Input> describeInputs(llvm::vfs::FileSystem &FS,
+                                           llvm::ArrayRef<std::string> Paths);
+
+  // Entries read back from the journal when it was opened
+  unsigned getNumEntries() const { return Entries.size(); }
+
+private:
+  struct Entry {
+    uint64_t CommandsHash = 0;
+    std::vector<Input> Inputs;
+    llvm::StringRef Output;
+  };
+
+  // An input as it is now; the hash is only computed if needed
+  struct FileState {
+    bool Exists = false;
+    uint64_t Size = 0;
+    int64_t MTime = -1;
+    llvm::Optional<uint64_t> Hash;
+  };
+
+  TypeCorrectJournal() = default;
+  void parse(uint64_t Config);
+  bool isUnchanged(const Input &I);
+
+  // The journal as it was when opened; recorded outputs point into it
+  std::unique_ptr<llvm::MemoryBuffer> Previous;
+  llvm::StringMap<Entry> Entries;
+  // The inputs looked up so far, which are assumed not to change during
+  // the run
+  llvm::StringMap<FileState> Current;
+  std::unique_ptr<llvm::raw_fd_ostream> OS;
+};
+
+// Passes everything through to the filesystem it wraps, remembering the
+// (absolute) paths of the files opened for reading: the inputs of the TUs
+// run over it, for the journal
+class TYPE_CORRECT_EXPORT TypeCorrectRecordingFileSystem
+    : public llvm::vfs::ProxyFileSystem {
+public:
+  explicit TypeCorrectRecordingFileSystem(
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> Underlying)
+      : ProxyFileSystem(std::move(Underlying)) {}
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+  openFileForRead(const llvm::Twine &Path) override;
+
+  // Also count `Path` as read (for files read by other means)
+  void addRead(const llvm::Twine &Path);
+  // The files read, in the order they were first read
+  llvm::ArrayRef<std::string> getReads() const { return Reads; }
+
+private:
+  llvm::StringSet<> Seen;
+  std::vector<std::string> Reads;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTJOURNAL_H */
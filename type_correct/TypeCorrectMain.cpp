@@ -11,13 +11,33 @@
 //
 //    (or any of b.cxx c.cc d.c d.h a.hpp b.hxx)
 //
+//    * ct-type-correct a.ast
+//
+//    (serialized ASTs from `clang -emit-ast` are deserialized, not reparsed)
+//
+//    * ct-type-correct -j 8 a.c b.c c.c
+//
+//    (TUs run in forked workers; a crash only loses the offending TU)
+//
+//    * ct-type-correct -p build --sample=5% -j 8
+//
+//    (no files means every file of build/compile_commands.json; only 5% of
+//    them are run, to estimate how many edits a full run would make)
+//
+//    With `-p`, compile_commands.json is parsed once into a binary index in
+//    the user cache directory, which later runs map instead of re-parsing
+//    the JSON (until it changes); `--no-compdb-cache` disables this.
 //
 // License: CC0
 //==============================================================================
+#include <clang/Tooling/ArgumentsAdjusters.h>
 #include <clang/Tooling/CommonOptionsParser.h>
-#include <clang/Tooling/Refactoring.h>
 #include <llvm/Support/CommandLine.h>
 
+#include "TypeCorrectCompilationCache.h"
+#include "TypeCorrectDriver.h"
+#include "TypeCorrectHistory.h"
+#include "TypeCorrectJournal.h"
 #include "TypeCorrectMain.h"
 
 //===----------------------------------------------------------------------===//
@@ -25,21 +45,333 @@
 //===----------------------------------------------------------------------===//
 static llvm::cl::OptionCategory TypeCorrectCategory("ct-type-correct options");
 
+static llvm::cl::opt<std::string> Sample(
+    "sample",
+    llvm::cl::desc("Only process a stratified random sample of P% of the TUs "
+                   "(stratified by directory) and print estimated edit "
+                   "counts for all of them instead of rewritten output"),
+    llvm::cl::value_desc("P%"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<uint64_t>
+    SampleSeed("sample-seed",
+               llvm::cl::desc("Seed of the --sample selection"),
+               llvm::cl::init(0), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool>
+    Summary("summary",
+            llvm::cl::desc("Instead of rewritten output, print edit counts "
+                           "per rule, type change and directory"),
+            llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool>
+    InPlace("in-place",
+            llvm::cl::desc("Save rewritten files over the originals instead "
+                           "of printing them"),
+            llvm::cl::cat(TypeCorrectCategory));
+static llvm::cl::alias InPlaceAlias("i", llvm::cl::desc("Alias for --in-place"),
+                                    llvm::cl::aliasopt(InPlace));
+
+static llvm::cl::opt<std::string>
+    JournalPath("journal",
+                llvm::cl::desc("Record each file that completes in this "
+                               "journal, for --resume"),
+                llvm::cl::value_desc("file"),
+                llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool> Resume(
+    "resume",
+    llvm::cl::desc("Skip the files the --journal (by default, the one kept "
+                   "for the working directory) shows to be done and "
+                   "unchanged since, reusing their recorded output"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> SummaryJSON(
+    "summary-json",
+    llvm::cl::desc("Also write the --summary counts here as JSON (implies "
+                   "--summary)"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::list<std::string> EditableRoots(
+    "editable-root",
+    llvm::cl::desc("Only edit files under this directory (repeatable; "
+                   "default: anywhere)"),
+    llvm::cl::value_desc("dir"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::list<std::string> EditIncludes(
+    "edit-include",
+    llvm::cl::desc("Only edit files whose absolute path matches this glob "
+                   "(repeatable; `*` also matches `/`)"),
+    llvm::cl::value_desc("glob"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::list<std::string> EditExcludes(
+    "edit-exclude",
+    llvm::cl::desc("Never edit files whose absolute path matches this glob "
+                   "(repeatable), e.g. '*/generated/*'"),
+    llvm::cl::value_desc("glob"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> ModuleCachePath(
+    "module-cache-path",
+    llvm::cl::desc("Persistent module cache shared by every TU and run of "
+                   "`-fmodules` builds (default: user cache directory)"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::list<std::string> PrebuiltModulePaths(
+    "prebuilt-module-path",
+    llvm::cl::desc("Directory of PCMs built by the build to reuse when they "
+                   "match (the build's own -fmodules-cache-path is always "
+                   "searched)"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool> NoCompdbCache(
+    "no-compdb-cache",
+    llvm::cl::desc("Parse -p's compile_commands.json on every run instead of "
+                   "mapping a cached binary index of it"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<unsigned>
+    Jobs("jobs",
+         llvm::cl::desc("Number of worker processes (implies --isolate when "
+                        "more than 1)"),
+         llvm::cl::init(1), llvm::cl::cat(TypeCorrectCategory));
+static llvm::cl::alias JobsAlias("j", llvm::cl::desc("Alias for --jobs"),
+                                 llvm::cl::aliasopt(Jobs));
+
+static llvm::cl::opt<bool>
+    Isolate("isolate",
+            llvm::cl::desc("Run each TU in a forked worker process, so that a "
+                           "crash only loses that TU"),
+            llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool> StreamDecls(
+    "stream-decls",
+    llvm::cl::desc("Match each top-level function as it's parsed, deferring "
+                   "templates to the end of the TU"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool> NoPipeline(
+    "no-pipeline",
+    llvm::cl::desc("In serial runs, write each TU's output before parsing "
+                   "the next rather than on a writer thread"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool>
+    ShowProgress("progress",
+                 llvm::cl::desc("Show a progress line on stderr when it's a "
+                                "terminal (diagnostics break into it)"),
+                 llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> ProgressJSON(
+    "progress-json",
+    llvm::cl::desc("Keep a JSON report of the run's progress and ETA here, "
+                   "rewritten every second"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> MetricsFile(
+    "metrics",
+    llvm::cl::desc("Keep Prometheus metrics for the run (TU latencies, "
+                   "outcomes, cache hits, edits per rule) in this textfile"),
+    llvm::cl::value_desc("file"), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<unsigned> TUTimeout(
+    "tu-timeout",
+    llvm::cl::desc("Per-TU time budget in seconds: a TU over budget is "
+                   "cancelled and recorded as skipped, with the phase it was "
+                   "in (0: no limit; implies --isolate)"),
+    llvm::cl::init(0), llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<unsigned> MemoryBudget(
+    "memory-budget",
+    llvm::cl::desc("With --jobs, only start another TU while the predicted "
+                   "peak RSS of all TUs in flight stays within this many MiB "
+                   "(0: no limit)"),
+    llvm::cl::value_desc("MiB"), llvm::cl::init(0),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> SkippedReport(
+    "skipped-report",
+    llvm::cl::desc("Write a JSON list of TUs skipped by --tu-timeout here"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> HistoryPath(
+    "history",
+    llvm::cl::desc("Per-file cost history used to schedule the longest TUs "
+                   "first (default: <user cache dir>/type_correct/"
+                   "history.json)"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<bool>
+    NoHistory("no-history",
+              llvm::cl::desc("Neither read nor record per-file costs"),
+              llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<std::string> ReproducerDir(
+    "reproducer-dir",
+    llvm::cl::desc("Where reproducers for crashed, hung, slow or memory-"
+                   "hungry TUs are written (default: system temporary "
+                   "directory)"),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<unsigned> ReproduceSlowerThan(
+    "reproduce-slower-than",
+    llvm::cl::desc("Also write a reproducer for every TU that takes longer "
+                   "than this many seconds (0: none; implies --isolate)"),
+    llvm::cl::value_desc("seconds"), llvm::cl::init(0),
+    llvm::cl::cat(TypeCorrectCategory));
+
+static llvm::cl::opt<unsigned> ReproduceAboveRSS(
+    "reproduce-above-rss",
+    llvm::cl::desc("Also write a reproducer for every TU whose peak RSS is "
+                   "above this many MiB (0: none; implies --isolate)"),
+    llvm::cl::value_desc("MiB"), llvm::cl::init(0),
+    llvm::cl::cat(TypeCorrectCategory));
+
+//===----------------------------------------------------------------------===//
+// Cached compilation database
+//===----------------------------------------------------------------------===//
+// CommonOptionsParser parses `-p`'s compile_commands.json as soon as it has
+// parsed the options, so the build directory is looked for ahead of it
+struct BuildPathArgs {
+  std::string Path;
+  // Indices of the arguments naming it
+  std::vector<int> Indices;
+  bool NoCache = false;
+};
+
+static BuildPathArgs scanBuildPathArgs(int argc, const char **argv) {
+  BuildPathArgs Result;
+  for (int Idx = 1; Idx < argc; Idx++) {
+    llvm::StringRef Arg(argv[Idx]);
+    // A fixed compilation database follows, and `-p` is ignored
+    if (Arg == "--")
+      return BuildPathArgs();
+    if (Arg == "-no-compdb-cache" || Arg == "--no-compdb-cache")
+      Result.NoCache = true;
+    if ((Arg == "-p" || Arg == "--p") && Idx + 1 < argc) {
+      Result.Path = argv[Idx + 1];
+      Result.Indices = {Idx, Idx + 1};
+      Idx++;
+    } else if (Arg.consume_front("-p=") || Arg.consume_front("--p=")) {
+      Result.Path = Arg.str();
+      Result.Indices = {Idx};
+    }
+  }
+  return Result;
+}
+
+// `Compilations` with the `--extra-arg-before` and `--extra-arg` adjustments
+// CommonOptionsParser applies to the databases it loads itself
+static std::unique_ptr<clang::tooling::CompilationDatabase> addExtraArgs(
+    std::unique_ptr<clang::tooling::CompilationDatabase> Compilations) {
+  auto Adjusting =
+      std::make_unique<clang::tooling::ArgumentsAdjustingCompilations>(
+          std::move(Compilations));
+  const llvm::StringMap<llvm::cl::Option *> &Registered =
+      llvm::cl::getRegisteredOptions();
+  const std::pair<llvm::StringRef, clang::tooling::ArgumentInsertPosition>
+      ExtraArgs[] = {
+          {"extra-arg-before", clang::tooling::ArgumentInsertPosition::BEGIN},
+          {"extra-arg", clang::tooling::ArgumentInsertPosition::END}};
+  for (const auto &Extra : ExtraArgs)
+    // Both are cl::list<std::string>, registered by CommonOptionsParser
+    if (const auto *Opt = static_cast<const llvm::cl::list<std::string> *>(
+            Registered.lookup(Extra.first)))
+      Adjusting->appendArgumentsAdjuster(
+          clang::tooling::getInsertArgumentAdjuster(
+              clang::tooling::CommandLineArguments(Opt->begin(), Opt->end()),
+              Extra.second));
+  return Adjusting;
+}
+
 //===----------------------------------------------------------------------===//
 // Main driver code.
 //===----------------------------------------------------------------------===//
 int main(int argc, const char **argv) {
+  // With a cached database, CommonOptionsParser gets the arguments without
+  // `-p`, and an empty fixed compilation database so it doesn't look for one
+  std::vector<const char *> Args(argv, argv + argc);
+  std::unique_ptr<clang::tooling::CompilationDatabase> CachedCompilations;
+  const BuildPathArgs BuildPath = scanBuildPathArgs(argc, argv);
+  if (!BuildPath.Path.empty() && !BuildPath.NoCache) {
+    std::string ErrorMessage;
+    CachedCompilations = loadCachedCompilationDatabase(
+        BuildPath.Path,
+        TypeCorrectCompilationCache::getDefaultPath(BuildPath.Path),
+        ErrorMessage);
+    // Otherwise CommonOptionsParser reports the problem
+    if (CachedCompilations) {
+      Args.clear();
+      for (int Idx = 0; Idx < argc; Idx++)
+        if (llvm::find(BuildPath.Indices, Idx) == BuildPath.Indices.end())
+          Args.push_back(argv[Idx]);
+      Args.push_back("--");
+    }
+  }
+  int ArgCount = static_cast<int>(Args.size());
+
   llvm::Expected<clang::tooling::CommonOptionsParser> eOptParser =
-      clang::tooling::CommonOptionsParser::create(argc, argv,
-                                                  TypeCorrectCategory);
+      clang::tooling::CommonOptionsParser::create(
+          ArgCount, Args.data(), TypeCorrectCategory, llvm::cl::ZeroOrMore);
   if (auto E = eOptParser.takeError()) {
     llvm::errs() << "Problem constructing CommonOptionsParser "
                  << toString(std::move(E)) << '\n';
     return EXIT_FAILURE;
   }
-  clang::tooling::RefactoringTool Tool(eOptParser->getCompilations(),
-                                       eOptParser->getSourcePathList());
-  return Tool.runAndSave(
-      clang::tooling::newFrontendActionFactory<TypeCorrectPluginAction>()
-          .get());
+  if (CachedCompilations)
+    CachedCompilations = addExtraArgs(std::move(CachedCompilations));
+  const clang::tooling::CompilationDatabase &Compilations =
+      CachedCompilations ? *CachedCompilations
+                         : eOptParser->getCompilations();
+
+  TypeCorrectDriverOptions Options;
+  Options.Jobs = Jobs;
+  Options.Isolate = Isolate;
+  Options.StreamDecls = StreamDecls;
+  Options.Pipeline = !NoPipeline;
+  Options.ProgressLine = ShowProgress && llvm::errs().is_displayed();
+  Options.ProgressJSONPath = ProgressJSON;
+  Options.MetricsPath = MetricsFile;
+  Options.TUTimeoutSeconds = TUTimeout;
+  Options.MemoryBudgetMB = MemoryBudget;
+  Options.SkippedReportPath = SkippedReport;
+  Options.ReproduceSlowerThanSeconds = ReproduceSlowerThan;
+  Options.ReproduceAboveRSSMB = ReproduceAboveRSS;
+  Options.ReproducerDir = ReproducerDir;
+  if (!Sample.empty()) {
+    llvm::StringRef Percent = llvm::StringRef(Sample).trim();
+    Percent.consume_back("%");
+    double P;
+    if (Percent.getAsDouble(P) || P <= 0 || P > 100) {
+      llvm::errs() << "type_correct: --sample expects a percentage in "
+                      "(0, 100], e.g. 5%\n";
+      return EXIT_FAILURE;
+    }
+    Options.SampleFraction = P / 100;
+    Options.SampleSeed = SampleSeed;
+  }
+  if (!NoHistory)
+    Options.HistoryPath = HistoryPath.empty()
+                              ? TypeCorrectHistory::getDefaultPath()
+                              : std::string(HistoryPath);
+  Options.ModuleCachePath = ModuleCachePath;
+  Options.PrebuiltModulePaths.assign(PrebuiltModulePaths.begin(),
+                                     PrebuiltModulePaths.end());
+
+  Options.EditableRoots.assign(EditableRoots.begin(), EditableRoots.end());
+  Options.EditIncludes.assign(EditIncludes.begin(), EditIncludes.end());
+  Options.EditExcludes.assign(EditExcludes.begin(), EditExcludes.end());
+
+  Options.Summary = Summary || !SummaryJSON.empty();
+  Options.SummaryJSONPath = SummaryJSON;
+  Options.InPlace = InPlace;
+  Options.Resume = Resume;
+  Options.JournalPath = JournalPath.empty() && Resume
+                            ? TypeCorrectJournal::getDefaultPath()
+                            : std::string(JournalPath);
+
+  std::vector<std::string> SourcePaths = eOptParser->getSourcePathList();
+  if (SourcePaths.empty())
+    SourcePaths = Compilations.getAllFiles();
+
+  return runTypeCorrect(Compilations, SourcePaths, Options, llvm::outs(),
+                        llvm::errs());
 }
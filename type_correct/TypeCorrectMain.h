@@ -15,6 +15,7 @@
 
 #include <clang/Frontend/CompilerInstance.h>
 #include <clang/Rewrite/Core/Rewriter.h>
+#include <clang/Tooling/Tooling.h>
 
 #include "TypeCorrect.h"
 
@@ -26,7 +27,13 @@
 class TYPE_CORRECT_EXPORT TypeCorrectPluginAction
     : public clang::PluginASTAction {
 public:
-  explicit TypeCorrectPluginAction() = default;
+  explicit TypeCorrectPluginAction(
+      llvm::raw_ostream &Out = llvm::outs(),
+      TypeCorrectPhaseFn OnPhase = nullptr, TypeCorrectEditFn OnEdit = nullptr,
+      const TypeCorrectPathFilter *EditFilter = nullptr,
+      bool StreamDecls = false)
+      : Out(Out), OnPhase(std::move(OnPhase)), OnEdit(std::move(OnEdit)),
+        EditFilter(EditFilter), StreamDecls(StreamDecls) {}
   // Not used
   bool ParseArgs(const clang::CompilerInstance &CI,
                  const std::vector<std::string> &args) override {
@@ -46,11 +53,48 @@ public:
     RewriterForTypeCorrect.setSourceMgr(CI.getSourceManager(),
                                         CI.getLangOpts());
 
-    return std::make_unique<TypeCorrectASTConsumer>(RewriterForTypeCorrect);
+    return std::make_unique<TypeCorrectASTConsumer>(
+        RewriterForTypeCorrect, Out, OnPhase, OnEdit, EditFilter, StreamDecls);
   }
 
 private:
   clang::Rewriter RewriterForTypeCorrect;
+  llvm::raw_ostream &Out;
+  TypeCorrectPhaseFn OnPhase;
+  TypeCorrectEditFn OnEdit;
+  const TypeCorrectPathFilter *EditFilter;
+  bool StreamDecls;
+};
+
+//===----------------------------------------------------------------------===//
+// FrontendActionFactory
+//===----------------------------------------------------------------------===//
+// Like newFrontendActionFactory<TypeCorrectPluginAction>(), but writing the
+// rewritten output somewhere other than stdout (e.g., back to a parent process)
+class TYPE_CORRECT_EXPORT TypeCorrectActionFactory
+    : public clang::tooling::FrontendActionFactory {
+public:
+  explicit TypeCorrectActionFactory(
+      llvm::raw_ostream &Out, TypeCorrectPhaseFn OnPhase = nullptr,
+      TypeCorrectEditFn OnEdit = nullptr,
+      const TypeCorrectPathFilter *EditFilter = nullptr,
+      bool StreamDecls = false)
+      : Out(Out), OnPhase(std::move(OnPhase)), OnEdit(std::move(OnEdit)),
+        EditFilter(EditFilter), StreamDecls(StreamDecls) {}
+
+  std::unique_ptr<clang::FrontendAction> create() override {
+    if (OnPhase)
+      OnPhase(TypeCorrectPhase::Parse);
+    return std::make_unique<TypeCorrectPluginAction>(
+        Out, OnPhase, OnEdit, EditFilter, StreamDecls);
+  }
+
+private:
+  llvm::raw_ostream &Out;
+  TypeCorrectPhaseFn OnPhase;
+  TypeCorrectEditFn OnEdit;
+  const TypeCorrectPathFilter *EditFilter;
+  bool StreamDecls;
 };
 
 #endif /* TYPECORRECT_TYPECORRECTMAIN_H */
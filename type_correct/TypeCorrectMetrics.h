@@ -0,0 +1,95 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectMetrics.h
+//
+// DESCRIPTION: Header for TypeCorrectMetrics.cpp (latency histograms and
+// counters for a run, shared with its worker processes, written out in the
+// Prometheus text format)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTMETRICS_H
+#define TYPECORRECT_TYPECORRECTMETRICS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+// Counters and histograms for the whole of a run. They live in memory
+// shared with the processes forked after the metrics are created (on Unix),
+// so workers update them directly; every update is a relaxed atomic add.
+// Thread-safe.
+class TYPE_CORRECT_EXPORT TypeCorrectMetrics {
+public:
+  enum class Histogram : unsigned {
+    ParseSeconds, // Per TU: driver, preprocessor and Sema
+    MatchSeconds, // Per TU: ASTMatchers and rules
+    TUSeconds,    // Per TU, all phases
+  };
+  static constexpr unsigned NumHistograms = 3;
+
+  enum class Counter : unsigned {
+    TUsSucceeded,
+    TUsFailed,
+    TUsCrashed,
+    TUsTimedOut,
+    // Dead workers (crashed or timed out) that were replaced, which only
+    // happens while there's more to run
+    WorkerRestarts,
+    FileCacheHits,
+    FileCacheMisses,
+    InvocationCacheHits,
+    InvocationCacheMisses,
+  };
+  static constexpr unsigned NumCounters = 9;
+
+  // Distinct rules whose edits are counted by name; edits by any more are
+  // counted together
+  static constexpr unsigned MaxRules = 64;
+
+  TypeCorrectMetrics();
+  ~TypeCorrectMetrics();
+  TypeCorrectMetrics(const TypeCorrectMetrics &) = delete;
+  TypeCorrectMetrics &operator=(const TypeCorrectMetrics &) = delete;
+
+  void add(Counter C, uint64_t N = 1);
+  void observe(Histogram H, double Seconds);
+  // `Rule` is the name of the rule that made the edit
+  void addEdit(llvm::StringRef Rule);
+
+  uint64_t get(Counter C) const;
+  uint64_t getEdits(llvm::StringRef Rule) const;
+
+  // Everything, in the Prometheus text exposition format
+  void print(llvm::raw_ostream &OS) const;
+  // Atomically replace `Path` with print()'s output (as node-exporter's
+  // textfile collector expects); false on failure
+  bool writeTextfile(llvm::StringRef Path) const;
+
+  // Rewrite `Path` every `IntervalSeconds` from a thread of its own, until
+  // stopWriting(), which writes it one last time
+  void startWriting(std::string Path, double IntervalSeconds);
+  void stopWriting();
+
+private:
+  struct Storage;
+  Storage *Shared;
+  // Whether `Shared` is a shared mapping rather than on the heap
+  bool Mapped = false;
+
+  std::string TextfilePath;
+  std::mutex Mutex;
+  std::condition_variable Stop;
+  bool Stopping = false;
+  std::thread Writer;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTMETRICS_H */
@@ -0,0 +1,96 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectModules.cpp
+//
+// DESCRIPTION:
+//    Without help every RefactoringTool run rebuilds the module cache from
+//    scratch. This rewrites module-enabled compile commands so that:
+//
+//      * the module cache lives in a persistent directory shared by every TU
+//        of every run;
+//      * PCMs are validated by content (`-fvalidate-ast-input-files-content`),
+//        so a touched-but-unchanged header doesn't invalidate them, and only
+//        once per run (`-fmodules-validate-once-per-build-session`);
+//      * the build directory's own module cache (and any extra
+//        `--prebuilt-module-path`) is searched for prebuilt implicit modules
+//        first, so each TU only pays for its own body.
+//
+// License: CC0
+//==============================================================================
+
+#include <chrono>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectModules.h"
+
+static constexpr llvm::StringLiteral ModuleCachePathFlag =
+    "-fmodules-cache-path=";
+
+bool usesClangModules(const clang::tooling::CommandLineArguments &Args) {
+  return llvm::any_of(Args, [](const std::string &Arg) {
+    return Arg == "-fmodules" || Arg == "-fcxx-modules";
+  });
+}
+
+std::string getDefaultModuleCachePath() {
+  llvm::SmallString<128> Path;
+  if (!llvm::sys::path::cache_directory(Path))
+    llvm::sys::path::system_temp_directory(/*erasedOnReboot=*/false, Path);
+  llvm::sys::path::append(Path, "type_correct", "ModuleCache");
+  return std::string(Path);
+}
+
+clang::tooling::ArgumentsAdjuster
+getModuleCacheAdjuster(llvm::StringRef CachePath,
+                       llvm::ArrayRef<std::string> PrebuiltModulePaths) {
+  const std::string Cache =
+      CachePath.empty() ? getDefaultModuleCachePath() : CachePath.str();
+  const std::vector<std::string> Prebuilt(PrebuiltModulePaths.begin(),
+                                          PrebuiltModulePaths.end());
+
+  // One build session per run: PCM inputs are validated by the first TU that
+  // uses them, and trusted by every later TU.
+  const long long SessionTimestamp =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+
+  return [Cache, Prebuilt,
+          SessionTimestamp](const clang::tooling::CommandLineArguments &Args,
+                            llvm::StringRef /*Filename*/) {
+    if (!usesClangModules(Args))
+      return Args;
+
+    clang::tooling::CommandLineArguments Adjusted, Extra;
+    for (const std::string &Arg : Args) {
+      const llvm::StringRef ArgRef(Arg);
+      if (ArgRef.startswith(ModuleCachePathFlag)) {
+        // The build's own cache becomes a source of prebuilt PCMs
+        const llvm::StringRef BuildCache =
+            ArgRef.drop_front(ModuleCachePathFlag.size());
+        if (BuildCache != Cache)
+          Extra.push_back(("-fprebuilt-module-path=" + BuildCache).str());
+        continue;
+      }
+      Adjusted.push_back(Arg);
+    }
+
+    for (const std::string &Path : Prebuilt)
+      Extra.push_back("-fprebuilt-module-path=" + Path);
+    if (!Extra.empty())
+      Extra.push_back("-fprebuilt-implicit-modules");
+    Extra.push_back((ModuleCachePathFlag + Cache).str());
+    Extra.push_back("-fvalidate-ast-input-files-content");
+    Extra.push_back("-fmodules-validate-once-per-build-session");
+    Extra.push_back("-fbuild-session-timestamp=" +
+                    std::to_string(SessionTimestamp));
+
+    // Same placement as getInsertArgumentAdjuster(..., END): before any `--`
+    const auto End = llvm::find(Adjusted, "--");
+    Adjusted.insert(End, Extra.begin(), Extra.end());
+    return Adjusted;
+  };
+}
@@ -0,0 +1,43 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectModules.h
+//
+// DESCRIPTION: Header for TypeCorrectModules.cpp (Clang module cache reuse for
+// `-fmodules` builds)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTMODULES_H
+#define TYPECORRECT_TYPECORRECTMODULES_H
+
+#include <string>
+#include <vector>
+
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "type_correct_export.h"
+
+// Whether the compile command enables Clang (implicit) modules
+TYPE_CORRECT_EXPORT bool
+usesClangModules(const clang::tooling::CommandLineArguments &Args);
+
+// Default persistent module cache: <user cache dir>/type_correct/ModuleCache
+TYPE_CORRECT_EXPORT std::string getDefaultModuleCachePath();
+
+// Returns an ArgumentsAdjuster that, for module-enabled commands only:
+//   * points `-fmodules-cache-path` at `CachePath`, which persists across TUs
+//     and runs (an empty `CachePath` means getDefaultModuleCachePath());
+//   * validates cached PCMs by input file content rather than mtime, and only
+//     once per run (one build session per adjuster);
+//   * exposes the command's own module cache, and each of
+//     `PrebuiltModulePaths`, as prebuilt implicit module directories so PCMs
+//     already built by the build are reused when they match.
+// Commands without `-fmodules` are returned unchanged.
+TYPE_CORRECT_EXPORT clang::tooling::ArgumentsAdjuster
+getModuleCacheAdjuster(llvm::StringRef CachePath,
+                       llvm::ArrayRef<std::string> PrebuiltModulePaths);
+
+#endif /* TYPECORRECT_TYPECORRECTMODULES_H */
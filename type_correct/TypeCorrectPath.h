@@ -0,0 +1,30 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectPath.h
+//
+// DESCRIPTION: The one spelling of a source file's path that history,
+// journal, progress and the editable filter key it by
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTPATH_H
+#define TYPECORRECT_TYPECORRECTPATH_H
+
+#include <string>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+// `Path` made absolute (against the current directory), without `.` and `..`
+// components
+inline std::string getNormalizedPath(llvm::StringRef Path) {
+  llvm::SmallString<256> Normalized(Path);
+  llvm::sys::fs::make_absolute(Normalized);
+  llvm::sys::path::remove_dots(Normalized, /*remove_dot_dot=*/true);
+  return std::string(Normalized);
+}
+
+#endif /* TYPECORRECT_TYPECORRECTPATH_H */
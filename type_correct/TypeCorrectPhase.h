@@ -0,0 +1,41 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectPhase.h
+//
+// DESCRIPTION: Phases a TU goes through, so that watchdogs, timings and
+// reports can say where the time went
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTPHASE_H
+#define TYPECORRECT_TYPECORRECTPHASE_H
+
+#include <cstdint>
+#include <functional>
+
+enum class TypeCorrectPhase : uint8_t {
+  Parse, // Driver, preprocessor and Sema (or AST deserialization)
+  Match, // ASTMatchers and rule evaluation
+  Write, // Emitting the rewritten output
+};
+
+constexpr unsigned NumTypeCorrectPhases =
+    static_cast<unsigned>(TypeCorrectPhase::Write) + 1;
+
+inline const char *getPhaseName(TypeCorrectPhase Phase) {
+  switch (Phase) {
+  case TypeCorrectPhase::Parse:
+    return "parse";
+  case TypeCorrectPhase::Match:
+    return "match";
+  case TypeCorrectPhase::Write:
+    return "write";
+  }
+  return "unknown";
+}
+
+// Called on entry to each phase
+using TypeCorrectPhaseFn = std::function<void(TypeCorrectPhase)>;
+
+#endif /* TYPECORRECT_TYPECORRECTPHASE_H */
@@ -0,0 +1,121 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectPipeline.cpp
+//
+// DESCRIPTION:
+//    A serial run used to alternate between parsing a TU (CPU) and writing
+//    its rewritten output (I/O), leaving one idle while the other ran. With
+//    the output behind TypeCorrectOutputPipeline, TU N is written while TU
+//    N+1 is parsed and matched. Edits are still resolved at the end of their
+//    TU, while its SourceManager is alive, into the chunk handed to the
+//    writer; the queue bounds how far parsing can run ahead of a slow output.
+//
+//    The chunk doesn't copy the TU's output. writeInsertions writes the main
+//    file's buffer in slices, with the inserted texts in between; the
+//    pipeline recognises the slices and keeps only the main file's buffer
+//    (shared with the file cache, see TypeCorrectFileCache) and the texts.
+//    The writer thread then calls writeInsertions on them itself, so output
+//    to stdout still goes out with writev(2) straight from the buffer.
+//
+// License: CC0
+//==============================================================================
+
+#include "TypeCorrectApply.h"
+#include "TypeCorrectPipeline.h"
+
+TypeCorrectOutputPipeline::TypeCorrectOutputPipeline(llvm::raw_ostream &Out,
+                                                     size_t MaxQueuedBytes)
+    : Out(Out), MaxQueuedBytes(MaxQueuedBytes) {
+  // Chunks are buffers already
+  SetUnbuffered();
+  Writer = std::thread([this] { drain(); });
+}
+
+TypeCorrectOutputPipeline::~TypeCorrectOutputPipeline() { finish(); }
+
+void TypeCorrectOutputPipeline::write_impl(const char *Ptr, size_t Size) {
+  if (!Size)
+    return;
+  Pos += Size;
+  if (Current.Source) {
+    const llvm::StringRef Rest =
+        Current.Source->getBuffer().drop_front(Current.SourceSize);
+    if (Ptr == Rest.data() && Size <= Rest.size()) {
+      Current.SourceSize += Size;
+      return;
+    }
+  }
+  // Text written at the same place as the last is the same insertion
+  if (Current.Insertions.empty() ||
+      Current.Insertions.back().first != Current.SourceSize)
+    Current.Insertions.emplace_back(Current.SourceSize, 0);
+  Current.Inserted.append(Ptr, Size);
+  Current.Insertions.back().second = Current.Inserted.size();
+}
+
+void TypeCorrectOutputPipeline::setSource(
+    std::shared_ptr<const llvm::MemoryBuffer> Source) {
+  // Ends what's written before in the same chunk
+  endChunk();
+  Current.Source = std::move(Source);
+}
+
+void TypeCorrectOutputPipeline::endChunk() {
+  flush();
+  if (!Current.size()) {
+    Current = Chunk();
+    return;
+  }
+  std::unique_lock<std::mutex> Lock(Mutex);
+  ChunkWritten.wait(Lock, [&] {
+    return QueuedBytes == 0 ||
+           QueuedBytes + Current.size() <= MaxQueuedBytes;
+  });
+  QueuedBytes += Current.size();
+  Queue.push_back(std::move(Current));
+  Current = Chunk();
+  ChunkQueued.notify_one();
+}
+
+void TypeCorrectOutputPipeline::finish() {
+  if (!Writer.joinable())
+    return;
+  endChunk();
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Finished = true;
+  }
+  ChunkQueued.notify_one();
+  Writer.join();
+}
+
+void TypeCorrectOutputPipeline::drain() {
+  std::unique_lock<std::mutex> Lock(Mutex);
+  while (true) {
+    ChunkQueued.wait(Lock, [&] { return !Queue.empty() || Finished; });
+    if (Queue.empty())
+      break;
+    Chunk Next = std::move(Queue.front());
+    Queue.pop_front();
+
+    Lock.unlock();
+    std::vector<TypeCorrectInsertion> Insertions;
+    size_t Begin = 0;
+    for (const std::pair<size_t, size_t> &Insertion : Next.Insertions) {
+      Insertions.push_back(
+          {Insertion.first, llvm::StringRef(Next.Inserted).slice(
+                                Begin, Insertion.second)});
+      Begin = Insertion.second;
+    }
+    writeInsertions(Out,
+                    Next.Source ? Next.Source->getBuffer().take_front(
+                                      Next.SourceSize)
+                                : llvm::StringRef(),
+                    Insertions);
+    Out.flush();
+    Lock.lock();
+
+    QueuedBytes -= Next.size();
+    ChunkWritten.notify_one();
+  }
+}
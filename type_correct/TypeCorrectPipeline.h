@@ -0,0 +1,87 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectPipeline.h
+//
+// DESCRIPTION: Header for TypeCorrectPipeline.cpp (an output stream whose
+// chunks are written out by a thread of its own, behind a bounded queue)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTPIPELINE_H
+#define TYPECORRECT_TYPECORRECTPIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+// The write stage of a serial run. What's written to the stream is kept
+// until endChunk(), which queues it for a writer thread that writes it to
+// `Out` with writeInsertions, in order; meanwhile the caller goes on with
+// the next TU. A chunk is a source buffer (see setSource()) and the text
+// inserted into it, so a TU's output isn't copied: only what's inserted is.
+// Once `MaxQueuedBytes` are queued or being written, endChunk() waits for
+// the writer (a single chunk may be larger). Only the thread that created
+// the pipeline may write to it, and nothing else may write to `Out` until
+// finish().
+class TYPE_CORRECT_EXPORT TypeCorrectOutputPipeline : public llvm::raw_ostream {
+public:
+  explicit TypeCorrectOutputPipeline(llvm::raw_ostream &Out,
+                                     size_t MaxQueuedBytes = 64 << 20);
+  ~TypeCorrectOutputPipeline() override;
+
+  // The chunk being written is `Source` with insertions: a write of the
+  // bytes of `Source` that come next, from where the last one ended, is kept
+  // by reference, and anything else written is inserted there. The chunk
+  // shares ownership of `Source` until it has been written.
+  void setSource(std::shared_ptr<const llvm::MemoryBuffer> Source);
+  // Hand what was written since the last chunk over to the writer
+  void endChunk();
+  // End the last chunk and wait until everything has been written to `Out`
+  void finish();
+
+private:
+  struct Chunk {
+    std::shared_ptr<const llvm::MemoryBuffer> Source;
+    // How much of `Source` has been written
+    size_t SourceSize = 0;
+    // The inserted texts, back to back
+    std::string Inserted;
+    // Where each text goes in `Source`, and where it ends in `Inserted`
+    std::vector<std::pair<size_t, size_t>> Insertions;
+
+    size_t size() const { return SourceSize + Inserted.size(); }
+  };
+
+  void write_impl(const char *Ptr, size_t Size) override;
+  uint64_t current_pos() const override { return Pos; }
+  // The writer thread
+  void drain();
+
+  llvm::raw_ostream &Out;
+  const size_t MaxQueuedBytes;
+  Chunk Current;
+  uint64_t Pos = 0;
+
+  std::mutex Mutex;
+  std::condition_variable ChunkQueued, ChunkWritten;
+  std::deque<Chunk> Queue;
+  // Including the chunk being written
+  size_t QueuedBytes = 0;
+  bool Finished = false;
+  std::thread Writer;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTPIPELINE_H */
@@ -0,0 +1,269 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectProgress.cpp
+//
+// DESCRIPTION:
+//    A run over a large codebase takes hours, and used to be silent until
+//    the end. TypeCorrectProgress reports, once a second by default:
+//      [1200/4000] 2 failed, 3.1 files/s, 0.4 MiB/s, slowest: big.cc 95s,
+//      ETA 15m04s
+//    on stderr with `--progress` (when it's a terminal), and the same as JSON
+//    with `--progress-json`:
+//      {"total": 4000, "done": 1200, "failed": 2, "in_flight": 8,
+//       "elapsed_seconds": 387.1, "files_per_second": 3.1,
+//       "bytes_per_second": 419430.4,
+//       "slowest": {"file": "/abs/big.cc", "seconds": 95.2},
+//       "eta_seconds": 904.3, "finished": false}
+//
+//    The ETA comes from the per-file costs recorded by earlier runs (see
+//    TypeCorrectHistory), so that a run that did the cheap files first
+//    doesn't promise to end early: the costs of the files left are scaled by
+//    the ratio of wall time to recorded cost of the files done so far, which
+//    also accounts for the parallelism.
+//
+//    The status line is off by default: compiler diagnostics, which workers
+//    write too, go to stderr as they happen and break into it. What the
+//    driver reports goes through print(), which clears the line and draws
+//    it again below.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <cassert>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectPath.h"
+#include "TypeCorrectProgress.h"
+
+static double secondsBetween(std::chrono::steady_clock::time_point From,
+                             std::chrono::steady_clock::time_point To) {
+  return std::chrono::duration<double>(To - From).count();
+}
+
+TypeCorrectProgress::TypeCorrectProgress(
+    llvm::ArrayRef<std::string> Paths, llvm::ArrayRef<double> EstimatedSeconds,
+    unsigned Parallelism, llvm::raw_ostream *StatusLine, std::string JSONPath,
+    double IntervalSeconds)
+    : Start(std::chrono::steady_clock::now()),
+      Parallelism(std::max(Parallelism, 1u)), StatusLine(StatusLine),
+      JSONPath(std::move(JSONPath)), Interval(IntervalSeconds) {
+  for (unsigned Idx = 0; Idx < Paths.size(); Idx++) {
+    File &F = getFile(getNormalizedPath(Paths[Idx]));
+    if (Idx < EstimatedSeconds.size()) {
+      LeftEstimate += EstimatedSeconds[Idx] - F.EstimatedSeconds;
+      F.EstimatedSeconds = EstimatedSeconds[Idx];
+    }
+  }
+  if (this->StatusLine || !this->JSONPath.empty())
+    Reporter = std::thread([this] { tick(); });
+}
+
+TypeCorrectProgress::~TypeCorrectProgress() { finish(); }
+
+// Called with the lock held, or from the constructor
+TypeCorrectProgress::File &TypeCorrectProgress::getFile(llvm::StringRef Key) {
+  const auto Inserted = Files.try_emplace(Key);
+  if (Inserted.second)
+    Total++;
+  return Inserted.first->second;
+}
+
+void TypeCorrectProgress::started(llvm::StringRef Path) {
+  const std::string Key = getNormalizedPath(Path);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  File &F = getFile(Key);
+  if (F.State != FileState::Queued)
+    return;
+  F.State = FileState::Running;
+  Running[Key] = std::chrono::steady_clock::now();
+}
+
+void TypeCorrectProgress::finished(llvm::StringRef Path, bool Succeeded) {
+  const std::string Key = getNormalizedPath(Path);
+  uint64_t Size = 0;
+  llvm::sys::fs::file_size(Key, Size);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  File &F = getFile(Key);
+  if (F.State == FileState::Done || F.State == FileState::PassedOver)
+    return;
+  F.State = FileState::Done;
+  Running.erase(Key);
+  Done++;
+  if (!Succeeded)
+    Failed++;
+  DoneBytes += Size;
+  DoneEstimate += F.EstimatedSeconds;
+  LeftEstimate -= F.EstimatedSeconds;
+}
+
+void TypeCorrectProgress::passOver(llvm::StringRef Path) {
+  const std::string Key = getNormalizedPath(Path);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  File &F = getFile(Key);
+  if (F.State == FileState::Done || F.State == FileState::PassedOver)
+    return;
+  F.State = FileState::PassedOver;
+  Running.erase(Key);
+  Total--;
+  LeftEstimate -= F.EstimatedSeconds;
+}
+
+TypeCorrectProgress::Snapshot TypeCorrectProgress::getSnapshot() const {
+  const auto Now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Snapshot S;
+  S.Total = Total;
+  S.Done = Done;
+  S.Failed = Failed;
+  S.InFlight = Running.size();
+  S.ElapsedSeconds = secondsBetween(Start, Now);
+  if (S.ElapsedSeconds > 0) {
+    S.FilesPerSecond = Done / S.ElapsedSeconds;
+    S.BytesPerSecond = static_cast<double>(DoneBytes) / S.ElapsedSeconds;
+  }
+  for (const auto &KV : Running) {
+    const double Seconds = secondsBetween(KV.second, Now);
+    if (S.Slowest.empty() || Seconds > S.SlowestSeconds) {
+      S.Slowest = KV.getKey().str();
+      S.SlowestSeconds = Seconds;
+    }
+  }
+  const double Scale = DoneEstimate > 0 ? S.ElapsedSeconds / DoneEstimate
+                                        : 1.0 / Parallelism;
+  S.ETASeconds = std::max(LeftEstimate, 0.0) * Scale;
+  S.Finished = Stopping;
+  return S;
+}
+
+//===----------------------------------------------------------------------===//
+// Reporting
+//===----------------------------------------------------------------------===//
+// 1h02m, 5m07s or 12s
+static void printDuration(double Seconds, llvm::raw_ostream &OS) {
+  const unsigned Total = static_cast<unsigned>(std::max(Seconds, 0.0));
+  if (Total >= 3600)
+    OS << Total / 3600 << 'h' << llvm::format("%02u", Total % 3600 / 60)
+       << 'm';
+  else if (Total >= 60)
+    OS << Total / 60 << 'm' << llvm::format("%02u", Total % 60) << 's';
+  else
+    OS << Total << 's';
+}
+
+void TypeCorrectProgress::printStatusLine(const Snapshot &S,
+                                          llvm::raw_ostream &OS) {
+  OS << '[' << S.Done << '/' << S.Total << ']';
+  if (S.Failed)
+    OS << ' ' << S.Failed << " failed,";
+  OS << ' ' << llvm::format("%.1f", S.FilesPerSecond) << " files/s, "
+     << llvm::format("%.1f", S.BytesPerSecond / (1 << 20)) << " MiB/s";
+  if (!S.Slowest.empty()) {
+    OS << ", slowest: " << llvm::sys::path::filename(S.Slowest) << ' ';
+    printDuration(S.SlowestSeconds, OS);
+  }
+  if (S.Finished) {
+    OS << ", took ";
+    printDuration(S.ElapsedSeconds, OS);
+  } else {
+    OS << ", ETA ";
+    printDuration(S.ETASeconds, OS);
+  }
+}
+
+void TypeCorrectProgress::writeJSON(const Snapshot &S,
+                                    llvm::raw_ostream &OS) {
+  llvm::json::OStream J(OS);
+  J.object([&] {
+    J.attribute("total", static_cast<int64_t>(S.Total));
+    J.attribute("done", static_cast<int64_t>(S.Done));
+    J.attribute("failed", static_cast<int64_t>(S.Failed));
+    J.attribute("in_flight", static_cast<int64_t>(S.InFlight));
+    J.attribute("elapsed_seconds", S.ElapsedSeconds);
+    J.attribute("files_per_second", S.FilesPerSecond);
+    J.attribute("bytes_per_second", S.BytesPerSecond);
+    if (S.Slowest.empty())
+      J.attribute("slowest", nullptr);
+    else
+      J.attributeObject("slowest", [&] {
+        J.attribute("file", S.Slowest);
+        J.attribute("seconds", S.SlowestSeconds);
+      });
+    J.attribute("eta_seconds", S.ETASeconds);
+    J.attribute("finished", S.Finished);
+  });
+}
+
+void TypeCorrectProgress::report(const Snapshot &S) {
+  if (StatusLine) {
+    std::string Line;
+    llvm::raw_string_ostream LineOS(Line);
+    printStatusLine(S, LineOS);
+    std::lock_guard<std::mutex> Lock(PrintMutex);
+    // Back to the start of the line, and clear it
+    *StatusLine << "\r\x1b[K" << LineOS.str();
+    if (S.Finished)
+      *StatusLine << '\n';
+    StatusLine->flush();
+    Drawn = S.Finished ? std::string() : std::move(Line);
+  }
+
+  if (JSONPath.empty())
+    return;
+  // Replaced atomically, so a poller never sees half a report
+  int FD;
+  llvm::SmallString<256> TempPath;
+  if (llvm::sys::fs::createUniqueFile(JSONPath + ".tmp-%%%%%%", FD,
+                                      TempPath))
+    return;
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    writeJSON(S, OS);
+    OS << '\n';
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(TempPath);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(TempPath, JSONPath))
+    llvm::sys::fs::remove(TempPath);
+}
+
+void TypeCorrectProgress::print(llvm::StringRef Text) {
+  assert(StatusLine && "Printing without a status line");
+  std::lock_guard<std::mutex> Lock(PrintMutex);
+  if (!Drawn.empty())
+    *StatusLine << "\r\x1b[K";
+  *StatusLine << Text << Drawn;
+  StatusLine->flush();
+}
+
+void TypeCorrectProgress::tick() {
+  std::unique_lock<std::mutex> Lock(Mutex);
+  while (!Stop.wait_for(Lock, Interval, [&] { return Stopping; })) {
+    Lock.unlock();
+    report(getSnapshot());
+    Lock.lock();
+  }
+}
+
+void TypeCorrectProgress::finish() {
+  {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    if (Stopping)
+      return;
+    Stopping = true;
+  }
+  Stop.notify_one();
+  if (!Reporter.joinable())
+    return;
+  Reporter.join();
+  report(getSnapshot());
+}
@@ -0,0 +1,113 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectProgress.h
+//
+// DESCRIPTION: Header for TypeCorrectProgress.cpp (tracks how far a run has
+// got, and reports it on a status line and/or in a JSON file)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTPROGRESS_H
+#define TYPECORRECT_TYPECORRECTPROGRESS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "type_correct_export.h"
+
+// The files of a run done, in flight and to go, and what that says about
+// throughput and time left. Reported every `IntervalSeconds` by a thread of
+// its own, so that a TU that takes minutes doesn't freeze the report: to
+// `StatusLine` (if set, a terminal), as one line rewritten in place, and to
+// `JSONPath` (if set), replaced atomically, for something else to poll.
+// Files are identified by path (relative ones against the working
+// directory); one that is started again once done counts once. Thread-safe.
+class TYPE_CORRECT_EXPORT TypeCorrectProgress {
+public:
+  struct Snapshot {
+    unsigned Total = 0, Done = 0, Failed = 0, InFlight = 0;
+    double ElapsedSeconds = 0;
+    // Of the files done; bytes are those of the main files
+    double FilesPerSecond = 0, BytesPerSecond = 0;
+    // The file in flight the longest, and for how long
+    std::string Slowest;
+    double SlowestSeconds = 0;
+    // The estimated costs of the files left, scaled by how long the files
+    // done took against theirs (before any are done, by the parallelism)
+    double ETASeconds = 0;
+    bool Finished = false;
+  };
+
+  // `EstimatedSeconds` holds the expected cost of each of `Files` (e.g. from
+  // TypeCorrectHistory); `Parallelism` is how many run at once.
+  // `StatusLine` is written from the reporting thread: anything else meant
+  // for it has to go through print() until finish().
+  TypeCorrectProgress(llvm::ArrayRef<std::string> Files,
+                      llvm::ArrayRef<double> EstimatedSeconds,
+                      unsigned Parallelism, llvm::raw_ostream *StatusLine,
+                      std::string JSONPath, double IntervalSeconds = 1);
+  ~TypeCorrectProgress();
+
+  void started(llvm::StringRef File);
+  void finished(llvm::StringRef File, bool Succeeded);
+  // `File` won't run after all (e.g. it's up to date in the journal)
+  void passOver(llvm::StringRef File);
+  // Stop reporting, after a last report with `Finished` set; the status line
+  // is ended
+  void finish();
+  // Write `Text`, whole lines, to the status line's stream (which must be
+  // set): the line is cleared first and drawn again after
+  void print(llvm::StringRef Text);
+
+  Snapshot getSnapshot() const;
+  static void printStatusLine(const Snapshot &S, llvm::raw_ostream &OS);
+  static void writeJSON(const Snapshot &S, llvm::raw_ostream &OS);
+
+private:
+  enum class FileState : uint8_t { Queued, Running, Done, PassedOver };
+  struct File {
+    double EstimatedSeconds = 0;
+    FileState State = FileState::Queued;
+  };
+
+  File &getFile(llvm::StringRef Path);
+  void report(const Snapshot &S);
+  // The reporting thread
+  void tick();
+
+  const std::chrono::steady_clock::time_point Start;
+  const unsigned Parallelism;
+  llvm::raw_ostream *const StatusLine;
+  const std::string JSONPath;
+  const std::chrono::duration<double> Interval;
+
+  mutable std::mutex Mutex;
+  llvm::StringMap<File> Files;
+  // Files in flight, with the time each started
+  llvm::StringMap<std::chrono::steady_clock::time_point> Running;
+  unsigned Total = 0, Done = 0, Failed = 0;
+  uint64_t DoneBytes = 0;
+  // Estimated costs of the files done, and of those not done yet
+  double DoneEstimate = 0, LeftEstimate = 0;
+
+  // Held while writing to `StatusLine`
+  std::mutex PrintMutex;
+  // The status line as last drawn, empty once it's ended
+  std::string Drawn;
+
+  std::condition_variable Stop;
+  bool Stopping = false;
+  std::thread Reporter;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTPROGRESS_H */
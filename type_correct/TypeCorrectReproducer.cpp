@@ -0,0 +1,441 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectReproducer.cpp
+//
+// DESCRIPTION:
+//    A TU that crashes, hangs, or is merely slow or memory hungry can only be
+//    handed on if it comes without the include tree of the build it is part
+//    of. writeReproducer bundles it into a directory of its own:
+//      type_correct-big-3fa9c1/
+//        big.cc            the TU with every #include inlined, as clang's
+//                          -frewrite-includes does (macros are left alone)
+//        forced-0-pch.h    a copy of each -include or -imacros file, which
+//                          -frewrite-includes leaves out
+//        run.sh            type_correct_cli on big.cc, with the compile flags
+//                          that still apply (include search paths and module
+//                          flags dropped, forced includes pointing at the
+//                          copies)
+//        time-report.json  what the run measured: seconds in all and per
+//                          phase, the phase it was in last, peak RSS
+//    which can be moved anywhere, e.g. into a corpus of perf regressions.
+//    Everything is now in the main file, so rules may edit code that came
+//    from headers; parsing and matching it is the same work. Includes are
+//    inlined with modules off, so that modular headers are inlined too
+//    rather than left as imports. Serialized ASTs are copied into the bundle
+//    as they are.
+//
+//    What can't be bundled (a precompiled header, or a forced include that
+//    includes headers of its own or can't be found) is listed in run.sh,
+//    which then keeps the include search paths.
+//
+//    Inlining runs the preprocessor over a TU that may just have crashed or
+//    hung clang, so on Unix it is done in a child process, killed once it
+//    runs out of time. If it fails, run.sh falls back to the original file,
+//    in its compile command's directory.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+
+#include <llvm/Config/llvm-config.h>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif /* LLVM_ON_UNIX */
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Rewrite/Frontend/FrontendActions.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectASTFile.h"
+#include "TypeCorrectReproducer.h"
+
+static std::string shellQuote(llvm::StringRef Arg) {
+  std::string Quoted = "'";
+  for (const char C : Arg)
+    Quoted += C == '\'' ? std::string("'\\''") : std::string(1, C);
+  return Quoted + "'";
+}
+
+//===----------------------------------------------------------------------===//
+// Inlining includes
+//===----------------------------------------------------------------------===//
+namespace {
+// Runs -frewrite-includes' action over the first compile command of a TU,
+// writing to `OutputPath`
+class InlineIncludesFactory : public clang::tooling::FrontendActionFactory {
+public:
+  explicit InlineIncludesFactory(llvm::StringRef OutputPath)
+      : OutputPath(OutputPath) {}
+
+  std::unique_ptr<clang::FrontendAction> create() override {
+    return std::make_unique<clang::RewriteIncludesAction>();
+  }
+
+  bool
+  runInvocation(std::shared_ptr<clang::CompilerInvocation> Invocation,
+                clang::FileManager *Files,
+                std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps,
+                clang::DiagnosticConsumer *DiagConsumer) override {
+    // run.sh and time-report.json are for the command it was run with
+    if (Ran)
+      return true;
+    Ran = true;
+    Invocation->getFrontendOpts().OutputFile = OutputPath;
+    // So that diagnostics still point into the original headers
+    Invocation->getPreprocessorOutputOpts().ShowLineMarkers = true;
+    // Modular headers would be left as imports, of modules run.sh can't
+    // build without the module flags
+    Invocation->getLangOpts()->Modules = false;
+    return FrontendActionFactory::runInvocation(
+        std::move(Invocation), Files, std::move(PCHContainerOps),
+        DiagConsumer);
+  }
+
+private:
+  std::string OutputPath;
+  bool Ran = false;
+};
+} // namespace
+
+static bool
+inlineIncludes(const clang::tooling::CompilationDatabase &Compilations,
+               llvm::StringRef File, llvm::StringRef OutputPath) {
+  clang::tooling::ClangTool Tool(Compilations, {File.str()});
+  // The run has reported the TU's diagnostics already
+  clang::IgnoringDiagConsumer Ignore;
+  Tool.setDiagnosticConsumer(&Ignore);
+  InlineIncludesFactory Factory(OutputPath);
+  return Tool.run(&Factory) == EXIT_SUCCESS &&
+         llvm::sys::fs::exists(OutputPath);
+}
+
+// Runs `Fn` in a child process where possible, so that a crash only takes
+// the child down, and one that runs past `TimeoutSeconds` (unless 0) is
+// killed. False if `Fn` failed, crashed or was killed.
+static bool runContained(llvm::function_ref<bool()> Fn,
+                         unsigned TimeoutSeconds) {
+#ifdef LLVM_ON_UNIX
+  // Anything still buffered would otherwise be written twice
+  llvm::outs().flush();
+  llvm::errs().flush();
+  const pid_t Pid = ::fork();
+  if (Pid == 0)
+    ::_exit(Fn() ? 0 : 1);
+  if (Pid > 0) {
+    const auto Deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(TimeoutSeconds);
+    bool Polling = TimeoutSeconds != 0;
+    int WaitStatus;
+    while (true) {
+      const pid_t Reaped = ::waitpid(Pid, &WaitStatus, Polling ? WNOHANG : 0);
+      if (Reaped == Pid)
+        break;
+      if (Reaped < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      if (std::chrono::steady_clock::now() >= Deadline) {
+        // Reaped by the blocking wait next time around
+        ::kill(Pid, SIGKILL);
+        Polling = false;
+        continue;
+      }
+      ::usleep(10 * 1000);
+    }
+    return WIFEXITED(WaitStatus) && WEXITSTATUS(WaitStatus) == 0;
+  }
+#endif /* LLVM_ON_UNIX */
+  return Fn();
+}
+
+//===----------------------------------------------------------------------===//
+// Bundle
+//===----------------------------------------------------------------------===//
+// Include search paths (joined or separate), which are moot once the
+// includes are inlined, and would point outside the bundle
+static bool isSearchPathFlag(llvm::StringRef Arg, bool &TakesValue) {
+  for (const llvm::StringRef Flag :
+       {"-I", "-isystem", "-iquote", "-idirafter", "-iframework", "-F",
+        "-isysroot", "--sysroot"}) {
+    if (!Arg.startswith(Flag))
+      continue;
+    TakesValue = Arg.size() == Flag.size();
+    return true;
+  }
+  return false;
+}
+
+// Modules (cache, maps, prebuilt files), moot once the includes are inlined
+// with modules off
+static bool isModuleFlag(llvm::StringRef Arg) {
+  for (const llvm::StringRef Flag :
+       {"-fmodule", "-fcxx-modules", "-fimplicit-module-maps",
+        "-fprebuilt-module-path", "-fbuiltin-module-map"})
+    if (Arg.startswith(Flag))
+      return true;
+  return false;
+}
+
+// Files included ahead of the main file (joined or separate), which
+// -frewrite-includes doesn't inline. Sets `Value` if it's joined.
+static bool isForcedIncludeFlag(llvm::StringRef Arg, llvm::StringRef &Flag,
+                                llvm::StringRef &Value) {
+  if (Arg.startswith("-include-pch"))
+    return false;
+  for (const llvm::StringRef Forced : {"-include", "-imacros"}) {
+    if (!Arg.startswith(Forced))
+      continue;
+    Flag = Forced;
+    Value = Arg.drop_front(Forced.size());
+    return true;
+  }
+  return false;
+}
+
+// Whether `Header` has an #include (or #import) of its own
+static bool hasIncludes(llvm::StringRef Header) {
+  llvm::SmallVector<llvm::StringRef, 64> Lines;
+  Header.split(Lines, '\n');
+  for (llvm::StringRef Line : Lines) {
+    Line = Line.ltrim();
+    if (!Line.consume_front("#"))
+      continue;
+    Line = Line.ltrim();
+    if (Line.startswith("include") || Line.startswith("import"))
+      return true;
+  }
+  return false;
+}
+
+// Copy the forced include `Path` of `Command` into `Bundle`, as the `Num`th;
+// returns the copy's name, or the original's absolute path if it isn't
+// self-contained (with why in `Missing`)
+static std::string copyForcedInclude(
+    const clang::tooling::CompileCommand &Command, llvm::StringRef Path,
+    llvm::StringRef Bundle, unsigned Num, std::vector<std::string> &Missing) {
+  // As the preprocessor tries it first: in the working directory
+  llvm::SmallString<128> Original(Path);
+  llvm::sys::fs::make_absolute(Command.Directory, Original);
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Contents =
+      llvm::MemoryBuffer::getFile(Original);
+  if (!Contents) {
+    Missing.push_back("forced include " + Path.str() +
+                      ", not found in the working directory");
+    return Path.str();
+  }
+  if (hasIncludes((*Contents)->getBuffer())) {
+    Missing.push_back("forced include " + Path.str() +
+                      ", which includes other headers");
+    return Original.str().str();
+  }
+  const std::string Name = "forced-" + std::to_string(Num) + "-" +
+                           llvm::sys::path::filename(Path).str();
+  llvm::SmallString<128> Copy(Bundle);
+  llvm::sys::path::append(Copy, Name);
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Copy, EC);
+  if (!EC)
+    OS << (*Contents)->getBuffer();
+  OS.close();
+  if (EC || OS.has_error()) {
+    OS.clear_error();
+    Missing.push_back("forced include " + Path.str() + ", not copied");
+    return Original.str().str();
+  }
+  return Name;
+}
+
+// The arguments of `Command` for type_correct_cli, which adds its own
+// compiler, input and `-fsyntax-only`. With the source bundled into
+// `Bundle` (else empty), the flags are for the bundle: module flags are
+// dropped, and forced includes copied in. What the bundle still needs from
+// outside it is added to `Missing`; the include search paths are dropped
+// unless there is any.
+static std::vector<std::string>
+getFlags(const clang::tooling::CompileCommand &Command, llvm::StringRef File,
+         llvm::StringRef Bundle, std::vector<std::string> &Missing) {
+  std::vector<std::string> Flags;
+  std::vector<std::pair<size_t, size_t>> SearchPaths;
+  unsigned NumForced = 0;
+  for (size_t Idx = 1; Idx < Command.CommandLine.size(); Idx++) {
+    const llvm::StringRef Arg = Command.CommandLine[Idx];
+    if (Arg == "-c" || Arg == Command.Filename || Arg == File)
+      continue;
+    if (Arg == "-o") {
+      Idx++;
+      continue;
+    }
+    if (Arg.startswith("-o"))
+      continue;
+    if (Bundle.empty()) {
+      Flags.push_back(Arg.str());
+      continue;
+    }
+
+    bool TakesValue;
+    if (isSearchPathFlag(Arg, TakesValue)) {
+      // Dropped at the end, if the bundle turns out self-contained
+      const size_t End =
+          std::min(Idx + TakesValue, Command.CommandLine.size() - 1);
+      SearchPaths.emplace_back(Flags.size(), End - Idx + 1);
+      for (; Idx <= End; Idx++)
+        Flags.push_back(Command.CommandLine[Idx]);
+      Idx--;
+      continue;
+    }
+    if (isModuleFlag(Arg))
+      continue;
+    llvm::StringRef Flag, Value;
+    if (isForcedIncludeFlag(Arg, Flag, Value)) {
+      if (Value.empty() && Idx + 1 < Command.CommandLine.size())
+        Value = Command.CommandLine[++Idx];
+      Flags.push_back(Flag.str());
+      Flags.push_back(
+          copyForcedInclude(Command, Value, Bundle, NumForced++, Missing));
+      continue;
+    }
+    if (Arg.startswith("-include-pch")) {
+      // Kept, but where run.sh can still find it
+      Value = Arg.drop_front(llvm::StringRef("-include-pch").size());
+      if (Value.empty() && Idx + 1 < Command.CommandLine.size())
+        Value = Command.CommandLine[++Idx];
+      llvm::SmallString<128> PCH(Value);
+      llvm::sys::fs::make_absolute(Command.Directory, PCH);
+      Missing.push_back("precompiled header " + PCH.str().str());
+      Flags.push_back("-include-pch");
+      Flags.push_back(PCH.str().str());
+      continue;
+    }
+    Flags.push_back(Arg.str());
+  }
+
+  if (!Missing.empty())
+    return Flags;
+  // Back to front, so that the positions still hold
+  for (auto It = SearchPaths.rbegin(); It != SearchPaths.rend(); ++It)
+    Flags.erase(Flags.begin() + It->first,
+                Flags.begin() + It->first + It->second);
+  return Flags;
+}
+
+static bool writeTimeReport(llvm::StringRef Path, llvm::StringRef File,
+                            llvm::StringRef Reason,
+                            const TypeCorrectWorkerPool::JobResult &Result) {
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Text);
+  if (EC)
+    return false;
+  llvm::json::OStream J(OS, /*IndentSize=*/2);
+  J.object([&] {
+    J.attribute("file", File);
+    J.attribute("reason", Reason);
+    J.attribute("seconds", Result.Seconds);
+    J.attribute("phase", getPhaseName(Result.Phase));
+    J.attributeObject("phase_seconds", [&] {
+      for (unsigned Idx = 0; Idx < NumTypeCorrectPhases; Idx++)
+        J.attribute(getPhaseName(static_cast<TypeCorrectPhase>(Idx)),
+                    Result.PhaseSeconds[Idx]);
+    });
+    J.attribute("peak_rss_bytes", static_cast<int64_t>(Result.PeakRSSBytes));
+  });
+  OS << '\n';
+  OS.close();
+  return !OS.has_error();
+}
+
+std::string
+writeReproducer(const clang::tooling::CompilationDatabase &Compilations,
+                llvm::StringRef File, llvm::StringRef Dir,
+                llvm::StringRef Reason,
+                const TypeCorrectWorkerPool::JobResult &Result,
+                unsigned TimeoutSeconds) {
+  llvm::SmallString<128> Model(Dir);
+  if (Model.empty())
+    llvm::sys::path::system_temp_directory(/*erasedOnReboot=*/true, Model);
+  // A relative path would be taken as relative to the temporary directory
+  llvm::sys::fs::make_absolute(Model);
+  llvm::sys::fs::create_directories(Model);
+  llvm::sys::path::append(Model,
+                          "type_correct-" + llvm::sys::path::stem(File));
+  llvm::SmallString<128> Bundle;
+  if (llvm::sys::fs::createUniqueDirectory(Model, Bundle))
+    return std::string();
+
+  llvm::SmallString<128> Report(Bundle), Script(Bundle);
+  llvm::sys::path::append(Report, "time-report.json");
+  llvm::sys::path::append(Script, "run.sh");
+  if (!writeTimeReport(Report, File, Reason, Result))
+    return std::string();
+
+  // The source: inlined (or copied, for a serialized AST) into the bundle,
+  // else the original
+  const std::vector<clang::tooling::CompileCommand> Commands =
+      Compilations.getCompileCommands(File);
+  const bool IsAST = isSerializedASTFile(File);
+  const llvm::StringRef Original =
+      IsAST || Commands.empty() ? File
+                                : llvm::StringRef(Commands.front().Filename);
+  llvm::SmallString<128> Source(Bundle);
+  llvm::sys::path::append(Source, llvm::sys::path::filename(Original));
+  bool Bundled;
+  if (IsAST)
+    Bundled = !llvm::sys::fs::copy_file(File, Source);
+  else
+    Bundled = runContained(
+        [&] { return inlineIncludes(Compilations, File, Source); },
+        TimeoutSeconds);
+  // Whatever a killed child got to write
+  if (!Bundled)
+    llvm::sys::fs::remove(Source);
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Script, EC, llvm::sys::fs::OF_Text);
+  if (EC)
+    return std::string();
+  OS << "#!/bin/sh\n"
+     << "# type_correct: " << Reason << '\n';
+  if (Bundled)
+    OS << "cd \"$(dirname \"$0\")\" || exit 1\n"
+       << "exec type_correct_cli "
+       << shellQuote(llvm::sys::path::filename(Source));
+  else if (!Commands.empty())
+    OS << "cd " << shellQuote(Commands.front().Directory) << " || exit 1\n"
+       << "exec type_correct_cli " << shellQuote(Commands.front().Filename);
+  else
+    OS << "exec type_correct_cli " << shellQuote(File);
+
+  std::vector<std::string> Missing;
+  if (!IsAST) {
+    OS << " --";
+    if (!Commands.empty())
+      for (const std::string &Flag :
+           getFlags(Commands.front(), File,
+                    Bundled ? Bundle.str() : llvm::StringRef(), Missing))
+        OS << ' ' << shellQuote(Flag);
+  }
+  OS << '\n';
+  if (!Missing.empty()) {
+    OS << "# Not self-contained: it still needs, from the original tree,\n";
+    for (const std::string &What : Missing)
+      OS << "#   " << What << '\n';
+  }
+  OS.close();
+  if (OS.has_error())
+    return std::string();
+  llvm::sys::fs::setPermissions(Script, llvm::sys::fs::all_read |
+                                            llvm::sys::fs::all_exe |
+                                            llvm::sys::fs::owner_write);
+  return std::string(Script);
+}
@@ -0,0 +1,38 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectReproducer.h
+//
+// DESCRIPTION: Header for TypeCorrectReproducer.cpp (self-contained
+// reproducers for TUs that crash, hang, or are slow or memory hungry)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTREPRODUCER_H
+#define TYPECORRECT_TYPECORRECTREPRODUCER_H
+
+#include <string>
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <llvm/ADT/StringRef.h>
+
+#include "TypeCorrectWorkerPool.h"
+
+#include "type_correct_export.h"
+
+// Bundle `File` into a new directory under `Dir` (empty means the system
+// temporary directory): its source with every include inlined, copies of
+// its forced includes, a script that runs type_correct_cli on that with its
+// compile flags (noting anything still needed from outside), and a time
+// report from `Result`. `Reason` says why (e.g. "crashed on a.c in the match
+// phase"). Inlining is given `TimeoutSeconds` (0 means no limit), after which
+// the script runs the original file instead. Returns the script's path, or
+// an empty string on failure.
+TYPE_CORRECT_EXPORT std::string
+writeReproducer(const clang::tooling::CompilationDatabase &Compilations,
+                llvm::StringRef File, llvm::StringRef Dir,
+                llvm::StringRef Reason,
+                const TypeCorrectWorkerPool::JobResult &Result,
+                unsigned TimeoutSeconds = 0);
+
+#endif /* TYPECORRECT_TYPECORRECTREPRODUCER_H */
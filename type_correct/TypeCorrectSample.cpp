@@ -0,0 +1,263 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectSample.cpp
+//
+// DESCRIPTION:
+//    `--sample=P%` sizes a migration without paying for a full run: only a
+//    stratified random sample of the TUs is processed, each reporting its
+//    edit counts rather than its rewritten text, and the counts are
+//    extrapolated to every TU.
+//
+//    Strata are directories, since edit density follows code ownership and
+//    style far more than it follows anything else cheap to know up front.
+//    The sample is ceil(P% of the TUs), allocated to the strata in
+//    proportion to their size by the largest remainder method. A directory
+//    too small to be allocated a TU is merged into its parent's stratum
+//    (the top-level one into the largest stratum), and the allocation is
+//    redone, so that every TU belongs to a sampled stratum without the
+//    sample outgrowing P%. The total of a counter is estimated with the
+//    usual stratified estimator, sum_h N_h * mean_h, with variance
+//      sum_h N_h^2 * (1 - n_h / N_h) * s_h^2 / n_h
+//    (N_h TUs in stratum h, n_h of them sampled, s_h^2 their sample
+//    variance). Strata with a single observation borrow the variance of the
+//    whole sample, and strata whose every sample was lost (crashed or timed
+//    out) borrow its mean as well. Intervals are normal-approximation 95%.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectSample.h"
+
+// Two-sided 95% quantile of the standard normal distribution
+static constexpr double Z95 = 1.96;
+
+namespace {
+struct SampleStratum {
+  std::vector<unsigned> Members;
+  // Directories merged into it, itself included
+  unsigned NumDirs = 1;
+  // Its share of the sample
+  size_t Allocated = 0;
+};
+} // namespace
+
+// The strata of `Files`, by directory, each allocated its share of a sample
+// of `Fraction` of them. Ordered, so that the random stream is consumed the
+// same way every time.
+static std::map<std::string, SampleStratum>
+getStrata(llvm::ArrayRef<std::string> Files, double Fraction) {
+  std::map<std::string, SampleStratum> Strata;
+  for (unsigned Idx = 0; Idx < Files.size(); Idx++)
+    Strata[llvm::sys::path::parent_path(Files[Idx]).str()].Members.push_back(
+        Idx);
+  // The epsilon keeps e.g. 0.05 * 20 from rounding up to 2
+  const size_t Wanted = std::min(
+      Files.size(), static_cast<size_t>(std::ceil(
+                        Fraction * static_cast<double>(Files.size()) - 1e-9)));
+  if (!Wanted)
+    return Strata;
+
+  while (true) {
+    // Largest remainder: everyone gets the whole part of their quota, then
+    // the largest fractional parts get one more each (ties in path order)
+    std::vector<std::pair<size_t, SampleStratum *>> Remainders;
+    size_t Left = Wanted;
+    for (auto &KV : Strata) {
+      SampleStratum &S = KV.second;
+      const size_t Quota = Wanted * S.Members.size();
+      S.Allocated = Quota / Files.size();
+      Left -= S.Allocated;
+      Remainders.emplace_back(Quota % Files.size(), &S);
+    }
+    std::stable_sort(Remainders.begin(), Remainders.end(),
+                     [](const std::pair<size_t, SampleStratum *> &L,
+                        const std::pair<size_t, SampleStratum *> &R) {
+                       return L.first > R.first;
+                     });
+    for (size_t Idx = 0; Idx < Left; Idx++)
+      Remainders[Idx].second->Allocated++;
+
+    // Deepest first, so that a parent merged away in turn takes its
+    // children along
+    std::vector<std::string> Empty;
+    for (const auto &KV : Strata)
+      if (!KV.second.Allocated)
+        Empty.push_back(KV.first);
+    if (Empty.empty())
+      return Strata;
+    std::stable_sort(Empty.begin(), Empty.end(),
+                     [](const std::string &L, const std::string &R) {
+                       return L.size() > R.size();
+                     });
+    for (const std::string &Dir : Empty) {
+      SampleStratum Merged = std::move(Strata[Dir]);
+      Strata.erase(Dir);
+      SampleStratum *Into;
+      if (!Dir.empty()) {
+        const auto Parent = Strata.try_emplace(
+            llvm::sys::path::parent_path(Dir).str(), SampleStratum());
+        Into = &Parent.first->second;
+        // The parent has no files of its own
+        if (Parent.second)
+          Into->NumDirs = 0;
+      } else {
+        Into = &std::max_element(Strata.begin(), Strata.end(),
+                                 [](const auto &L, const auto &R) {
+                                   return L.second.Members.size() <
+                                          R.second.Members.size();
+                                 })
+                    ->second;
+      }
+      Into->Members.insert(Into->Members.end(), Merged.Members.begin(),
+                           Merged.Members.end());
+      Into->NumDirs += Merged.NumDirs;
+    }
+  }
+}
+
+std::vector<unsigned> selectStratifiedSample(llvm::ArrayRef<std::string> Files,
+                                             double Fraction, uint64_t Seed) {
+  std::mt19937_64 Rng(Seed);
+  std::vector<unsigned> Sample;
+  for (auto &KV : getStrata(Files, Fraction)) {
+    std::vector<unsigned> &Members = KV.second.Members;
+    const size_t Size = KV.second.Allocated;
+    // Partial Fisher-Yates shuffle
+    for (size_t Idx = 0; Idx < Size; Idx++) {
+      std::uniform_int_distribution<size_t> Pick(Idx, Members.size() - 1);
+      std::swap(Members[Idx], Members[Pick(Rng)]);
+    }
+    Sample.insert(Sample.end(), Members.begin(), Members.begin() + Size);
+  }
+  std::sort(Sample.begin(), Sample.end());
+  return Sample;
+}
+
+TypeCorrectSampleEstimate::TypeCorrectSampleEstimate(
+    llvm::ArrayRef<std::string> Population, double Fraction)
+    : StratumOf(Population.size()) {
+  for (const auto &KV : getStrata(Population, Fraction)) {
+    const unsigned StratumIdx = static_cast<unsigned>(Strata.size());
+    StratumByDir[KV.first] = StratumIdx;
+    Strata.emplace_back();
+    Strata.back().Dir = KV.first;
+    Strata.back().NumDirs = KV.second.NumDirs;
+    Strata.back().Size = static_cast<unsigned>(KV.second.Members.size());
+    for (const unsigned Idx : KV.second.Members)
+      StratumOf[Idx] = StratumIdx;
+  }
+}
+
+void TypeCorrectSampleEstimate::record(unsigned Index,
+                                       const TypeCorrectCounters &Counts) {
+  Strata[StratumOf[Index]].Sampled.push_back(Observations.size());
+  Observations.push_back(Counts);
+  SampledTotals.merge(Counts);
+}
+
+// Mean and sample variance (0 for fewer than two values)
+template <typename ValueFn>
+static std::pair<double, double> getMoments(llvm::ArrayRef<unsigned> Obs,
+                                            ValueFn Value) {
+  double Mean = 0;
+  for (const unsigned Idx : Obs)
+    Mean += Value(Idx);
+  Mean /= static_cast<double>(Obs.size());
+  if (Obs.size() < 2)
+    return {Mean, 0};
+  double SumSq = 0;
+  for (const unsigned Idx : Obs)
+    SumSq += (Value(Idx) - Mean) * (Value(Idx) - Mean);
+  return {Mean, SumSq / static_cast<double>(Obs.size() - 1)};
+}
+
+TypeCorrectSampleEstimate::Estimate
+TypeCorrectSampleEstimate::estimate(llvm::ArrayRef<const Stratum *> Subset,
+                                    llvm::StringRef Key) const {
+  if (Observations.empty())
+    return Estimate();
+  const auto Value = [&](unsigned Obs) {
+    return static_cast<double>(Key.empty()
+                                   ? Observations[Obs].total(RuleCounterPrefix)
+                                   : Observations[Obs].get(Key));
+  };
+
+  std::vector<unsigned> All(Observations.size());
+  for (unsigned Idx = 0; Idx < All.size(); Idx++)
+    All[Idx] = Idx;
+  const std::pair<double, double> Overall = getMoments(All, Value);
+
+  Estimate Result;
+  double Variance = 0;
+  for (const Stratum *S : Subset) {
+    const double N = S->Size;
+    if (S->Sampled.empty()) {
+      Result.Total += N * Overall.first;
+      Variance += N * N * Overall.second / static_cast<double>(All.size());
+      continue;
+    }
+    const double Sampled = static_cast<double>(S->Sampled.size());
+    const std::pair<double, double> Moments = getMoments(S->Sampled, Value);
+    const double S2 = S->Sampled.size() < 2 ? Overall.second : Moments.second;
+    Result.Total += N * Moments.first;
+    Variance += N * N * (1 - Sampled / N) * S2 / Sampled;
+  }
+  Result.HalfWidth = Z95 * std::sqrt(Variance);
+  return Result;
+}
+
+TypeCorrectSampleEstimate::Estimate
+TypeCorrectSampleEstimate::estimate(llvm::StringRef Key) const {
+  std::vector<const Stratum *> All;
+  for (const Stratum &S : Strata)
+    All.push_back(&S);
+  return estimate(All, Key);
+}
+
+TypeCorrectSampleEstimate::Estimate
+TypeCorrectSampleEstimate::estimateDirectory(llvm::StringRef Dir) const {
+  const auto It = StratumByDir.find(Dir);
+  if (It == StratumByDir.end())
+    return Estimate();
+  const Stratum *S = &Strata[It->getValue()];
+  return estimate(llvm::makeArrayRef(S), llvm::StringRef());
+}
+
+void TypeCorrectSampleEstimate::print(llvm::raw_ostream &OS) const {
+  const auto Row = [&](llvm::StringRef Name, const Estimate &E) {
+    OS << llvm::format("  %-48s %12.0f +/- %.0f\n", Name.str().c_str(),
+                       E.Total, E.HalfWidth);
+  };
+
+  // Of what was recorded, so lost TUs show
+  const double Percent =
+      StratumOf.empty() ? 0
+                        : 100.0 * static_cast<double>(Observations.size()) /
+                              static_cast<double>(StratumOf.size());
+  OS << "type_correct: sampled " << Observations.size() << " of "
+     << StratumOf.size() << " TUs (" << llvm::format("%.1f", Percent)
+     << "%) in " << Strata.size()
+     << (Strata.size() == 1 ? " stratum\n" : " strata\n")
+     << "Estimated edits across all TUs (95% confidence interval):\n"
+     << "  per rule\n";
+  for (const llvm::StringRef Key : SampledTotals.keys(RuleCounterPrefix))
+    Row(Key.drop_front(RuleCounterPrefix.size()), estimate(Key));
+  Row("(all rules)", estimate());
+
+  // In path order, as getStrata() keeps them
+  OS << "  per directory\n";
+  for (const Stratum &S : Strata) {
+    std::string Name = S.Dir.empty() ? "." : S.Dir;
+    if (S.NumDirs > 1)
+      Name += " (" + std::to_string(S.NumDirs) + " directories)";
+    Row(Name, estimateDirectory(S.Dir));
+  }
+}
@@ -0,0 +1,86 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectSample.h
+//
+// DESCRIPTION: Header for TypeCorrectSample.cpp (`--sample`: run a stratified
+// random sample of the TUs and extrapolate edit counts to all of them)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTSAMPLE_H
+#define TYPECORRECT_TYPECORRECTSAMPLE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "TypeCorrectCounters.h"
+
+#include "type_correct_export.h"
+
+// Indices into `Files`, ascending, of a stratified random sample of
+// ceil(Fraction * their number) files. Strata are directories, allocated
+// their share of the sample by the largest remainder method; a directory
+// whose share rounds to nothing is merged into its parent's stratum. The
+// same `Seed` gives the same sample.
+TYPE_CORRECT_EXPORT std::vector<unsigned>
+selectStratifiedSample(llvm::ArrayRef<std::string> Files, double Fraction,
+                       uint64_t Seed);
+
+class TYPE_CORRECT_EXPORT TypeCorrectSampleEstimate {
+public:
+  // Estimates are for every file of `Population`, sampled by
+  // selectStratifiedSample with `Fraction`
+  TypeCorrectSampleEstimate(llvm::ArrayRef<std::string> Population,
+                            double Fraction);
+
+  // The counts of the sampled file `Index` (into the population). Sampled
+  // files that are never recorded, e.g. because they crashed, are treated as
+  // missing at random.
+  void record(unsigned Index, const TypeCorrectCounters &Counts);
+
+  struct Estimate {
+    double Total = 0;
+    // Of the 95% confidence interval
+    double HalfWidth = 0;
+  };
+  // Estimated sum of counter `Key` over the population; an empty key means
+  // edits of every rule (the RuleCounterPrefix counters)
+  Estimate estimate(llvm::StringRef Key = llvm::StringRef()) const;
+  // Estimated edits of every rule over the files of the stratum of
+  // directory `Dir` (with the directories merged into it)
+  Estimate estimateDirectory(llvm::StringRef Dir) const;
+
+  size_t getNumRecorded() const { return Observations.size(); }
+  // Table of the per-key and per-directory estimates
+  void print(llvm::raw_ostream &OS) const;
+
+private:
+  struct Stratum {
+    std::string Dir;
+    // Directories merged into it, itself included
+    unsigned NumDirs = 1;
+    // Files in the population
+    unsigned Size = 0;
+    // Indices into Observations
+    std::vector<unsigned> Sampled;
+  };
+  Estimate estimate(llvm::ArrayRef<const Stratum *> Strata,
+                    llvm::StringRef Key) const;
+
+  std::vector<Stratum> Strata;
+  // Stratum of each file of the population
+  std::vector<unsigned> StratumOf;
+  llvm::StringMap<unsigned> StratumByDir;
+  std::vector<TypeCorrectCounters> Observations;
+  // Sum of every observation, for the keys seen
+  TypeCorrectCounters SampledTotals;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTSAMPLE_H */
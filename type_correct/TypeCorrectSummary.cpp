@@ -0,0 +1,107 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectSummary.cpp
+//
+// DESCRIPTION:
+//    `--summary` answers "how much would change, and where" for a large run.
+//    Workers report a handful of counters per TU rather than rewritten text
+//    (see TypeCorrectCounters), and they are folded into running totals as
+//    each TU completes, so memory grows with the number of distinct rules,
+//    type changes and directories, never with the number of edits.
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+
+#include "TypeCorrectSummary.h"
+
+void TypeCorrectSummary::add(llvm::StringRef File,
+                             const TypeCorrectCounters &Counts) {
+  NumTUs++;
+  Totals.merge(Counts);
+  if (const uint64_t Edits = Counts.total(RuleCounterPrefix))
+    ByDirectory.add(llvm::sys::path::parent_path(File), Edits);
+}
+
+// `Keys` sorted by descending count, then name
+static std::vector<llvm::StringRef>
+sortByCount(const TypeCorrectCounters &Counters,
+            std::vector<llvm::StringRef> Keys) {
+  std::stable_sort(Keys.begin(), Keys.end(),
+                   [&](llvm::StringRef L, llvm::StringRef R) {
+                     return Counters.get(L) > Counters.get(R);
+                   });
+  return Keys;
+}
+
+// The rule, from and to types of a ChangeCounterPrefix key
+static llvm::SmallVector<llvm::StringRef, 3>
+splitChangeKey(llvm::StringRef Key) {
+  llvm::SmallVector<llvm::StringRef, 3> Fields;
+  Key.drop_front(ChangeCounterPrefix.size())
+      .split(Fields, '\t', /*MaxSplit=*/2);
+  Fields.resize(3);
+  return Fields;
+}
+
+void TypeCorrectSummary::printTable(llvm::raw_ostream &OS) const {
+  const auto Row = [&](const llvm::Twine &Name, uint64_t Count) {
+    OS << llvm::format("    %-56s %10llu\n", Name.str().c_str(),
+                       static_cast<unsigned long long>(Count));
+  };
+
+  OS << "type_correct: " << getNumEdits() << " edits in " << NumTUs
+     << " TUs\n"
+     << "  per rule\n";
+  for (const llvm::StringRef Key :
+       sortByCount(Totals, Totals.keys(RuleCounterPrefix)))
+    Row(Key.drop_front(RuleCounterPrefix.size()), Totals.get(Key));
+
+  OS << "  per type change\n";
+  for (const llvm::StringRef Key :
+       sortByCount(Totals, Totals.keys(ChangeCounterPrefix))) {
+    const llvm::SmallVector<llvm::StringRef, 3> Change = splitChangeKey(Key);
+    Row(Change[1] + " -> " + Change[2] + " (" + Change[0] + ")",
+        Totals.get(Key));
+  }
+
+  OS << "  per directory\n";
+  for (const llvm::StringRef Dir : sortByCount(ByDirectory, ByDirectory.keys()))
+    Row(Dir.empty() ? "." : Dir, ByDirectory.get(Dir));
+}
+
+void TypeCorrectSummary::writeJSON(llvm::raw_ostream &OS) const {
+  llvm::json::OStream J(OS, /*IndentSize=*/2);
+  J.object([&] {
+    J.attribute("tus", static_cast<int64_t>(NumTUs));
+    J.attribute("edits", static_cast<int64_t>(getNumEdits()));
+    J.attributeObject("rules", [&] {
+      for (const llvm::StringRef Key : Totals.keys(RuleCounterPrefix))
+        J.attribute(Key.drop_front(RuleCounterPrefix.size()),
+                    static_cast<int64_t>(Totals.get(Key)));
+    });
+    J.attributeArray("changes", [&] {
+      for (const llvm::StringRef Key : Totals.keys(ChangeCounterPrefix))
+        J.object([&] {
+          const llvm::SmallVector<llvm::StringRef, 3> Change =
+              splitChangeKey(Key);
+          J.attribute("rule", Change[0]);
+          J.attribute("from", Change[1]);
+          J.attribute("to", Change[2]);
+          J.attribute("edits", static_cast<int64_t>(Totals.get(Key)));
+        });
+    });
+    J.attributeObject("directories", [&] {
+      for (const llvm::StringRef Dir : ByDirectory.keys())
+        J.attribute(Dir.empty() ? "." : Dir,
+                    static_cast<int64_t>(ByDirectory.get(Dir)));
+    });
+  });
+  OS << '\n';
+}
@@ -0,0 +1,52 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectSummary.h
+//
+// DESCRIPTION: Header for TypeCorrectSummary.cpp (`--summary`: edit counts
+// per rule, type change and directory, reduced as TUs complete)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTSUMMARY_H
+#define TYPECORRECT_TYPECORRECTSUMMARY_H
+
+#include <cstdint>
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "TypeCorrectCounters.h"
+
+#include "type_correct_export.h"
+
+class TYPE_CORRECT_EXPORT TypeCorrectSummary {
+public:
+  // Fold in the counters reported for the TU `File`
+  void add(llvm::StringRef File, const TypeCorrectCounters &Counts);
+
+  unsigned getNumTUs() const { return NumTUs; }
+  uint64_t getNumEdits() const { return Totals.total(RuleCounterPrefix); }
+  // Edits of every rule in the files of directory `Dir`
+  uint64_t getDirectoryEdits(llvm::StringRef Dir) const {
+    return ByDirectory.get(Dir);
+  }
+
+  // Human-readable tables, largest counts first
+  void printTable(llvm::raw_ostream &OS) const;
+  // The same as a JSON object:
+  //   {"tus": 2, "edits": 3, "rules": {"<rule>": 3},
+  //    "changes": [{"rule": "<rule>", "from": "int", "to": "size_t",
+  //                 "edits": 3}],
+  //    "directories": {"src": 3}}
+  void writeJSON(llvm::raw_ostream &OS) const;
+
+private:
+  unsigned NumTUs = 0;
+  // The per-TU counters, summed
+  TypeCorrectCounters Totals;
+  // Keyed by directory
+  TypeCorrectCounters ByDirectory;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTSUMMARY_H */
@@ -0,0 +1,211 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectTool.cpp
+//
+// DESCRIPTION:
+//    ClangTool runs the clang driver for every TU to turn its compile command
+//    into a CompilerInvocation. In a build with thousands of TUs most
+//    commands share their flags, so the driver's output for one command is
+//    reused, input swapped, for every other command that differs only in its
+//    input. Building the CompilerInvocation from cc1 arguments is cheap next
+//    to the driver (toolchain and installation detection, include path
+//    probing, ...).
+//
+// License: CC0
+//==============================================================================
+
+#include <cstdlib>
+
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/Utils.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "TypeCorrectTool.h"
+
+//===----------------------------------------------------------------------===//
+// Invocation cache
+//===----------------------------------------------------------------------===//
+llvm::Optional<std::vector<std::string>> TypeCorrectInvocationCache::getCC1Args(
+    llvm::StringRef Directory, llvm::ArrayRef<std::string> CommandLine,
+    llvm::StringRef Input, clang::DiagnosticsEngine &Diags,
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS) {
+  // The key: everything the driver looks at, except the input's name
+  std::string Key;
+  llvm::raw_string_ostream KeyOS(Key);
+  KeyOS << Directory << '\0' << llvm::sys::path::extension(Input) << '\0';
+  bool NamesInput = false;
+  for (const std::string &Arg : CommandLine) {
+    if (Arg == Input) {
+      NamesInput = true;
+      KeyOS << '\1';
+    } else {
+      KeyOS << Arg;
+    }
+    KeyOS << '\0';
+  }
+  KeyOS.flush();
+
+  const llvm::StringRef MainFileName = llvm::sys::path::filename(Input);
+  if (NamesInput) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    const auto It = Templates.find(Key);
+    if (It != Templates.end() && It->second.Reusable) {
+      Hits++;
+      std::vector<std::string> Args = It->second.Args;
+      for (const unsigned Idx : It->second.InputArgs)
+        Args[Idx] = Input.str();
+      if (It->second.MainFileNameArg)
+        Args[*It->second.MainFileNameArg] = MainFileName.str();
+      return Args;
+    }
+  }
+
+  Misses++;
+  std::vector<const char *> Argv;
+  for (const std::string &Arg : CommandLine)
+    Argv.push_back(Arg.c_str());
+  std::vector<std::string> CC1Args;
+  if (!clang::createInvocationFromCommandLine(
+          Argv, &Diags, std::move(VFS), /*ShouldRecoverOnErrors=*/false,
+          &CC1Args))
+    return llvm::None;
+  if (!NamesInput)
+    return CC1Args;
+
+  Template T;
+  T.Args = CC1Args;
+  const llvm::StringRef Stem = llvm::sys::path::stem(Input);
+  for (unsigned Idx = 0; Idx < T.Args.size(); Idx++) {
+    llvm::StringRef Arg = T.Args[Idx];
+    if (Arg == Input) {
+      T.InputArgs.push_back(Idx);
+    } else if (Idx > 0 && T.Args[Idx - 1] == "-main-file-name") {
+      T.MainFileNameArg = Idx;
+    } else if (Arg.contains((Stem + ".").str())) {
+      // Derived from the input, in a way not worth second-guessing
+      T.Reusable = false;
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Templates.try_emplace(Key, std::move(T));
+  return CC1Args;
+}
+
+//===----------------------------------------------------------------------===//
+// Tool
+//===----------------------------------------------------------------------===//
+TypeCorrectTool::TypeCorrectTool(
+    const clang::tooling::CompilationDatabase &Compilations,
+    llvm::ArrayRef<std::string> SourcePaths, TypeCorrectInvocationCache &Cache,
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> BaseFS)
+    : Compilations(Compilations), SourcePaths(SourcePaths), Cache(Cache),
+      FS(std::move(BaseFS)),
+      Files(new clang::FileManager(clang::FileSystemOptions(), FS)) {
+  // As ClangTool does
+  appendArgumentsAdjuster(clang::tooling::getClangStripOutputAdjuster());
+  appendArgumentsAdjuster(clang::tooling::getClangSyntaxOnlyAdjuster());
+  appendArgumentsAdjuster(
+      clang::tooling::getClangStripDependencyFileAdjuster());
+}
+
+void TypeCorrectTool::appendArgumentsAdjuster(
+    clang::tooling::ArgumentsAdjuster NewAdjuster) {
+  Adjuster = clang::tooling::combineAdjusters(std::move(Adjuster),
+                                              std::move(NewAdjuster));
+}
+
+// Anchor for finding the resource directory relative to the executable
+static int StaticSymbol;
+
+int TypeCorrectTool::run(clang::tooling::ToolAction *Action) {
+  const std::string ResourceDir =
+      "-resource-dir=" +
+      clang::CompilerInvocation::GetResourcesPath("type_correct",
+                                                  &StaticSymbol);
+  const std::shared_ptr<clang::PCHContainerOperations> PCHContainerOps =
+      std::make_shared<clang::PCHContainerOperations>();
+
+  bool Failed = false;
+  // As ClangTool does, sources are resolved up front, against the working
+  // directory the tool starts in: each compile command changes it (until
+  // it's restored at the end)
+  std::vector<std::string> AbsolutePaths;
+  for (const std::string &File : SourcePaths) {
+    llvm::Expected<std::string> AbsolutePath =
+        clang::tooling::getAbsolutePath(*FS, File);
+    if (!AbsolutePath) {
+      llvm::errs() << "Skipping " << File << ": "
+                   << llvm::toString(AbsolutePath.takeError()) << '\n';
+      Failed = true;
+      AbsolutePaths.emplace_back();
+      continue;
+    }
+    AbsolutePaths.push_back(std::move(*AbsolutePath));
+  }
+  const llvm::ErrorOr<std::string> InitialWorkingDir =
+      FS->getCurrentWorkingDirectory();
+
+  for (size_t Idx = 0; Idx < SourcePaths.size(); Idx++) {
+    const std::string &File = SourcePaths[Idx];
+    const std::string &AbsolutePath = AbsolutePaths[Idx];
+    if (AbsolutePath.empty())
+      continue;
+    const std::vector<clang::tooling::CompileCommand> Commands =
+        Compilations.getCompileCommands(AbsolutePath);
+    if (Commands.empty()) {
+      llvm::errs() << "Skipping " << File << ". Compile command not found.\n";
+      Failed = true;
+      continue;
+    }
+
+    for (const clang::tooling::CompileCommand &Command : Commands) {
+      if (FS->setCurrentWorkingDirectory(Command.Directory)) {
+        llvm::errs() << "Cannot chdir into \"" << Command.Directory
+                     << "\"\n";
+        Failed = true;
+        continue;
+      }
+      std::vector<std::string> CommandLine =
+          Adjuster(Command.CommandLine, AbsolutePath);
+      if (llvm::none_of(CommandLine, [](llvm::StringRef Arg) {
+            return Arg.startswith("-resource-dir");
+          }))
+        CommandLine.insert(CommandLine.begin() + 1, ResourceDir);
+
+      llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> Diags =
+          clang::CompilerInstance::createDiagnostics(
+              new clang::DiagnosticOptions());
+      llvm::Optional<std::vector<std::string>> CC1Args = Cache.getCC1Args(
+          Command.Directory, CommandLine, Command.Filename, *Diags, FS);
+      auto Invocation = std::make_shared<clang::CompilerInvocation>();
+      std::vector<const char *> CC1Argv;
+      if (CC1Args)
+        for (const std::string &Arg : *CC1Args)
+          CC1Argv.push_back(Arg.c_str());
+      if (!CC1Args || !clang::CompilerInvocation::CreateFromArgs(
+                          *Invocation, CC1Argv, *Diags,
+                          CommandLine.front().c_str())) {
+        llvm::errs() << "Error while processing " << File << ".\n";
+        Failed = true;
+        continue;
+      }
+      // The driver asks cc1 to leak its state on exit; this process goes on
+      Invocation->getFrontendOpts().DisableFree = false;
+      Invocation->getCodeGenOpts().DisableFree = false;
+
+      if (!Action->runInvocation(std::move(Invocation), Files.get(),
+                                 PCHContainerOps, /*DiagConsumer=*/nullptr)) {
+        llvm::errs() << "Error while processing " << File << ".\n";
+        Failed = true;
+      }
+    }
+  }
+  if (InitialWorkingDir)
+    FS->setCurrentWorkingDirectory(*InitialWorkingDir);
+  return Failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectTool.h
+//
+// DESCRIPTION: Header for TypeCorrectTool.cpp (runs a ToolAction over files
+// like ClangTool, reusing the driver's cc1 arguments between TUs whose
+// compile commands differ only in their input)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTTOOL_H
+#define TYPECORRECT_TYPECORRECTTOOL_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Tooling/ArgumentsAdjusters.h>
+#include <clang/Tooling/CompilationDatabase.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/VirtualFileSystem.h>
+
+#include "type_correct_export.h"
+
+// The cc1 arguments the clang driver derives from compile commands, kept as
+// templates keyed by the command line with the input file left out (plus the
+// working directory and the input's extension, which the driver also looks
+// at). A TU whose command matches an earlier one gets a copy with its input
+// patched in instead of a driver run. Thread-safe.
+class TYPE_CORRECT_EXPORT TypeCorrectInvocationCache {
+public:
+  // The cc1 arguments for `CommandLine`, run in `Directory`, where `Input` is
+  // the argument naming the input file. Returns None if the driver fails
+  // (after reporting to `Diags`).
+  llvm::Optional<std::vector<std::string>>
+  getCC1Args(llvm::StringRef Directory,
+             llvm::ArrayRef<std::string> CommandLine, llvm::StringRef Input,
+             clang::DiagnosticsEngine &Diags,
+             llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS);
+
+  // Commands answered from a template, and commands the driver ran for
+  unsigned getNumHits() const { return Hits; }
+  unsigned getNumMisses() const { return Misses; }
+
+private:
+  struct Template {
+    std::vector<std::string> Args;
+    // Where the input goes, and the argument of `-main-file-name`
+    std::vector<unsigned> InputArgs;
+    llvm::Optional<unsigned> MainFileNameArg;
+    // False if the input shows up in the arguments in some other form (e.g.
+    // a coverage file named after it): such commands always run the driver
+    bool Reusable = true;
+  };
+
+  std::mutex Mutex;
+  llvm::StringMap<Template> Templates;
+  std::atomic<unsigned> Hits{0}, Misses{0};
+};
+
+// Runs a ToolAction over each of `SourcePaths`, like ClangTool (with the
+// same default argument adjusters and resource directory), except that the
+// driver step goes through `Cache`
+class TYPE_CORRECT_EXPORT TypeCorrectTool {
+public:
+  TypeCorrectTool(const clang::tooling::CompilationDatabase &Compilations,
+                  llvm::ArrayRef<std::string> SourcePaths,
+                  TypeCorrectInvocationCache &Cache,
+                  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> BaseFS =
+                      llvm::vfs::createPhysicalFileSystem().release());
+
+  void appendArgumentsAdjuster(clang::tooling::ArgumentsAdjuster Adjuster);
+
+  // EXIT_SUCCESS if every compile command of every file ran successfully
+  int run(clang::tooling::ToolAction *Action);
+
+private:
+  const clang::tooling::CompilationDatabase &Compilations;
+  std::vector<std::string> SourcePaths;
+  TypeCorrectInvocationCache &Cache;
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> FS;
+  llvm::IntrusiveRefCntPtr<clang::FileManager> Files;
+  clang::tooling::ArgumentsAdjuster Adjuster;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTTOOL_H */
@@ -0,0 +1,520 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectWorkerPool.cpp
+//
+// DESCRIPTION:
+//    A pool of forked worker processes. The parent owns a job queue and hands
+//    one TU at a time to each idle worker over a pipe; the worker sends back a
+//    result frame holding the TU's output. A clang crash or assertion only
+//    takes down that worker: the parent notices the EOF, records the TU as
+//    crashed, forks a replacement and carries on with the rest of the queue.
+//
+//    The parent doubles as the watchdog: workers report each phase change
+//    (parse, match, write) as it happens, and a job that exceeds its time
+//    budget is killed, reported with the phase it was stuck in, and the rest
+//    of the queue keeps running on a replacement worker.
+//
+//    With a memory budget, the parent also acts as an admission controller:
+//    it sums the predicted peak RSS of the jobs in flight and only starts
+//    another one while that total stays under the budget. Workers measure
+//    each job's actual peak RSS and send it back with the result, so that the
+//    next run's predictions improve.
+//
+//    Frame layout (both directions): FrameHeader, then `Length` payload bytes.
+//    Job payloads are the file path; phase payloads are one TypeCorrectPhase
+//    byte; result payloads are the job's output. The parent never blocks on
+//    a worker: it reads whatever each one has sent into a buffer of its own,
+//    and handles a frame once all of it is there, so that a worker stopped
+//    halfway through a large result still gets killed on time.
+//
+// License: CC0
+//==============================================================================
+
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+#include <llvm/Config/llvm-config.h>
+
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif /* LLVM_ON_UNIX */
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "TypeCorrectWorkerPool.h"
+
+#ifdef LLVM_ON_UNIX
+namespace {
+enum class FrameKind : uint8_t { Job, Phase, Result };
+
+struct FrameHeader {
+  FrameKind Kind;
+  TypeCorrectWorkerPool::JobStatus Status;
+  uint16_t Reserved;
+  uint32_t Index;
+  uint32_t Length;
+  // Result frames only
+  uint64_t PeakRSS;
+};
+
+bool writeAll(int FD, const char *Data, size_t Size) {
+  while (Size) {
+    const ssize_t N = ::write(FD, Data, Size);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    Data += N;
+    Size -= static_cast<size_t>(N);
+  }
+  return true;
+}
+
+// Returns false on EOF or error
+bool readAll(int FD, char *Data, size_t Size) {
+  while (Size) {
+    const ssize_t N = ::read(FD, Data, Size);
+    if (N < 0 && errno == EINTR)
+      continue;
+    if (N <= 0)
+      return false;
+    Data += N;
+    Size -= static_cast<size_t>(N);
+  }
+  return true;
+}
+
+bool writeFrame(int FD, FrameKind Kind, TypeCorrectWorkerPool::JobStatus Status,
+                uint32_t Index, llvm::StringRef Payload, uint64_t PeakRSS = 0) {
+  const FrameHeader Header{Kind, Status, 0, Index,
+                           static_cast<uint32_t>(Payload.size()), PeakRSS};
+  return writeAll(FD, reinterpret_cast<const char *>(&Header),
+                  sizeof(Header)) &&
+         writeAll(FD, Payload.data(), Payload.size());
+}
+
+bool readFrame(int FD, FrameHeader &Header, std::string &Payload) {
+  if (!readAll(FD, reinterpret_cast<char *>(&Header), sizeof(Header)))
+    return false;
+  Payload.resize(Header.Length);
+  return readAll(FD, &Payload[0], Payload.size());
+}
+
+// Appends whatever the nonblocking `FD` has to `Buffer`. Returns false on
+// EOF or error.
+bool readAvailable(int FD, std::string &Buffer) {
+  char Chunk[64 << 10];
+  while (true) {
+    const ssize_t N = ::read(FD, Chunk, sizeof(Chunk));
+    if (N > 0) {
+      Buffer.append(Chunk, static_cast<size_t>(N));
+      continue;
+    }
+    if (N < 0 && errno == EINTR)
+      continue;
+    return N < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+}
+
+// Takes the first frame off `Buffer`, if all of it is there
+bool takeFrame(std::string &Buffer, FrameHeader &Header,
+               std::string &Payload) {
+  if (Buffer.size() < sizeof(Header))
+    return false;
+  std::memcpy(&Header, Buffer.data(), sizeof(Header));
+  const size_t Size = sizeof(Header) + Header.Length;
+  if (Buffer.size() < Size) {
+    // A result is read in many pieces; grow only once
+    Buffer.reserve(Size);
+    return false;
+  }
+  if (Buffer.size() == Size) {
+    // Usually the whole result: handed over without a copy
+    Buffer.erase(0, sizeof(Header));
+    Payload = std::move(Buffer);
+    Buffer = std::string();
+    return true;
+  }
+  Payload.assign(Buffer, sizeof(Header), Header.Length);
+  Buffer.erase(0, Size);
+  return true;
+}
+
+// Start measuring the peak RSS of the next job. Linux lets the high-water
+// mark be reset; elsewhere the process-lifetime peak is reported, which can
+// only overestimate.
+void resetPeakRSS() {
+#ifdef __linux__
+  const int FD = ::open("/proc/self/clear_refs", O_WRONLY);
+  if (FD >= 0) {
+    (void)!::write(FD, "5", 1);
+    ::close(FD);
+  }
+#endif /* __linux__ */
+}
+
+uint64_t getPeakRSS() {
+#ifdef __linux__
+  if (llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Status =
+          llvm::MemoryBuffer::getFileAsStream("/proc/self/status")) {
+    llvm::StringRef Rest = (*Status)->getBuffer();
+    while (!Rest.empty()) {
+      llvm::StringRef Line;
+      std::tie(Line, Rest) = Rest.split('\n');
+      uint64_t KiB;
+      if (Line.consume_front("VmHWM:") &&
+          !Line.trim().drop_back(/*"kB"*/ 2).trim().getAsInteger(10, KiB))
+        return KiB * 1024;
+    }
+  }
+#endif /* __linux__ */
+  struct rusage Usage {};
+  if (::getrusage(RUSAGE_SELF, &Usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return static_cast<uint64_t>(Usage.ru_maxrss); // bytes
+#else
+  return static_cast<uint64_t>(Usage.ru_maxrss) * 1024; // KiB
+#endif /* __APPLE__ */
+}
+
+double secondsSince(std::chrono::steady_clock::time_point Start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       Start)
+      .count();
+}
+} // namespace
+#endif /* LLVM_ON_UNIX */
+
+TypeCorrectWorkerPool::TypeCorrectWorkerPool(Options PoolOpts, JobFn Job)
+    : Opts(PoolOpts), Fn(std::move(Job)) {
+  if (Opts.NumWorkers == 0)
+    Opts.NumWorkers = 1;
+}
+
+TypeCorrectWorkerPool::~TypeCorrectWorkerPool() { shutdown(); }
+
+#ifdef LLVM_ON_UNIX
+bool TypeCorrectWorkerPool::spawn(Worker &W) {
+  int ToPipe[2], FromPipe[2];
+  if (::pipe(ToPipe) != 0)
+    return false;
+  if (::pipe(FromPipe) != 0) {
+    ::close(ToPipe[0]);
+    ::close(ToPipe[1]);
+    return false;
+  }
+
+  // Anything still buffered would otherwise be written twice
+  llvm::outs().flush();
+  llvm::errs().flush();
+
+  const pid_t Pid = ::fork();
+  if (Pid < 0) {
+    for (const int FD : {ToPipe[0], ToPipe[1], FromPipe[0], FromPipe[1]})
+      ::close(FD);
+    return false;
+  }
+  if (Pid == 0) {
+    // Drop the parent's ends, including those of sibling workers: a sibling
+    // holding a copy would hide that sibling's EOF from the parent.
+    ::close(ToPipe[1]);
+    ::close(FromPipe[0]);
+    for (const Worker &Other : Workers)
+      if (&Other != &W && Other.Pid > 0) {
+        ::close(Other.ToWorker);
+        ::close(Other.FromWorker);
+      }
+    ::signal(SIGPIPE, SIG_DFL);
+    workerLoop(ToPipe[0], FromPipe[1]);
+  }
+
+  ::close(ToPipe[0]);
+  ::close(FromPipe[1]);
+  // Read as it comes, so that a worker stalled mid-frame can't block the
+  // parent, and with it the watchdog
+  ::fcntl(FromPipe[0], F_SETFL, ::fcntl(FromPipe[0], F_GETFL) | O_NONBLOCK);
+  if (W.Restart && Opts.OnRestart)
+    Opts.OnRestart();
+  W.Pid = Pid;
+  W.ToWorker = ToPipe[1];
+  W.FromWorker = FromPipe[0];
+  W.Job = -1;
+  return true;
+}
+
+void TypeCorrectWorkerPool::workerLoop(int In, int Out) {
+  FrameHeader Header;
+  std::string File;
+  while (readFrame(In, Header, File)) {
+    const uint32_t Index = Header.Index;
+    const TypeCorrectPhaseFn OnPhase = [&](TypeCorrectPhase Phase) {
+      const char Byte = static_cast<char>(Phase);
+      writeFrame(Out, FrameKind::Phase, JobStatus::Succeeded, Index,
+                 llvm::StringRef(&Byte, 1));
+    };
+
+    std::string Output;
+    llvm::raw_string_ostream OS(Output);
+    resetPeakRSS();
+    const bool Succeeded = Fn(File, OS, OnPhase);
+    OS.flush();
+    llvm::outs().flush();
+    llvm::errs().flush();
+    if (!writeFrame(Out, FrameKind::Result,
+                    Succeeded ? JobStatus::Succeeded : JobStatus::Failed,
+                    Index, Output, getPeakRSS()))
+      break;
+  }
+  // Skip static destructors and atexit handlers: they belong to the parent
+  ::_exit(EXIT_SUCCESS);
+}
+
+int TypeCorrectWorkerPool::reap(Worker &W) {
+  int WaitStatus = 0;
+  while (::waitpid(W.Pid, &WaitStatus, 0) < 0 && errno == EINTR)
+    ;
+  ::close(W.ToWorker);
+  ::close(W.FromWorker);
+  W = Worker();
+  W.Restart = true;
+  return WaitStatus;
+}
+
+void TypeCorrectWorkerPool::shutdown() {
+  // EOF on the job pipe tells an idle worker to exit
+  for (Worker &W : Workers)
+    if (W.Pid > 0) {
+      ::close(W.ToWorker);
+      W.ToWorker = -1;
+    }
+  for (Worker &W : Workers)
+    if (W.Pid > 0) {
+      if (W.Job >= 0)
+        ::kill(W.Pid, SIGKILL);
+      reap(W);
+    }
+  Workers.clear();
+}
+
+void TypeCorrectWorkerPool::run(llvm::ArrayRef<std::string> Files,
+                                ResultFn OnResult,
+                                llvm::ArrayRef<unsigned> Order,
+                                llvm::ArrayRef<uint64_t> PeakRSS,
+                                StartFn OnStart) {
+  assert((Order.empty() || Order.size() == Files.size()) &&
+         "Order must cover every file exactly once");
+  assert((PeakRSS.empty() || PeakRSS.size() == Files.size()) &&
+         "PeakRSS must have a prediction for every file");
+  std::deque<unsigned> Queue(Order.begin(), Order.end());
+  if (Order.empty())
+    for (unsigned Idx = 0; Idx < Files.size(); Idx++)
+      Queue.push_back(Idx);
+
+  Workers.resize(std::min<size_t>(Opts.NumWorkers, Files.size()));
+
+  // A worker dying mid-write must surface as EPIPE, not kill the parent
+  struct sigaction IgnorePipe {}, OldPipe{};
+  IgnorePipe.sa_handler = SIG_IGN;
+  ::sigaction(SIGPIPE, &IgnorePipe, &OldPipe);
+
+  // Predicted peak RSS of every job in flight
+  uint64_t Projected = 0;
+  const auto Predicted = [&](unsigned Idx) -> uint64_t {
+    return PeakRSS.empty() ? 0 : PeakRSS[Idx];
+  };
+
+  // Builds the result of the job in flight on `W`, and marks `W` idle
+  const auto Finish = [&](Worker &W, JobStatus Status, std::string Output) {
+    JobResult Result;
+    Result.Index = static_cast<unsigned>(W.Job);
+    Result.Status = Status;
+    Result.Output = std::move(Output);
+    Result.Seconds = secondsSince(W.Started);
+    Result.Phase = W.Phase;
+    Result.PhaseSeconds = W.PhaseSeconds;
+    Result.PhaseSeconds[static_cast<unsigned>(W.Phase)] +=
+        secondsSince(W.PhaseStarted);
+    Projected -= W.ProjectedRSS;
+    W.Job = -1;
+    W.ProjectedRSS = 0;
+    return Result;
+  };
+
+  // A dead worker's in-flight job is finished as Crashed/TimedOut; the
+  // worker itself is only re-forked when there is more work for it.
+  size_t Busy = 0;
+  const auto Bury = [&](Worker &W, JobStatus Status) {
+    JobResult Result = Finish(W, Status, std::string());
+    const int WaitStatus = reap(W);
+    Result.TermSignal = WIFSIGNALED(WaitStatus) ? WTERMSIG(WaitStatus) : 0;
+    Busy--;
+    OnResult(Files[Result.Index], Result);
+  };
+
+  while (!Queue.empty() || Busy) {
+    // Dispatch
+    bool SpawnFailed = false;
+    for (Worker &W : Workers) {
+      if (Queue.empty())
+        break;
+      if (W.Job >= 0)
+        continue;
+
+      // Admission: the first queued job that fits in the memory budget (the
+      // queue is longest first, so that's the biggest that fits)
+      auto Next = Queue.begin();
+      if (Opts.MemoryBudgetBytes && Busy) {
+        Next = std::find_if(Queue.begin(), Queue.end(), [&](unsigned Idx) {
+          return Projected + Predicted(Idx) <= Opts.MemoryBudgetBytes;
+        });
+        if (Next == Queue.end())
+          break;
+      }
+
+      if (W.Pid < 0 && !spawn(W)) {
+        SpawnFailed = true;
+        continue;
+      }
+      const unsigned Idx = *Next;
+      if (!writeFrame(W.ToWorker, FrameKind::Job, JobStatus::Succeeded, Idx,
+                      Files[Idx])) {
+        // Died while idle; a replacement picks the job up next time around
+        reap(W);
+        continue;
+      }
+      Queue.erase(Next);
+      W.Job = static_cast<int>(Idx);
+      W.ProjectedRSS = Predicted(Idx);
+      Projected += W.ProjectedRSS;
+      W.Started = W.PhaseStarted = std::chrono::steady_clock::now();
+      W.Phase = TypeCorrectPhase::Parse;
+      W.PhaseSeconds = {};
+      Busy++;
+      if (OnStart)
+        OnStart(Files[Idx]);
+    }
+    if (!Busy) {
+      if (!SpawnFailed)
+        continue;
+      llvm::errs() << "type_correct: unable to start worker processes: "
+                   << std::strerror(errno) << '\n';
+      break;
+    }
+
+    // Wait for a result, a death or the next deadline
+    std::vector<pollfd> PollFDs;
+    std::vector<Worker *> Polled;
+    int TimeoutMs = -1;
+    for (Worker &W : Workers) {
+      if (W.Job < 0)
+        continue;
+      PollFDs.push_back({W.FromWorker, POLLIN, 0});
+      Polled.push_back(&W);
+      if (Opts.TimeoutSeconds) {
+        const int Remaining = std::max(
+            static_cast<int>(
+                (Opts.TimeoutSeconds - secondsSince(W.Started)) * 1000),
+            0);
+        TimeoutMs = TimeoutMs < 0 ? Remaining : std::min(TimeoutMs, Remaining);
+      }
+    }
+    if (::poll(PollFDs.data(), PollFDs.size(), TimeoutMs) < 0) {
+      if (errno == EINTR)
+        continue;
+      llvm::errs() << "type_correct: waiting on workers failed: "
+                   << std::strerror(errno) << '\n';
+      break;
+    }
+
+    for (size_t Idx = 0; Idx < PollFDs.size(); Idx++) {
+      if (!PollFDs[Idx].revents)
+        continue;
+      Worker &W = *Polled[Idx];
+      const bool Open = readAvailable(W.FromWorker, W.Received);
+      FrameHeader Header;
+      std::string Payload;
+      while (W.Job >= 0 && takeFrame(W.Received, Header, Payload)) {
+        if (Header.Kind == FrameKind::Phase && Payload.size() == 1) {
+          const auto Now = std::chrono::steady_clock::now();
+          W.PhaseSeconds[static_cast<unsigned>(W.Phase)] +=
+              std::chrono::duration<double>(Now - W.PhaseStarted).count();
+          W.Phase = static_cast<TypeCorrectPhase>(Payload[0]);
+          W.PhaseStarted = Now;
+          continue;
+        }
+        JobResult Result = Finish(W, Header.Status, std::move(Payload));
+        Result.PeakRSSBytes = Header.PeakRSS;
+        Busy--;
+        OnResult(Files[Result.Index], Result);
+      }
+      // Died mid-job (or mid-frame). One that died idle is found out when
+      // it's next given a job.
+      if (!Open && W.Job >= 0)
+        Bury(W, JobStatus::Crashed);
+    }
+
+    // Watchdog: jobs over their time budget
+    if (Opts.TimeoutSeconds)
+      for (Worker &W : Workers)
+        if (W.Job >= 0 && secondsSince(W.Started) >= Opts.TimeoutSeconds) {
+          ::kill(W.Pid, SIGKILL);
+          Bury(W, JobStatus::TimedOut);
+        }
+  }
+
+  // Only reached early when the pool itself broke down: still give every job
+  // its result.
+  for (Worker &W : Workers)
+    if (W.Job >= 0) {
+      ::kill(W.Pid, SIGKILL);
+      Bury(W, JobStatus::Crashed);
+    }
+  for (const unsigned Idx : Queue) {
+    JobResult Result;
+    Result.Index = Idx;
+    Result.Status = JobStatus::Failed;
+    OnResult(Files[Idx], Result);
+  }
+
+  shutdown();
+  ::sigaction(SIGPIPE, &OldPipe, nullptr);
+}
+#else
+// No fork: run in-process, without isolation
+bool TypeCorrectWorkerPool::spawn(Worker &) { return false; }
+int TypeCorrectWorkerPool::reap(Worker &) { return 0; }
+void TypeCorrectWorkerPool::shutdown() {}
+void TypeCorrectWorkerPool::workerLoop(int, int) { std::abort(); }
+
+void TypeCorrectWorkerPool::run(llvm::ArrayRef<std::string> Files,
+                                ResultFn OnResult,
+                                llvm::ArrayRef<unsigned> Order,
+                                llvm::ArrayRef<uint64_t>, StartFn OnStart) {
+  for (unsigned Pos = 0; Pos < Files.size(); Pos++) {
+    const unsigned Idx = Order.empty() ? Pos : Order[Pos];
+    if (OnStart)
+      OnStart(Files[Idx]);
+    const auto Started = std::chrono::steady_clock::now();
+    JobResult Result;
+    Result.Index = Idx;
+    llvm::raw_string_ostream OS(Result.Output);
+    Result.Status = Fn(Files[Idx], OS, nullptr) ? JobStatus::Succeeded
+                                                 : JobStatus::Failed;
+    OS.flush();
+    Result.Seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - Started)
+                         .count();
+    OnResult(Files[Idx], Result);
+  }
+}
+#endif /* LLVM_ON_UNIX */
@@ -0,0 +1,133 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectWorkerPool.h
+//
+// DESCRIPTION: Header for TypeCorrectWorkerPool.cpp (crash-isolated, fork-based
+// worker processes fed by a job queue over pipes)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTWORKERPOOL_H
+#define TYPECORRECT_TYPECORRECTWORKERPOOL_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "TypeCorrectPhase.h"
+
+#include "type_correct_export.h"
+
+class TYPE_CORRECT_EXPORT TypeCorrectWorkerPool {
+public:
+  enum class JobStatus : uint8_t {
+    Succeeded,
+    Failed,   // The job ran to completion but reported an error
+    Crashed,  // The worker died (signal, assertion, non-zero `_exit`)
+    TimedOut, // The worker was killed after exceeding the TU time budget
+  };
+
+  struct JobResult {
+    // Index of the job in the `Files` passed to run()
+    unsigned Index = 0;
+    JobStatus Status = JobStatus::Succeeded;
+    // Everything the job wrote to its output stream
+    std::string Output;
+    // Signal that terminated the worker, for Crashed/TimedOut
+    int TermSignal = 0;
+    // Wall time from dispatch to result
+    double Seconds = 0;
+    // Last phase the job reported; for TimedOut, the phase it was killed in
+    TypeCorrectPhase Phase = TypeCorrectPhase::Parse;
+    // Wall time spent in each phase, indexed by TypeCorrectPhase
+    std::array<double, NumTypeCorrectPhases> PhaseSeconds{};
+    // Peak resident set size of the worker while running this job (0 if
+    // unknown, e.g. after a crash)
+    uint64_t PeakRSSBytes = 0;
+  };
+
+  struct Options {
+    // Number of worker processes
+    unsigned NumWorkers = 1;
+    // Watchdog: kill (and replace) a worker whose job runs longer than this;
+    // 0 means no limit
+    unsigned TimeoutSeconds = 0;
+    // Only start another job while the predicted peak RSS of every job in
+    // flight, plus its own, stays within this budget; 0 means unlimited.
+    // A job is always admitted when nothing else is running.
+    uint64_t MemoryBudgetBytes = 0;
+    // Runs in the parent process each time a worker that died (crashed, was
+    // killed by the watchdog, or went away while idle) is replaced
+    std::function<void()> OnRestart;
+  };
+
+  // Runs inside a worker process. Whatever is written to `Out` is shipped back
+  // to the parent in JobResult::Output; phases reported through `OnPhase`
+  // are forwarded to the parent as they happen.
+  using JobFn = std::function<bool(llvm::StringRef File, llvm::raw_ostream &Out,
+                                   const TypeCorrectPhaseFn &OnPhase)>;
+  // Runs in the parent process, once per job, as each job finishes
+  using ResultFn =
+      llvm::function_ref<void(llvm::StringRef File, const JobResult &Result)>;
+  // Runs in the parent process as each job is handed to a worker
+  using StartFn = llvm::function_ref<void(llvm::StringRef File)>;
+
+  TypeCorrectWorkerPool(Options PoolOpts, JobFn Job);
+  ~TypeCorrectWorkerPool();
+
+  TypeCorrectWorkerPool(const TypeCorrectWorkerPool &) = delete;
+  TypeCorrectWorkerPool &operator=(const TypeCorrectWorkerPool &) = delete;
+
+  // Process every file of `Files`, dispatching them in `Order` (indices into
+  // `Files`; empty means as given). `PeakRSS` holds the predicted peak RSS of
+  // each file, for Options::MemoryBudgetBytes; when the next job doesn't fit,
+  // the first later one that does is started instead. Crashed or hung
+  // workers are replaced and the queue keeps draining; every job gets
+  // exactly one OnResult call, and one OnStart call (if set) per dispatch.
+  void run(llvm::ArrayRef<std::string> Files, ResultFn OnResult,
+           llvm::ArrayRef<unsigned> Order = llvm::None,
+           llvm::ArrayRef<uint64_t> PeakRSS = llvm::None,
+           StartFn OnStart = nullptr);
+
+private:
+  struct Worker {
+    int Pid = -1;
+    // Whether a worker ran in this slot before, so that forking one is a
+    // restart
+    bool Restart = false;
+    int ToWorker = -1;   // Job frames, parent -> worker
+    int FromWorker = -1; // Result frames, worker -> parent
+    // What has been read from `FromWorker`, short of a whole frame
+    std::string Received;
+    // Index of the job in flight, or -1 when idle
+    int Job = -1;
+    // Its predicted peak RSS, counted against the memory budget
+    uint64_t ProjectedRSS = 0;
+    std::chrono::steady_clock::time_point Started;
+    // Phase of the job in flight, and when it was entered
+    TypeCorrectPhase Phase = TypeCorrectPhase::Parse;
+    std::chrono::steady_clock::time_point PhaseStarted;
+    std::array<double, NumTypeCorrectPhases> PhaseSeconds{};
+  };
+
+  bool spawn(Worker &W);
+  // Wait for a worker that has exited or been killed; returns its wait status
+  int reap(Worker &W);
+  void shutdown();
+  [[noreturn]] void workerLoop(int In, int Out);
+
+  Options Opts;
+  JobFn Fn;
+  std::vector<Worker> Workers;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTWORKERPOOL_H */
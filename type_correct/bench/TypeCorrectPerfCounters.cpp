@@ -0,0 +1,127 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectPerfCounters.cpp
+//
+// DESCRIPTION:
+//    Cycles, instructions, cache misses and branch misses of the calling
+//    thread, so that bench_type_correct can tell a branch-bound phase from a
+//    cache-miss-bound one. The events are opened as one perf_event group, so
+//    they are scheduled onto the PMU together and their ratios (IPC, misses
+//    per instruction) are consistent even when the kernel multiplexes.
+//    Only user-space events are counted, which works at the default
+//    perf_event_paranoid level of 2.
+//
+// License: CC0
+//==============================================================================
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
+#include "TypeCorrectPerfCounters.h"
+
+const char *TypeCorrectPerfCounters::getEventName(Event E) {
+  switch (E) {
+  case Cycles:
+    return "cycles";
+  case Instructions:
+    return "instructions";
+  case CacheMisses:
+    return "cache-misses";
+  case BranchMisses:
+    return "branch-misses";
+  case NumEvents:
+    break;
+  }
+  return "unknown";
+}
+
+#ifdef __linux__
+static int openEvent(uint64_t Config, int GroupFD) {
+  struct perf_event_attr Attr;
+  std::memset(&Attr, 0, sizeof(Attr));
+  Attr.type = PERF_TYPE_HARDWARE;
+  Attr.size = sizeof(Attr);
+  Attr.config = Config;
+  Attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+                     PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  Attr.exclude_kernel = 1;
+  Attr.exclude_hv = 1;
+  // The leader starts disabled and brings the group up in one go
+  Attr.disabled = GroupFD < 0;
+  return static_cast<int>(::syscall(SYS_perf_event_open, &Attr, /*pid=*/0,
+                                    /*cpu=*/-1, GroupFD, /*flags=*/0));
+}
+
+TypeCorrectPerfCounters::TypeCorrectPerfCounters() {
+  FDs.fill(-1);
+  static constexpr uint64_t Configs[NumEvents] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+  FDs[Cycles] = openEvent(Configs[Cycles], -1);
+  if (FDs[Cycles] < 0) {
+    Error = std::string("perf_event_open: ") + std::strerror(errno);
+    return;
+  }
+  for (unsigned E = Cycles + 1; E < NumEvents; E++)
+    FDs[E] = openEvent(Configs[E], FDs[Cycles]);
+
+  ::ioctl(FDs[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ::ioctl(FDs[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+TypeCorrectPerfCounters::~TypeCorrectPerfCounters() {
+  // Members before the leader
+  for (unsigned E = NumEvents; E-- > 0;)
+    if (FDs[E] >= 0)
+      ::close(FDs[E]);
+}
+
+TypeCorrectPerfCounters::Sample TypeCorrectPerfCounters::read() const {
+  Sample Counts{};
+  if (!isAvailable())
+    return Counts;
+
+  // {nr, time_enabled, time_running, {value, id} x nr}
+  struct {
+    uint64_t NumValues, TimeEnabled, TimeRunning;
+    struct {
+      uint64_t Value, ID;
+    } Values[NumEvents];
+  } Buffer;
+  if (::read(FDs[Cycles], &Buffer, sizeof(Buffer)) <= 0)
+    return Counts;
+
+  const double Scale = Buffer.TimeRunning
+                           ? static_cast<double>(Buffer.TimeEnabled) /
+                                 static_cast<double>(Buffer.TimeRunning)
+                           : 0;
+  // Values come in the order the events joined the group, i.e. skipping the
+  // unsupported ones
+  unsigned Value = 0;
+  for (unsigned E = 0; E < NumEvents && Value < Buffer.NumValues; E++)
+    if (FDs[E] >= 0)
+      Counts[E] = static_cast<uint64_t>(
+          static_cast<double>(Buffer.Values[Value++].Value) * Scale);
+  return Counts;
+}
+#else
+TypeCorrectPerfCounters::TypeCorrectPerfCounters()
+    : Error("hardware counters need Linux perf_event_open") {
+  FDs.fill(-1);
+}
+
+TypeCorrectPerfCounters::~TypeCorrectPerfCounters() = default;
+
+TypeCorrectPerfCounters::Sample TypeCorrectPerfCounters::read() const {
+  return Sample{};
+}
+#endif /* __linux__ */
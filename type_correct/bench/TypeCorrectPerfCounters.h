@@ -0,0 +1,53 @@
+//==============================================================================
+// FILE:
+//    TypeCorrectPerfCounters.h
+//
+// DESCRIPTION: Header for TypeCorrectPerfCounters.cpp (hardware performance
+// counters of the calling thread, through Linux perf_event_open)
+//
+// License: CC0
+//==============================================================================
+
+#ifndef TYPECORRECT_TYPECORRECTPERFCOUNTERS_H
+#define TYPECORRECT_TYPECORRECTPERFCOUNTERS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+class TypeCorrectPerfCounters {
+public:
+  enum Event : unsigned {
+    Cycles,
+    Instructions,
+    CacheMisses,
+    BranchMisses,
+    NumEvents
+  };
+  using Sample = std::array<uint64_t, NumEvents>;
+
+  static const char *getEventName(Event E);
+
+  // Start counting user-space events of the calling thread. Counting may be
+  // unavailable altogether (not Linux, perf_event_paranoid, a VM without a
+  // virtual PMU) or for single events; see isAvailable and isSupported.
+  TypeCorrectPerfCounters();
+  ~TypeCorrectPerfCounters();
+  TypeCorrectPerfCounters(const TypeCorrectPerfCounters &) = delete;
+  TypeCorrectPerfCounters &operator=(const TypeCorrectPerfCounters &) = delete;
+
+  bool isAvailable() const { return FDs[Cycles] >= 0; }
+  bool isSupported(Event E) const { return FDs[E] >= 0; }
+  // Why counting is unavailable
+  const std::string &getError() const { return Error; }
+
+  // Counts since construction, scaled up if the kernel had to multiplex the
+  // PMU; unsupported events read as 0
+  Sample read() const;
+
+private:
+  std::array<int, NumEvents> FDs;
+  std::string Error;
+};
+
+#endif /* TYPECORRECT_TYPECORRECTPERFCOUNTERS_H */
@@ -0,0 +1,262 @@
+//==============================================================================
+// FILE:
+//    bench_type_correct.cpp
+//
+// DESCRIPTION:
+//    Benchmark harness: runs TypeCorrect over each given TU a number of times
+//    and reports, per phase (parse, match, write), the mean wall time and,
+//    with `--perf`, hardware counters and IPC. A low IPC with many cache
+//    misses points at data layout; many branch misses at control flow.
+//
+//    With `--apply-edits`, instead compares applying N insertions to a
+//    synthetic file through clang::Rewriter and through applyInsertions.
+//
+// USAGE:
+//    * bench_type_correct --perf --iterations=5 big.c -- -I include
+//    * bench_type_correct --apply-edits=10,10000,1000000
+//
+// License: CC0
+//==============================================================================
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <clang/Basic/SourceManager.h>
+#include <clang/Rewrite/Core/Rewriter.h>
+#include <clang/Tooling/CommonOptionsParser.h>
+#include <llvm/ADT/Optional.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+
+#include <type_correct/TypeCorrectApply.h>
+#include <type_correct/TypeCorrectMain.h>
+
+#include "TypeCorrectPerfCounters.h"
+
+//===----------------------------------------------------------------------===//
+// Command line options
+//===----------------------------------------------------------------------===//
+static llvm::cl::OptionCategory BenchCategory("bench_type_correct options");
+
+static llvm::cl::opt<bool>
+    Perf("perf",
+         llvm::cl::desc("Also count cycles, instructions, cache misses and "
+                        "branch misses per phase (Linux perf_event_open)"),
+         llvm::cl::cat(BenchCategory));
+
+static llvm::cl::opt<unsigned>
+    Iterations("iterations", llvm::cl::desc("Runs per TU"), llvm::cl::init(3),
+               llvm::cl::cat(BenchCategory));
+
+static llvm::cl::list<unsigned> ApplyEdits(
+    "apply-edits",
+    llvm::cl::desc("Instead of running TUs, time applying this many edits to "
+                   "one file with clang::Rewriter and with applyInsertions"),
+    llvm::cl::value_desc("N,..."), llvm::cl::CommaSeparated,
+    llvm::cl::cat(BenchCategory));
+
+//===----------------------------------------------------------------------===//
+// Per-phase profile
+//===----------------------------------------------------------------------===//
+namespace {
+class PhaseProfile {
+public:
+  // `Counters` may be null, for timing only
+  explicit PhaseProfile(const TypeCorrectPerfCounters *Counters)
+      : Counters(Counters) {}
+
+  // Close the phase in progress, if any, and open `Phase`
+  void enter(TypeCorrectPhase Phase) {
+    close();
+    Current = Phase;
+    Started = std::chrono::steady_clock::now();
+    if (Counters)
+      StartSample = Counters->read();
+  }
+
+  void close() {
+    if (!Current)
+      return;
+    Total &T = Totals[static_cast<unsigned>(*Current)];
+    T.Seconds += std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - Started)
+                     .count();
+    if (Counters) {
+      const TypeCorrectPerfCounters::Sample Now = Counters->read();
+      for (unsigned E = 0; E < TypeCorrectPerfCounters::NumEvents; E++)
+        T.Counts[E] += Now[E] - StartSample[E];
+    }
+    Current.reset();
+  }
+
+  // Means over `Runs` runs
+  void print(llvm::raw_ostream &OS, unsigned Runs) const {
+    OS << llvm::format("  %-6s %10s", "phase", "seconds");
+    if (Counters) {
+      for (unsigned E = 0; E < TypeCorrectPerfCounters::NumEvents; E++)
+        OS << llvm::format(" %14s", TypeCorrectPerfCounters::getEventName(
+                                        TypeCorrectPerfCounters::Event(E)));
+      OS << llvm::format(" %6s", "IPC");
+    }
+    OS << '\n';
+
+    for (unsigned P = 0; P < NumTypeCorrectPhases; P++) {
+      const Total &T = Totals[P];
+      OS << llvm::format("  %-6s %10.4f",
+                         getPhaseName(static_cast<TypeCorrectPhase>(P)),
+                         T.Seconds / Runs);
+      if (Counters) {
+        for (unsigned E = 0; E < TypeCorrectPerfCounters::NumEvents; E++) {
+          if (Counters->isSupported(TypeCorrectPerfCounters::Event(E)))
+            OS << llvm::format(" %14llu",
+                               static_cast<unsigned long long>(T.Counts[E] /
+                                                               Runs));
+          else
+            OS << llvm::format(" %14s", "-");
+        }
+        const uint64_t Cycles = T.Counts[TypeCorrectPerfCounters::Cycles];
+        if (Cycles &&
+            Counters->isSupported(TypeCorrectPerfCounters::Instructions))
+          OS << llvm::format(
+              " %6.2f",
+              static_cast<double>(
+                  T.Counts[TypeCorrectPerfCounters::Instructions]) /
+                  static_cast<double>(Cycles));
+        else
+          OS << llvm::format(" %6s", "-");
+      }
+      OS << '\n';
+    }
+  }
+
+private:
+  struct Total {
+    double Seconds = 0;
+    TypeCorrectPerfCounters::Sample Counts{};
+  };
+
+  const TypeCorrectPerfCounters *Counters;
+  llvm::Optional<TypeCorrectPhase> Current;
+  std::chrono::steady_clock::time_point Started;
+  TypeCorrectPerfCounters::Sample StartSample{};
+  std::array<Total, NumTypeCorrectPhases> Totals;
+};
+} // namespace
+
+//===----------------------------------------------------------------------===//
+// Edit application
+//===----------------------------------------------------------------------===//
+// Seconds per run of `Fn`, the best of `Runs`
+template <typename FnT> static double bestOf(unsigned Runs, FnT Fn) {
+  double Best = 0;
+  for (unsigned Run = 0; Run < Runs; Run++) {
+    const auto Start = std::chrono::steady_clock::now();
+    Fn();
+    const double Seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - Start)
+                               .count();
+    if (Run == 0 || Seconds < Best)
+      Best = Seconds;
+  }
+  return Best;
+}
+
+// A file of `NumEdits` calls with a literal argument, each getting a comment
+// as TypeCorrect would add, applied both ways
+static bool benchApplyEdits(unsigned NumEdits, unsigned Runs,
+                            llvm::raw_ostream &OS) {
+  static constexpr llvm::StringLiteral Call = "  f(42);\n";
+  static constexpr size_t ArgOffset = 4;
+  std::string Buffer;
+  Buffer.reserve(Call.size() * NumEdits);
+  std::vector<TypeCorrectInsertion> Insertions;
+  Insertions.reserve(NumEdits);
+  for (unsigned Idx = 0; Idx < NumEdits; Idx++) {
+    Insertions.push_back({Buffer.size() + ArgOffset, "/*n=*/"});
+    Buffer += Call;
+  }
+
+  clang::SourceManagerForFile SMForFile("bench.c", Buffer);
+  clang::SourceManager &SM = SMForFile.get();
+  const clang::SourceLocation Start =
+      SM.getLocForStartOfFile(SM.getMainFileID());
+  std::string ViaRewriter;
+  const double RewriterSeconds = bestOf(Runs, [&] {
+    clang::Rewriter R(SM, clang::LangOptions());
+    for (const TypeCorrectInsertion &Insertion : Insertions)
+      R.InsertText(Start.getLocWithOffset(Insertion.Offset), Insertion.Text);
+    ViaRewriter.clear();
+    llvm::raw_string_ostream Out(ViaRewriter);
+    R.getEditBuffer(SM.getMainFileID()).write(Out);
+  });
+
+  std::string Linear;
+  const double LinearSeconds = bestOf(Runs, [&] {
+    std::vector<TypeCorrectInsertion> Copy = Insertions;
+    Linear = applyInsertions(Buffer, Copy);
+  });
+
+  OS << llvm::format("  %10u %12.6f %12.6f %8.1fx\n", NumEdits,
+                     RewriterSeconds, LinearSeconds,
+                     LinearSeconds > 0 ? RewriterSeconds / LinearSeconds : 0.);
+  if (ViaRewriter != Linear) {
+    llvm::errs() << "bench_type_correct: outputs differ for " << NumEdits
+                 << " edits\n";
+    return false;
+  }
+  return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+int main(int argc, const char **argv) {
+  llvm::Expected<clang::tooling::CommonOptionsParser> eOptParser =
+      clang::tooling::CommonOptionsParser::create(argc, argv, BenchCategory,
+                                                  llvm::cl::ZeroOrMore);
+  if (auto E = eOptParser.takeError()) {
+    llvm::errs() << "Problem constructing CommonOptionsParser "
+                 << toString(std::move(E)) << '\n';
+    return EXIT_FAILURE;
+  }
+  const unsigned Runs = std::max(1u, static_cast<unsigned>(Iterations));
+
+  if (!ApplyEdits.empty()) {
+    llvm::outs() << llvm::format("  %10s %12s %12s %9s\n", "edits",
+                                 "rewriter", "linear", "speedup");
+    int Status = EXIT_SUCCESS;
+    for (unsigned NumEdits : ApplyEdits)
+      if (!benchApplyEdits(NumEdits, Runs, llvm::outs()))
+        Status = EXIT_FAILURE;
+    return Status;
+  }
+
+  std::unique_ptr<TypeCorrectPerfCounters> Counters;
+  if (Perf) {
+    Counters = std::make_unique<TypeCorrectPerfCounters>();
+    if (!Counters->isAvailable()) {
+      llvm::errs() << "bench_type_correct: " << Counters->getError()
+                   << "; reporting wall time only\n";
+      Counters.reset();
+    }
+  }
+
+  int Status = EXIT_SUCCESS;
+  for (const std::string &File : eOptParser->getSourcePathList()) {
+    PhaseProfile Profile(Counters.get());
+    for (unsigned Run = 0; Run < Runs; Run++) {
+      clang::tooling::ClangTool Tool(eOptParser->getCompilations(), {File});
+      TypeCorrectActionFactory Factory(
+          llvm::nulls(), [&](TypeCorrectPhase Phase) { Profile.enter(Phase); });
+      if (Tool.run(&Factory) != EXIT_SUCCESS)
+        Status = EXIT_FAILURE;
+      Profile.close();
+    }
+    llvm::outs() << File << " (mean of " << Runs << " runs)\n";
+    Profile.print(llvm::outs(), Runs);
+  }
+  return Status;
+}
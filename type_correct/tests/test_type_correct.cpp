@@ -1,9 +1,45 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <map>
+#include <thread>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Tooling/JSONCompilationDatabase.h>
 #include <clang/Tooling/Tooling.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
 
 #include <gtest/gtest.h>
 
+#include <type_correct/TypeCorrectASTFile.h>
+#include <type_correct/TypeCorrectApply.h>
+#include <type_correct/TypeCorrectComments.h>
+#include <type_correct/TypeCorrectCompilationCache.h>
+#include <type_correct/TypeCorrectDriver.h>
+#include <type_correct/TypeCorrectEditable.h>
+#include <type_correct/TypeCorrectFileCache.h>
+#include <type_correct/TypeCorrectFileWriter.h>
+#include <type_correct/TypeCorrectHistory.h>
+#include <type_correct/TypeCorrectJournal.h>
 #include <type_correct/TypeCorrectMain.h>
+#include <type_correct/TypeCorrectMetrics.h>
+#include <type_correct/TypeCorrectModules.h>
+#include <type_correct/TypeCorrectPipeline.h>
+#include <type_correct/TypeCorrectProgress.h>
+#include <type_correct/TypeCorrectReproducer.h>
+#include <type_correct/TypeCorrectSample.h>
+#include <type_correct/TypeCorrectSummary.h>
+#include <type_correct/TypeCorrectTool.h>
+#include <type_correct/TypeCorrectWorkerPool.h>
 
 GTEST_TEST(runToolOnCode, StringFunctionReturnType) {
   /* Test that var type being assigned to function call is rewritten to match
@@ -61,6 +97,1190 @@ GTEST_TEST(runToolOnCode, FunctionReturnAndAssignementType) {
                << (output.ends_with(want) ? "true" : "false");
 }
 
+GTEST_TEST(runToolOnCode, StreamedMatchingMatchesWholeTU) {
+  /* Test that matching declarations as they are parsed, with templates
+   * (generic lambdas included) deferred to the end of the TU, finds the
+   * same edits */
+  const std::string from =
+      "void f(int a, const char *s);\n"
+      "template <class T> void t(T) { f(1, \"t\"); }\n"
+      "struct S { void m() { f(2, \"m\"); } };\n"
+      "namespace n { void g() { f(3, \"g\"); } }\n"
+      "int v = (t(0), f(4, \"v\"), 0);\n"
+      "void h() { auto l = [](auto x) { f(x, \"l\"); }; l(5); }\n";
+
+  const auto Run = [&](bool StreamDecls) {
+    std::string Output;
+    llvm::raw_string_ostream OS(Output);
+    EXPECT_TRUE(clang::tooling::runToolOnCode(
+        std::make_unique<TypeCorrectPluginAction>(OS, nullptr, nullptr,
+                                                  nullptr, StreamDecls),
+        from));
+    return OS.str();
+  };
+  const std::string Whole = Run(false);
+  for (const char *Edit : {"f(/*a=*/1, /*s=*/\"t\")", "f(/*a=*/2,",
+                           "f(/*a=*/3,", "f(/*a=*/4,"})
+    EXPECT_NE(Whole.find(Edit), std::string::npos) << Edit;
+  EXPECT_EQ(Run(true), Whole);
+}
+
+GTEST_TEST(runToolOnCode, AnnotatedArgumentsAreSkipped) {
+  /* Test that arguments which already have an argument comment get no
+   * second one, so that a second run over the output changes nothing */
+  EXPECT_TRUE(isArgumentComment("/*b=*/"));
+  EXPECT_TRUE(isArgumentComment("/* b = */"));
+  EXPECT_FALSE(isArgumentComment("/* b */"));
+  EXPECT_FALSE(isArgumentComment("// b=*/"));
+
+  const auto Run = [](const std::string &Code) {
+    std::string Output;
+    llvm::raw_string_ostream OS(Output);
+    EXPECT_TRUE(clang::tooling::runToolOnCode(
+        std::make_unique<TypeCorrectPluginAction>(OS), Code));
+    return OS.str();
+  };
+  const std::string Once =
+      Run("void f(int a, int b);\n"
+          "void g(void) { f(/*a=*/1, 2); f(/* a */ 3, /* b = */\n 4); }\n");
+  EXPECT_EQ(Once, "void f(int a, int b);\n"
+                  "void g(void) { f(/*a=*/1, /*b=*/2); "
+                  "f(/* a */ /*a=*/3, /* b = */\n 4); }\n");
+  EXPECT_EQ(Run(Once), Once);
+}
+
+GTEST_TEST(runToolOnCode, ReadOnlyFilesAreNotEdited) {
+  /* Test that editable roots and include/exclude globs decide which files
+   * are edited */
+  llvm::Expected<TypeCorrectPathFilter> Filter = TypeCorrectPathFilter::create(
+      {"/src/proj/"}, {}, {"*/generated/*", "*.inc"});
+  ASSERT_TRUE(static_cast<bool>(Filter));
+  EXPECT_TRUE(Filter->isEditable("/src/proj/a.c"));
+  EXPECT_TRUE(Filter->isEditable("/src/proj/sub/../b.c"));
+  EXPECT_FALSE(Filter->isEditable("/src/project/a.c"));
+  EXPECT_FALSE(Filter->isEditable("/src/proj/generated/a.c"));
+  EXPECT_FALSE(Filter->isEditable("/src/proj/x.inc"));
+  llvm::Expected<TypeCorrectPathFilter> Bad =
+      TypeCorrectPathFilter::create({}, {"[z-a]"}, {});
+  EXPECT_FALSE(static_cast<bool>(Bad));
+  llvm::consumeError(Bad.takeError());
+
+  const auto Run = [](llvm::ArrayRef<std::string> Excludes) {
+    llvm::Expected<TypeCorrectPathFilter> Excluding =
+        TypeCorrectPathFilter::create({}, {}, Excludes);
+    EXPECT_TRUE(static_cast<bool>(Excluding));
+    std::string Output;
+    llvm::raw_string_ostream OS(Output);
+    EXPECT_TRUE(clang::tooling::runToolOnCode(
+        std::make_unique<TypeCorrectPluginAction>(OS, nullptr, nullptr,
+                                                  &*Excluding),
+        "void f(int a);\nvoid g(void) { f(1); }\n"));
+    return OS.str();
+  };
+  EXPECT_EQ(Run({"*/elsewhere/*"}),
+            "void f(int a);\nvoid g(void) { f(/*a=*/1); }\n");
+  EXPECT_EQ(Run({"*input.cc"}), "void f(int a);\nvoid g(void) { f(1); }\n");
+}
+
+GTEST_TEST(Apply, LinearPassMatchesInsertionOrder) {
+  /* Test that insertions are applied by offset, including at both ends,
+   * with those at the same offset kept in the order given */
+  std::vector<TypeCorrectInsertion> Insertions = {
+      {8, "/*b=*/"}, {0, "/**/"}, {2, "/*a=*/"}, {8, "/*c=*/"}, {11, "//"}};
+  EXPECT_EQ(applyInsertions("f(1, g(2));", Insertions),
+            "/**/f(/*a=*/1, g(2/*b=*//*c=*/));//");
+  EXPECT_EQ(applyInsertions("unchanged", {}), "unchanged");
+}
+
+GTEST_TEST(Apply, StreamedOutputMatchesLinearPass) {
+  /* Test that streaming the pieces, to a string or with writev to stdout
+   * (more of them than fit in one writev), gives the same bytes */
+  std::string Buffer;
+  std::vector<TypeCorrectInsertion> Insertions;
+  for (int Call = 0; Call < 5000; Call++) {
+    Insertions.push_back({Buffer.size() + 2, "/*n=*/"});
+    Buffer += "f(" + std::to_string(Call) + ");\n";
+  }
+  const std::string Want = applyInsertions(Buffer, Insertions);
+
+  std::string Streamed;
+  llvm::raw_string_ostream OS(Streamed);
+  writeInsertions(OS, Buffer, Insertions);
+  EXPECT_EQ(OS.str(), Want);
+
+  llvm::SmallString<128> Path;
+  int FD;
+  ASSERT_FALSE(
+      llvm::sys::fs::createTemporaryFile("type_correct", "c", FD, Path));
+  llvm::outs().flush();
+  const int SavedStdout = ::dup(STDOUT_FILENO);
+  ::dup2(FD, STDOUT_FILENO);
+  // Still buffered when the pieces are written
+  llvm::outs() << "/* before */";
+  writeInsertions(llvm::outs(), Buffer, Insertions);
+  llvm::outs() << "/* after */";
+  llvm::outs().flush();
+  ::dup2(SavedStdout, STDOUT_FILENO);
+  ::close(SavedStdout);
+  ::close(FD);
+
+  auto Written = llvm::MemoryBuffer::getFile(Path);
+  ASSERT_TRUE(static_cast<bool>(Written));
+  EXPECT_EQ((*Written)->getBuffer(), "/* before */" + Want + "/* after */");
+  llvm::sys::fs::remove(Path);
+}
+
+GTEST_TEST(FileWriter, BackendsSaveInPlace) {
+  /* Test that either backend replaces every file, keeping its permissions
+   * and leaving no temporary files behind, and reports the files it can't
+   * save without touching the others */
+  for (const TypeCorrectFileWriter::Backend Backend :
+       {TypeCorrectFileWriter::Backend::IOUring,
+        TypeCorrectFileWriter::Backend::ThreadPool}) {
+    llvm::SmallString<128> Dir;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("tc-writer", Dir));
+    const auto PathOf = [&](int Idx) {
+      return (Dir + "/f" + std::to_string(Idx) + ".c").str();
+    };
+    for (int Idx = 0; Idx < 40; Idx++) {
+      std::error_code EC;
+      llvm::raw_fd_ostream OS(PathOf(Idx), EC);
+      ASSERT_FALSE(EC);
+      OS << "old";
+    }
+    ASSERT_FALSE(llvm::sys::fs::setPermissions(
+        PathOf(0), llvm::sys::fs::owner_read | llvm::sys::fs::owner_write));
+
+    TypeCorrectFileWriter Writer(Backend, /*BatchSize=*/16);
+    for (int Idx = 0; Idx < 40; Idx++)
+      Writer.add(PathOf(Idx), std::string(Idx * 1000, 'x'));
+    Writer.add((Dir + "/missing/f.c").str(), "new");
+    const std::vector<std::pair<std::string, std::error_code>> Failures =
+        Writer.flush();
+    ASSERT_EQ(Failures.size(), 1u)
+        << TypeCorrectFileWriter::getBackendName(Writer.getBackend()).str();
+    EXPECT_EQ(Failures[0].first, (Dir + "/missing/f.c").str());
+
+    for (int Idx = 0; Idx < 40; Idx++) {
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+          llvm::MemoryBuffer::getFile(PathOf(Idx));
+      ASSERT_TRUE(Buffer);
+      EXPECT_EQ((*Buffer)->getBuffer(), std::string(Idx * 1000, 'x'));
+    }
+    llvm::ErrorOr<llvm::sys::fs::perms> Perms =
+        llvm::sys::fs::getPermissions(PathOf(0));
+    ASSERT_TRUE(Perms);
+    EXPECT_EQ(*Perms, llvm::sys::fs::owner_read | llvm::sys::fs::owner_write);
+
+    std::error_code EC;
+    int NumFiles = 0;
+    for (llvm::sys::fs::directory_iterator It(Dir, EC), End; It != End && !EC;
+         It.increment(EC))
+      NumFiles++;
+    EXPECT_EQ(NumFiles, 40);
+    llvm::sys::fs::remove_directories(Dir);
+  }
+}
+
+GTEST_TEST(FileWriter, SymlinksFollowed) {
+  /* Test that saving through a symlink replaces the file it points at and
+   * leaves the link in place */
+  for (const TypeCorrectFileWriter::Backend Backend :
+       {TypeCorrectFileWriter::Backend::IOUring,
+        TypeCorrectFileWriter::Backend::ThreadPool}) {
+    llvm::SmallString<128> Dir;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("tc-writer", Dir));
+    const std::string Real = (Dir + "/real.c").str();
+    const std::string Link = (Dir + "/link.c").str();
+    {
+      std::error_code EC;
+      llvm::raw_fd_ostream OS(Real, EC);
+      ASSERT_FALSE(EC);
+      OS << "old";
+    }
+    ASSERT_FALSE(llvm::sys::fs::create_link("real.c", Link));
+
+    TypeCorrectFileWriter Writer(Backend);
+    Writer.add(Link, "new");
+    EXPECT_TRUE(Writer.flush().empty());
+
+    llvm::sys::fs::file_status Status;
+    ASSERT_FALSE(llvm::sys::fs::status(Link, Status, /*Follow=*/false));
+    EXPECT_EQ(Status.type(), llvm::sys::fs::file_type::symlink_file);
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        llvm::MemoryBuffer::getFile(Real);
+    ASSERT_TRUE(Buffer);
+    EXPECT_EQ((*Buffer)->getBuffer(), "new");
+    llvm::sys::fs::remove_directories(Dir);
+  }
+}
+
+GTEST_TEST(Pipeline, ChunksWrittenInOrder) {
+  /* Test that chunks come out whole and in order, also when the queue is
+   * full and when a single chunk is larger than the bound */
+  std::string Output, Expected;
+  {
+    llvm::raw_string_ostream OS(Output);
+    TypeCorrectOutputPipeline Pipeline(OS, /*MaxQueuedBytes=*/16);
+    for (int Idx = 0; Idx < 1000; Idx++) {
+      const std::string Text = "tu" + std::to_string(Idx) + ";";
+      Pipeline << Text;
+      Expected += Text;
+      if (Idx % 3 == 0)
+        Pipeline.endChunk();
+    }
+    const std::string Large(100, 'x');
+    Pipeline << Large;
+    Expected += Large;
+    Pipeline.finish();
+  }
+  EXPECT_EQ(Output, Expected);
+}
+
+GTEST_TEST(Pipeline, SourceChunksOutliveSource) {
+  /* Test that a TU written over its source buffer comes out as it was
+   * written, after everything else has let go of the buffer, and that
+   * writes which don't continue the buffer are kept as text */
+  std::string Output, Expected;
+  {
+    llvm::raw_string_ostream OS(Output);
+    TypeCorrectOutputPipeline Pipeline(OS);
+    for (int Idx = 0; Idx < 100; Idx++) {
+      std::shared_ptr<const llvm::MemoryBuffer> Source =
+          llvm::MemoryBuffer::getMemBufferCopy(
+              "int f" + std::to_string(Idx) + "(int);\nint x;\n");
+      const llvm::StringRef Buffer = Source->getBuffer();
+      Pipeline.setSource(std::move(Source));
+      TypeCorrectInsertion Insertions[] = {{0, "/* a */"},
+                                           {4, "const "},
+                                           {4, "volatile "},
+                                           {Buffer.size(), ";"}};
+      Expected += applyInsertions(Buffer, Insertions);
+      writeInsertions(Pipeline, Buffer, Insertions);
+      // Again: not where the buffer has got to
+      Pipeline << Buffer.take_front(3);
+      Expected += Buffer.take_front(3).str();
+      Pipeline.endChunk();
+    }
+  }
+  EXPECT_EQ(Output, Expected);
+}
+
+GTEST_TEST(Progress, ETAScalesRecordedCosts) {
+  /* Test that the ETA is the recorded cost of the files left, scaled by how
+   * the files done compared to theirs, that the slowest file in flight is
+   * the one started first, and how both are reported */
+  TypeCorrectProgress Progress({"/p/a.c", "/p/b.c", "/p/c.c", "/p/d.c"},
+                               {1, 1, 2, 4}, /*Parallelism=*/2,
+                               /*StatusLine=*/nullptr, /*JSONPath=*/"");
+  TypeCorrectProgress::Snapshot S = Progress.getSnapshot();
+  EXPECT_EQ(S.Total, 4u);
+  EXPECT_DOUBLE_EQ(S.ETASeconds, 4);
+
+  Progress.started("/p/a.c");
+  Progress.started("/p/./b.c");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  Progress.started("/p/c.c");
+  Progress.finished("/p/a.c", /*Succeeded=*/false);
+  Progress.passOver("/p/d.c");
+  S = Progress.getSnapshot();
+  EXPECT_EQ(S.Total, 3u);
+  EXPECT_EQ(S.Done, 1u);
+  EXPECT_EQ(S.Failed, 1u);
+  EXPECT_EQ(S.InFlight, 2u);
+  EXPECT_EQ(S.Slowest, "/p/b.c");
+  EXPECT_NEAR(S.ETASeconds, 3 * S.ElapsedSeconds, 1e-9);
+
+  S.Slowest = "/p/b.c";
+  S.SlowestSeconds = 95;
+  S.FilesPerSecond = 3.14;
+  S.BytesPerSecond = 3 << 20;
+  S.ETASeconds = 3725;
+  std::string Line;
+  llvm::raw_string_ostream LineOS(Line);
+  TypeCorrectProgress::printStatusLine(S, LineOS);
+  EXPECT_EQ(LineOS.str(), "[1/3] 1 failed, 3.1 files/s, 3.0 MiB/s, "
+                          "slowest: b.c 1m35s, ETA 1h02m");
+
+  std::string JSON;
+  llvm::raw_string_ostream JSONOS(JSON);
+  TypeCorrectProgress::writeJSON(S, JSONOS);
+  llvm::Expected<llvm::json::Value> Value = llvm::json::parse(JSONOS.str());
+  ASSERT_TRUE(bool(Value));
+  const llvm::json::Object *Obj = Value->getAsObject();
+  ASSERT_TRUE(Obj);
+  EXPECT_EQ(Obj->getInteger("in_flight"), llvm::Optional<int64_t>(2));
+  EXPECT_EQ(Obj->getNumber("eta_seconds"), llvm::Optional<double>(3725));
+  ASSERT_TRUE(Obj->getObject("slowest"));
+  EXPECT_EQ(Obj->getObject("slowest")->getString("file"),
+            llvm::StringRef("/p/b.c"));
+  EXPECT_EQ(Obj->getBoolean("finished"), llvm::Optional<bool>(false));
+}
+
+GTEST_TEST(Progress, PrintedLinesGoAboveStatusLine) {
+  /* Test that lines printed while the status line is up clear it and draw
+   * it again below them */
+  std::string Out;
+  llvm::raw_string_ostream OS(Out);
+  {
+    TypeCorrectProgress Progress({"/p/a.c"}, {1}, /*Parallelism=*/1, &OS,
+                                 /*JSONPath=*/"", /*IntervalSeconds=*/0.01);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    Progress.print("type_correct: message\n");
+    Progress.finish();
+  }
+  const llvm::StringRef Lines = OS.str();
+  const size_t Message = Lines.find("\r\x1b[Ktype_correct: message\n[0/1]");
+  ASSERT_NE(Message, llvm::StringRef::npos) << Lines.str();
+  EXPECT_LT(Lines.find("[0/1]"), Message);
+  EXPECT_TRUE(Lines.endswith("\n"));
+  EXPECT_NE(Lines.rfind("took"), llvm::StringRef::npos);
+}
+
+GTEST_TEST(Metrics, SharedWithForkedProcesses) {
+  /* Test that what a forked worker records shows up in the parent's
+   * metrics, and in the Prometheus output */
+  TypeCorrectMetrics Metrics;
+  Metrics.add(TypeCorrectMetrics::Counter::TUsSucceeded);
+  const pid_t Pid = fork();
+  ASSERT_GE(Pid, 0);
+  if (Pid == 0) {
+    Metrics.add(TypeCorrectMetrics::Counter::TUsSucceeded, 2);
+    Metrics.add(TypeCorrectMetrics::Counter::FileCacheHits, 5);
+    Metrics.observe(TypeCorrectMetrics::Histogram::ParseSeconds, 0.3);
+    Metrics.addEdit("literal-argument-comment");
+    Metrics.addEdit("literal-argument-comment");
+    _exit(0);
+  }
+  int WaitStatus = 0;
+  ASSERT_EQ(waitpid(Pid, &WaitStatus, 0), Pid);
+  Metrics.addEdit("literal-argument-comment");
+  Metrics.observe(TypeCorrectMetrics::Histogram::ParseSeconds, 20);
+
+  EXPECT_EQ(Metrics.get(TypeCorrectMetrics::Counter::TUsSucceeded), 3u);
+  EXPECT_EQ(Metrics.get(TypeCorrectMetrics::Counter::FileCacheHits), 5u);
+  EXPECT_EQ(Metrics.getEdits("literal-argument-comment"), 3u);
+  EXPECT_EQ(Metrics.getEdits("other-rule"), 0u);
+
+  std::string Text;
+  llvm::raw_string_ostream OS(Text);
+  Metrics.print(OS);
+  const auto Has = [&](llvm::StringRef Line) {
+    return llvm::StringRef(OS.str()).contains((Line + "\n").str());
+  };
+  EXPECT_TRUE(Has("type_correct_tus_total{status=\"succeeded\"} 3"));
+  EXPECT_TRUE(Has(
+      "type_correct_edits_total{rule=\"literal-argument-comment\"} 3"));
+  EXPECT_TRUE(Has("type_correct_tu_parse_seconds_bucket{le=\"0.5\"} 1"));
+  EXPECT_TRUE(Has("type_correct_tu_parse_seconds_bucket{le=\"+Inf\"} 2"));
+  EXPECT_TRUE(Has("type_correct_tu_parse_seconds_count 2"));
+}
+
+GTEST_TEST(ASTFile, RecognisesSerializedAST) {
+  /* Test that `-emit-ast` artifacts are told apart from source files */
+  EXPECT_TRUE(isSerializedASTFile("foo/bar.ast"));
+  EXPECT_TRUE(isSerializedASTFile("BAR.AST"));
+  EXPECT_FALSE(isSerializedASTFile("foo/bar.c"));
+  EXPECT_FALSE(isSerializedASTFile("foo.ast/bar.cpp"));
+}
+
+GTEST_TEST(ASTFile, MissingASTFails) {
+  /* Test that an unloadable AST is reported rather than crashing */
+  std::string Errors;
+  llvm::raw_string_ostream ErrStream(Errors);
+  EXPECT_FALSE(
+      typeCorrectASTFile("does/not/exist.ast", llvm::nulls(), ErrStream));
+  EXPECT_NE(ErrStream.str().find("does/not/exist.ast"), std::string::npos);
+}
+
+GTEST_TEST(ModuleCache, NonModuleCommandUnchanged) {
+  /* Test that commands without -fmodules are passed through untouched */
+  const clang::tooling::CommandLineArguments Args{"clang", "-c", "a.c"};
+  EXPECT_EQ(getModuleCacheAdjuster("/cache", {})(Args, "a.c"), Args);
+}
+
+GTEST_TEST(ModuleCache, BuildCacheBecomesPrebuilt) {
+  /* Test that the build's module cache is reused as prebuilt PCMs and the
+   * persistent cache takes its place */
+  const clang::tooling::CommandLineArguments Args{
+      "clang", "-fmodules", "-fmodules-cache-path=/build/mc", "-c", "a.c",
+      "--", "extra"};
+  const clang::tooling::CommandLineArguments Adjusted =
+      getModuleCacheAdjuster("/cache", {"/build/pcm"})(Args, "a.c");
+  const auto Has = [&](llvm::StringRef Flag) {
+    return llvm::is_contained(Adjusted, Flag.str());
+  };
+  EXPECT_TRUE(Has("-fmodules-cache-path=/cache"));
+  EXPECT_FALSE(Has("-fmodules-cache-path=/build/mc"));
+  EXPECT_TRUE(Has("-fprebuilt-module-path=/build/mc"));
+  EXPECT_TRUE(Has("-fprebuilt-module-path=/build/pcm"));
+  EXPECT_TRUE(Has("-fprebuilt-implicit-modules"));
+  EXPECT_TRUE(Has("-fvalidate-ast-input-files-content"));
+  EXPECT_EQ(Adjusted[Adjusted.size() - 2], "--");
+}
+
+GTEST_TEST(CompilationCache, LookupMatchesDatabase) {
+  /* Test that the binary index finds each file's commands, relative names
+   * resolved against their directory, and is rejected once stale */
+  std::vector<clang::tooling::CompileCommand> Commands;
+  for (int Idx = 0; Idx < 100; Idx++)
+    Commands.emplace_back("/build", "src/f" + std::to_string(Idx) + ".c",
+                          std::vector<std::string>{"cc", "-Iinc", "-c"},
+                          "f.o");
+  Commands.emplace_back("/build", "/abs/x.c",
+                        std::vector<std::string>{"cc", "-DX"}, "");
+  Commands.emplace_back("/build", "/abs/x.c",
+                        std::vector<std::string>{"cc", "-DY"}, "");
+  llvm::Optional<std::string> Image =
+      TypeCorrectCompilationCache::serialize(Commands, /*JSONHash=*/42);
+  ASSERT_TRUE(Image.hasValue());
+  EXPECT_EQ(TypeCorrectCompilationCache::create(
+                llvm::MemoryBuffer::getMemBufferCopy(*Image), 43),
+            nullptr);
+  EXPECT_EQ(TypeCorrectCompilationCache::create(
+                llvm::MemoryBuffer::getMemBufferCopy(
+                    llvm::StringRef(*Image).drop_back()),
+                42),
+            nullptr);
+
+  std::unique_ptr<TypeCorrectCompilationCache> Cache =
+      TypeCorrectCompilationCache::create(
+          llvm::MemoryBuffer::getMemBufferCopy(*Image), 42);
+  ASSERT_NE(Cache, nullptr);
+  EXPECT_EQ(Cache->getAllFiles().size(), 101u);
+  EXPECT_EQ(Cache->getAllCompileCommands().size(), 102u);
+  const std::vector<clang::tooling::CompileCommand> F7 =
+      Cache->getCompileCommands("/build/src/f7.c");
+  ASSERT_EQ(F7.size(), 1u);
+  EXPECT_EQ(F7[0].Filename, "src/f7.c");
+  EXPECT_EQ(F7[0].Output, "f.o");
+  EXPECT_EQ(F7[0].CommandLine,
+            std::vector<std::string>({"cc", "-Iinc", "-c"}));
+  EXPECT_EQ(Cache->getCompileCommands("/build/src/../src/f9.c").size(), 1u);
+  EXPECT_EQ(Cache->getCompileCommands("/abs/x.c").size(), 2u);
+  EXPECT_TRUE(Cache->getCompileCommands("/build/src/missing.c").empty());
+}
+
+GTEST_TEST(CompilationCache, LookupThroughSymlinks) {
+  /* Test that a file is found through a symlinked directory whichever of
+   * the two paths the database was written with */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("type_correct", Dir));
+  llvm::sys::fs::real_path(Dir, Dir);
+  llvm::SmallString<128> Real(Dir), Link(Dir), RealFile, LinkFile;
+  llvm::sys::path::append(Real, "real");
+  llvm::sys::path::append(Link, "link");
+  ASSERT_FALSE(llvm::sys::fs::create_directory(Real));
+  ASSERT_FALSE(llvm::sys::fs::create_link(Real, Link));
+  llvm::sys::path::append(RealFile = Real, "a.c");
+  llvm::sys::path::append(LinkFile = Link, "a.c");
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(RealFile, EC);
+  }
+
+  const std::string Paths[] = {std::string(RealFile), std::string(LinkFile)};
+  for (const std::string &Written : Paths) {
+    std::vector<clang::tooling::CompileCommand> Commands;
+    Commands.emplace_back(Dir.str(), Written,
+                          std::vector<std::string>{"cc", "-c"}, "");
+    llvm::Optional<std::string> Image =
+        TypeCorrectCompilationCache::serialize(Commands, /*JSONHash=*/1);
+    ASSERT_TRUE(Image.hasValue());
+    std::unique_ptr<TypeCorrectCompilationCache> Cache =
+        TypeCorrectCompilationCache::create(
+            llvm::MemoryBuffer::getMemBufferCopy(*Image), 1);
+    ASSERT_NE(Cache, nullptr);
+    EXPECT_EQ(Cache->getAllFiles(), std::vector<std::string>{Written});
+    EXPECT_EQ(Cache->getCompileCommands(RealFile).size(), 1u) << Written;
+    EXPECT_EQ(Cache->getCompileCommands(LinkFile).size(), 1u) << Written;
+  }
+
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+GTEST_TEST(InvocationCache, HitMatchesDriverRun) {
+  /* Test that a command differing from an earlier one only in its input is
+   * answered without the driver, with the cc1 arguments the driver gives */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> FS(
+      new llvm::vfs::InMemoryFileSystem);
+  for (const char *File : {"/src/a.cpp", "/src/b.cpp"})
+    FS->addFile(File, 0, llvm::MemoryBuffer::getMemBuffer("int x;"));
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> Diags =
+      clang::CompilerInstance::createDiagnostics(
+          new clang::DiagnosticOptions());
+  const auto Command = [](llvm::StringRef Input) {
+    return std::vector<std::string>{"clang++", "-fsyntax-only", "-DX",
+                                    Input.str()};
+  };
+
+  TypeCorrectInvocationCache Cache;
+  ASSERT_TRUE(Cache
+                  .getCC1Args("/src", Command("/src/a.cpp"), "/src/a.cpp",
+                              *Diags, FS)
+                  .hasValue());
+  const llvm::Optional<std::vector<std::string>> B = Cache.getCC1Args(
+      "/src", Command("/src/b.cpp"), "/src/b.cpp", *Diags, FS);
+  ASSERT_TRUE(B.hasValue());
+  EXPECT_EQ(Cache.getNumMisses(), 1u);
+  EXPECT_EQ(Cache.getNumHits(), 1u);
+
+  TypeCorrectInvocationCache Fresh;
+  EXPECT_EQ(Fresh.getCC1Args("/src", Command("/src/b.cpp"), "/src/b.cpp",
+                             *Diags, FS),
+            B);
+  EXPECT_EQ(Fresh.getNumMisses(), 1u);
+}
+
+GTEST_TEST(Tool, RelativeSourcesResolvedAgainstStartDir) {
+  /* Test that relative sources are all resolved against the working
+   * directory the run started in, not the previous command's directory,
+   * which is restored afterwards */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> FS(
+      new llvm::vfs::InMemoryFileSystem);
+  for (const char *File : {"/p/a/x.c", "/p/b/y.c"})
+    FS->addFile(File, 0, llvm::MemoryBuffer::getMemBuffer("int x;"));
+  ASSERT_FALSE(FS->setCurrentWorkingDirectory("/p"));
+  std::string Error;
+  const std::unique_ptr<clang::tooling::JSONCompilationDatabase>
+      Compilations = clang::tooling::JSONCompilationDatabase::loadFromBuffer(
+          R"([{"directory": "/p/a", "file": "x.c", "command": "cc -c x.c"},
+              {"directory": "/p/b", "file": "y.c", "command": "cc -c y.c"}])",
+          Error, clang::tooling::JSONCommandLineSyntax::AutoDetect);
+  ASSERT_TRUE(Compilations) << Error;
+
+  TypeCorrectInvocationCache Cache;
+  TypeCorrectTool Tool(*Compilations, {"a/x.c", "b/y.c"}, Cache, FS);
+  TypeCorrectActionFactory Factory(llvm::nulls());
+  EXPECT_EQ(Tool.run(&Factory), EXIT_SUCCESS);
+  EXPECT_EQ(FS->getCurrentWorkingDirectory().get(), "/p");
+}
+
+GTEST_TEST(FileCache, SharedAcrossFileSystems) {
+  /* Test that stat results, failures included, and contents are fetched
+   * once for every filesystem sharing the cache */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> Disk(
+      new llvm::vfs::InMemoryFileSystem);
+  Disk->addFile("/inc/a.h", 0, llvm::MemoryBuffer::getMemBuffer("int a;"));
+  TypeCorrectFileCache Cache;
+  TypeCorrectCachingFileSystem TU1(Cache, Disk), TU2(Cache, Disk);
+  ASSERT_FALSE(TU1.setCurrentWorkingDirectory("/inc"));
+
+  llvm::ErrorOr<llvm::vfs::Status> Stat = TU1.status("./a.h");
+  ASSERT_TRUE(Stat);
+  EXPECT_EQ(Stat->getName(), "./a.h");
+  EXPECT_FALSE(TU1.status("/inc/b.h"));
+  EXPECT_EQ(Cache.getNumMisses(), 2u);
+
+  // Appearing mid-run doesn't count
+  Disk->addFile("/inc/b.h", 0, llvm::MemoryBuffer::getMemBuffer("int b;"));
+  EXPECT_FALSE(TU2.status("/inc/b.h"));
+  for (llvm::vfs::FileSystem *FS : {&TU1, &TU2}) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        FS->getBufferForFile("/inc/a.h");
+    ASSERT_TRUE(Buffer);
+    EXPECT_EQ((*Buffer)->getBuffer(), "int a;");
+  }
+  // One more miss: reading a.h the first time
+  EXPECT_EQ(Cache.getNumMisses(), 3u);
+}
+
+GTEST_TEST(FileCache, DroppedContentsOutliveEntry) {
+  /* Test that dropped contents stay valid in the buffers handed out, and
+   * are read again by the next TU that asks */
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> Disk(
+      new llvm::vfs::InMemoryFileSystem);
+  Disk->addFile("/src/a.c", 0, llvm::MemoryBuffer::getMemBuffer("int a;"));
+  TypeCorrectFileCache Cache;
+  TypeCorrectCachingFileSystem FS(Cache, Disk);
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Held =
+      FS.getBufferForFile("/src/a.c");
+  ASSERT_TRUE(Held);
+  EXPECT_EQ(Cache.getNumMisses(), 2u);
+  Cache.dropContents("/src/./a.c");
+  EXPECT_EQ((*Held)->getBuffer(), "int a;");
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Again =
+      FS.getBufferForFile("/src/a.c");
+  ASSERT_TRUE(Again);
+  EXPECT_EQ((*Again)->getBuffer(), "int a;");
+  EXPECT_EQ(Cache.getNumMisses(), 3u);
+}
+
+GTEST_TEST(Journal, ResumeSkipsOnlyUnchangedFiles) {
+  /* Test that a reopened journal hands back the output of a file until its
+   * compile commands or one of the files it read change, and survives an
+   * entry cut off by a killed run */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("tc-journal", Dir));
+  const std::string Source = (Dir + "/a.c").str(),
+                    Header = (Dir + "/a.h").str(),
+                    Path = (Dir + "/journal.log").str();
+  const auto WriteFile = [](llvm::StringRef File, llvm::StringRef Text) {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(File, EC);
+    OS << Text;
+  };
+  WriteFile(Source, "#include \"a.h\"\nint a;\n");
+  WriteFile(Header, "int h;\n");
+
+  std::string Error;
+  {
+    std::unique_ptr<TypeCorrectJournal> Journal =
+        TypeCorrectJournal::open(Path, /*Config=*/1, /*Resume=*/true, Error);
+    ASSERT_TRUE(Journal) << Error;
+    EXPECT_EQ(Journal->getNumEntries(), 0u);
+    llvm::IntrusiveRefCntPtr<TypeCorrectRecordingFileSystem> Reads(
+        new TypeCorrectRecordingFileSystem(llvm::vfs::getRealFileSystem()));
+    ASSERT_FALSE(Reads->setCurrentWorkingDirectory(Dir));
+    ASSERT_TRUE(Reads->getBufferForFile("a.c"));
+    ASSERT_TRUE(Reads->getBufferForFile("./a.h"));
+    ASSERT_EQ(Reads->getReads().size(), 2u);
+    EXPECT_TRUE(Journal->record(
+        Source, /*CommandsHash=*/7,
+        TypeCorrectJournal::describeInputs(*Reads, Reads->getReads()),
+        "out\n"));
+  }
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Append);
+    OS << "{\"file\": \"" << Dir << "/b.c\", \"commands\": 1, \"inp";
+  }
+
+  const auto Lookup = [&](uint64_t Config, uint64_t CommandsHash) {
+    std::unique_ptr<TypeCorrectJournal> Journal =
+        TypeCorrectJournal::open(Path, Config, /*Resume=*/true, Error);
+    EXPECT_TRUE(Journal) << Error;
+    llvm::Optional<std::string> Output;
+    if (Journal)
+      if (llvm::Optional<llvm::StringRef> Found =
+              Journal->lookup(Source, CommandsHash))
+        Output = Found->str();
+    return Output;
+  };
+  EXPECT_EQ(Lookup(1, 7), llvm::Optional<std::string>("out\n"));
+  EXPECT_EQ(Lookup(1, 8), llvm::None);
+  // Rewriting the header with the same contents doesn't count as a change
+  WriteFile(Header, "int h;\n");
+  EXPECT_EQ(Lookup(1, 7), llvm::Optional<std::string>("out\n"));
+  WriteFile(Header, "long h;\n");
+  EXPECT_EQ(Lookup(1, 7), llvm::None);
+  // Other options: started afresh
+  WriteFile(Header, "int h;\n");
+  EXPECT_EQ(Lookup(2, 7), llvm::None);
+  EXPECT_EQ(Lookup(1, 7), llvm::None);
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+GTEST_TEST(Journal, TornEntryFailsChecksum) {
+  /* Test that an entry cut off before its checksum isn't replayed, even when
+   * the newline written after it on reopening falls where its output should
+   * end, while the entries appended after it are */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("tc-journal", Dir));
+  const std::string Torn = (Dir + "/torn.c").str(),
+                    Next = (Dir + "/next.c").str(),
+                    Path = (Dir + "/journal.log").str();
+  std::string Error;
+  {
+    std::unique_ptr<TypeCorrectJournal> Journal =
+        TypeCorrectJournal::open(Path, /*Config=*/1, /*Resume=*/false, Error);
+    ASSERT_TRUE(Journal) << Error;
+  }
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_Append);
+    OS << "{\"file\": \"" << Torn << "\", \"commands\": 1, "
+       << "\"inputs\": [], \"output\": 5}\nab\ncd";
+  }
+  {
+    std::unique_ptr<TypeCorrectJournal> Journal =
+        TypeCorrectJournal::open(Path, /*Config=*/1, /*Resume=*/true, Error);
+    ASSERT_TRUE(Journal) << Error;
+    EXPECT_TRUE(Journal->record(Next, /*CommandsHash=*/2, {}, "out\n"));
+  }
+
+  std::unique_ptr<TypeCorrectJournal> Journal =
+      TypeCorrectJournal::open(Path, /*Config=*/1, /*Resume=*/true, Error);
+  ASSERT_TRUE(Journal) << Error;
+  EXPECT_EQ(Journal->getNumEntries(), 1u);
+  EXPECT_EQ(Journal->lookup(Torn, 1), llvm::None);
+  EXPECT_EQ(Journal->lookup(Next, 2), llvm::Optional<llvm::StringRef>("out\n"));
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+GTEST_TEST(WorkerPool, CrashOnlyLosesOffendingJob) {
+  /* Test that a crashing or hanging job is recorded and replaced while every
+   * other job still completes */
+  TypeCorrectWorkerPool::Options Opts;
+  Opts.NumWorkers = 2;
+  Opts.TimeoutSeconds = 1;
+  TypeCorrectWorkerPool Pool(
+      Opts, [](llvm::StringRef File, llvm::raw_ostream &Out,
+               const TypeCorrectPhaseFn &OnPhase) {
+        if (File == "crash")
+          std::abort();
+        if (File == "hang") {
+          OnPhase(TypeCorrectPhase::Match);
+          ::sleep(60);
+        }
+        Out << File;
+        return File != "fail";
+      });
+
+  const std::vector<std::string> Files{"a", "crash", "b", "hang", "fail", "c"};
+  std::map<std::string, TypeCorrectWorkerPool::JobResult> Results;
+  Pool.run(Files, [&](llvm::StringRef File,
+                      const TypeCorrectWorkerPool::JobResult &Result) {
+    EXPECT_EQ(Files[Result.Index], File);
+    EXPECT_TRUE(Results.emplace(File.str(), Result).second);
+  });
+
+  ASSERT_EQ(Results.size(), Files.size());
+  for (const char *File : {"a", "b", "c"}) {
+    EXPECT_EQ(Results[File].Status,
+              TypeCorrectWorkerPool::JobStatus::Succeeded);
+    EXPECT_EQ(Results[File].Output, File);
+  }
+  EXPECT_EQ(Results["fail"].Status, TypeCorrectWorkerPool::JobStatus::Failed);
+  EXPECT_EQ(Results["crash"].Status,
+            TypeCorrectWorkerPool::JobStatus::Crashed);
+  EXPECT_EQ(Results["crash"].TermSignal, SIGABRT);
+  EXPECT_EQ(Results["hang"].Status,
+            TypeCorrectWorkerPool::JobStatus::TimedOut);
+  EXPECT_EQ(Results["hang"].Phase, TypeCorrectPhase::Match);
+  EXPECT_GE(Results["hang"].PhaseSeconds[static_cast<unsigned>(
+                TypeCorrectPhase::Match)],
+            0.5);
+}
+
+GTEST_TEST(WorkerPool, LargeResultsArriveWhole) {
+  /* Test that results many times the size of a pipe's buffer, read a piece
+   * at a time from workers writing at once, arrive whole */
+  TypeCorrectWorkerPool::Options Opts;
+  Opts.NumWorkers = 3;
+  Opts.TimeoutSeconds = 60;
+  const auto Output = [](llvm::StringRef File) {
+    return std::string(3 << 20, File.front());
+  };
+  TypeCorrectWorkerPool Pool(
+      Opts, [&](llvm::StringRef File, llvm::raw_ostream &Out,
+                const TypeCorrectPhaseFn &OnPhase) {
+        OnPhase(TypeCorrectPhase::Write);
+        Out << Output(File);
+        return true;
+      });
+
+  const std::vector<std::string> Files{"a", "b", "c", "d", "e"};
+  unsigned Results = 0;
+  Pool.run(Files, [&](llvm::StringRef File,
+                      const TypeCorrectWorkerPool::JobResult &Result) {
+    EXPECT_EQ(Result.Status, TypeCorrectWorkerPool::JobStatus::Succeeded);
+    EXPECT_EQ(Result.Phase, TypeCorrectPhase::Write);
+    EXPECT_TRUE(Result.Output == Output(File)) << File.str();
+    Results++;
+  });
+  EXPECT_EQ(Results, Files.size());
+}
+
+GTEST_TEST(WorkerPool, RestartsOnlyCountReplacements) {
+  /* Test that a worker lost on the last job isn't counted as restarted,
+   * while one replaced to run the rest of the queue is */
+  unsigned Restarts = 0;
+  TypeCorrectWorkerPool::Options Opts;
+  Opts.OnRestart = [&] { Restarts++; };
+  TypeCorrectWorkerPool Pool(
+      Opts, [](llvm::StringRef File, llvm::raw_ostream &,
+               const TypeCorrectPhaseFn &) {
+        if (File.startswith("crash"))
+          std::abort();
+        return true;
+      });
+  const auto OnResult = [](llvm::StringRef,
+                           const TypeCorrectWorkerPool::JobResult &) {};
+
+  Pool.run({"a", "crash"}, OnResult);
+  EXPECT_EQ(Restarts, 0u);
+  Pool.run({"crash", "crash2", "a"}, OnResult);
+  EXPECT_EQ(Restarts, 2u);
+}
+
+GTEST_TEST(WorkerPool, MemoryBudgetLimitsConcurrency) {
+  /* Test that jobs whose predicted peak RSS would overrun the budget wait,
+   * smaller later jobs go first, and the actual peak RSS is reported */
+  TypeCorrectWorkerPool::Options Opts;
+  Opts.NumWorkers = 3;
+  Opts.MemoryBudgetBytes = 100;
+  TypeCorrectWorkerPool Pool(
+      Opts, [](llvm::StringRef, llvm::raw_ostream &Out,
+               const TypeCorrectPhaseFn &) {
+        // steady_clock is CLOCK_MONOTONIC, shared by every process
+        const auto Now = [] {
+          return std::chrono::steady_clock::now().time_since_epoch().count();
+        };
+        Out << Now() << ' ';
+        ::usleep(200 * 1000);
+        Out << Now();
+        return true;
+      });
+
+  const std::vector<std::string> Files{"a", "b", "c", "d"};
+  const std::vector<uint64_t> PeakRSS{60, 60, 30, 100};
+  std::vector<std::pair<int64_t, int64_t>> Spans(Files.size());
+  Pool.run(
+      Files,
+      [&](llvm::StringRef, const TypeCorrectWorkerPool::JobResult &Result) {
+        EXPECT_EQ(Result.Status, TypeCorrectWorkerPool::JobStatus::Succeeded);
+        EXPECT_GT(Result.PeakRSSBytes, 0u);
+        const auto Times = llvm::StringRef(Result.Output).split(' ');
+        EXPECT_FALSE(Times.first.getAsInteger(10, Spans[Result.Index].first));
+        EXPECT_FALSE(Times.second.getAsInteger(10, Spans[Result.Index].second));
+      },
+      llvm::None, PeakRSS);
+
+  for (unsigned L = 0; L < Files.size(); L++)
+    for (unsigned R = L + 1; R < Files.size(); R++)
+      if (Spans[L].first < Spans[R].second && Spans[R].first < Spans[L].second)
+        EXPECT_LE(PeakRSS[L] + PeakRSS[R], Opts.MemoryBudgetBytes)
+            << Files[L] << " and " << Files[R] << " overlapped";
+  // c fits next to a and overtakes b
+  EXPECT_LT(Spans[2].first, Spans[1].first);
+}
+
+GTEST_TEST(Driver, OutputIndependentOfParallelism) {
+  /* Test that a corpus run at -j1 and at -j64 gives byte-identical output,
+   * whatever order the files are given in */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("type_correct", Dir));
+  std::vector<std::string> Files;
+  for (int Idx = 0; Idx < 32; Idx++) {
+    llvm::SmallString<128> Path(Dir);
+    llvm::sys::path::append(Path, "tu" + std::to_string(Idx) + ".c");
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC);
+    OS << "void f(int a, char c);\n";
+    // Uneven sizes, so that workers finish out of order
+    for (int Call = 0; Call < (Idx * 37) % 200; Call++)
+      OS << "void g" << Call << "(void) { f(" << Call << ", 'x'); }\n";
+    Files.push_back(std::string(Path));
+  }
+  const clang::tooling::FixedCompilationDatabase Compilations(
+      Dir, std::vector<std::string>());
+
+  const auto Run = [&](llvm::ArrayRef<std::string> SourcePaths,
+                       unsigned Jobs) {
+    TypeCorrectDriverOptions Options;
+    Options.Jobs = Jobs;
+    std::string Output, Errors;
+    llvm::raw_string_ostream Out(Output), Errs(Errors);
+    EXPECT_EQ(runTypeCorrect(Compilations, SourcePaths, Options, Out, Errs),
+              EXIT_SUCCESS)
+        << Errs.str();
+    return Out.str();
+  };
+  const std::string Serial = Run(Files, 1);
+  EXPECT_NE(Serial.find("f(/*a=*/1, /*c=*/'x')"), std::string::npos);
+  EXPECT_EQ(Run(Files, 64), Serial);
+  const std::vector<std::string> Reversed(Files.rbegin(), Files.rend());
+  EXPECT_EQ(Run(Reversed, 64), Serial);
+  EXPECT_EQ(Run(Reversed, 1), Serial);
+
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+GTEST_TEST(Driver, InPlaceSavesOnlyEditedFiles) {
+  /* Test that --in-place replaces the files with edits, serially and with
+   * workers, prints nothing, and leaves files without edits untouched */
+  for (const unsigned Jobs : {1u, 4u}) {
+    llvm::SmallString<128> Dir;
+    ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("type_correct", Dir));
+    const std::string Edited = (Dir + "/edited.c").str();
+    const std::string Clean = (Dir + "/clean.c").str();
+    {
+      std::error_code EC;
+      llvm::raw_fd_ostream OS(Edited, EC);
+      OS << "void f(int a);\nvoid g(void) { f(1); }\n";
+      llvm::raw_fd_ostream CleanOS(Clean, EC);
+      CleanOS << "int x;\n";
+    }
+    llvm::sys::fs::UniqueID CleanID;
+    ASSERT_FALSE(llvm::sys::fs::getUniqueID(Clean, CleanID));
+    const clang::tooling::FixedCompilationDatabase Compilations(
+        Dir, std::vector<std::string>());
+
+    TypeCorrectDriverOptions Options;
+    Options.Jobs = Jobs;
+    Options.InPlace = true;
+    std::string Output, Errors;
+    llvm::raw_string_ostream Out(Output), Errs(Errors);
+    EXPECT_EQ(runTypeCorrect(Compilations, {Edited, Clean}, Options, Out,
+                             Errs),
+              EXIT_SUCCESS)
+        << Errs.str();
+    EXPECT_EQ(Out.str(), "");
+
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buffer =
+        llvm::MemoryBuffer::getFile(Edited);
+    ASSERT_TRUE(Buffer);
+    EXPECT_EQ((*Buffer)->getBuffer(),
+              "void f(int a);\nvoid g(void) { f(/*a=*/1); }\n");
+    llvm::sys::fs::UniqueID CleanIDAfter;
+    ASSERT_FALSE(llvm::sys::fs::getUniqueID(Clean, CleanIDAfter));
+    EXPECT_EQ(CleanIDAfter, CleanID);
+    llvm::sys::fs::remove_directories(Dir);
+  }
+}
+
+GTEST_TEST(Reproducer, SelfContainedBundle) {
+  /* Test that a reproducer carries the TU with its includes inlined, a copy
+   * of its forced include, its flags less the include paths and modules,
+   * and the run's timings */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("tc-repro", Dir));
+  const auto PathOf = [&](llvm::StringRef Name) {
+    llvm::SmallString<128> Path(Dir);
+    llvm::sys::path::append(Path, Name);
+    return std::string(Path);
+  };
+  ASSERT_FALSE(llvm::sys::fs::create_directory(PathOf("inc")));
+  for (const auto &File :
+       {std::make_pair("inc/h.h", "typedef int my_int;\n"),
+        std::make_pair("pre.h", "#define Y 2\n"),
+        std::make_pair("a.c", "#include \"h.h\"\nmy_int x = X + Y;\n")}) {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(PathOf(File.first), EC);
+    OS << File.second;
+  }
+  const clang::tooling::FixedCompilationDatabase Compilations(
+      Dir, std::vector<std::string>{"-Iinc", "-DX=1", "-include", "pre.h",
+                                    "-fmodules"});
+  TypeCorrectWorkerPool::JobResult Result;
+  Result.Seconds = 2;
+  Result.Phase = TypeCorrectPhase::Match;
+  Result.PhaseSeconds[static_cast<unsigned>(TypeCorrectPhase::Parse)] = 1.5;
+
+  const std::string Script = writeReproducer(
+      Compilations, PathOf("a.c"), PathOf("out"), "slow TU a.c", Result);
+  ASSERT_FALSE(Script.empty());
+  const llvm::StringRef Bundle = llvm::sys::path::parent_path(Script);
+  const auto Read = [&](llvm::StringRef Name) {
+    llvm::SmallString<128> Path(Bundle);
+    llvm::sys::path::append(Path, Name);
+    auto Buffer = llvm::MemoryBuffer::getFile(Path);
+    return Buffer ? (*Buffer)->getBuffer().str() : std::string();
+  };
+
+  const std::string Source = Read("a.c");
+  EXPECT_NE(Source.find("typedef int my_int;"), std::string::npos);
+  EXPECT_NE(Source.find("my_int x = X + Y;"), std::string::npos);
+  EXPECT_EQ(Read("forced-0-pre.h"), "#define Y 2\n");
+  const std::string Run = Read("run.sh");
+  EXPECT_NE(Run.find("# type_correct: slow TU a.c"), std::string::npos);
+  EXPECT_NE(Run.find("'a.c' -- '-DX=1' '-include' 'forced-0-pre.h'"),
+            std::string::npos);
+  EXPECT_EQ(Run.find("-Iinc"), std::string::npos);
+  EXPECT_EQ(Run.find("-fmodules"), std::string::npos);
+  EXPECT_EQ(Run.find("Not self-contained"), std::string::npos);
+
+  llvm::Expected<llvm::json::Value> Report =
+      llvm::json::parse(Read("time-report.json"));
+  ASSERT_TRUE(bool(Report));
+  const llvm::json::Object *Obj = Report->getAsObject();
+  ASSERT_TRUE(Obj);
+  EXPECT_EQ(Obj->getNumber("seconds"), llvm::Optional<double>(2));
+  EXPECT_EQ(Obj->getString("phase"), llvm::StringRef("match"));
+  ASSERT_TRUE(Obj->getObject("phase_seconds"));
+  EXPECT_EQ(Obj->getObject("phase_seconds")->getNumber("parse"),
+            llvm::Optional<double>(1.5));
+
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+GTEST_TEST(Reproducer, InliningIsTimeLimited) {
+  /* Test that inlining a TU whose preprocessing hangs (here, on a FIFO
+   * nothing writes to) is given up on, and the script falls back to the
+   * original file */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("tc-repro", Dir));
+  const std::string Source = (Dir + "/a.c").str(),
+                    FIFO = (Dir + "/fifo.h").str();
+  ASSERT_EQ(::mkfifo(FIFO.c_str(), 0600), 0);
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Source, EC);
+    OS << "#include \"fifo.h\"\n";
+  }
+  const clang::tooling::FixedCompilationDatabase Compilations(
+      Dir, std::vector<std::string>());
+
+  const auto Start = std::chrono::steady_clock::now();
+  const std::string Script =
+      writeReproducer(Compilations, Source, (Dir + "/out").str(), "hung",
+                      TypeCorrectWorkerPool::JobResult(),
+                      /*TimeoutSeconds=*/1);
+  EXPECT_LT(std::chrono::steady_clock::now() - Start, std::chrono::seconds(30));
+  ASSERT_FALSE(Script.empty());
+  auto Run = llvm::MemoryBuffer::getFile(Script);
+  ASSERT_TRUE(Run);
+  EXPECT_NE((*Run)->getBuffer().find("cd '" + Dir.str().str() + "'"),
+            llvm::StringRef::npos);
+
+  llvm::sys::fs::remove_directories(Dir);
+}
+
+GTEST_TEST(Sample, StratifiedEstimateCoversTruth) {
+  /* Test that every directory is sampled, the sample is reproducible, and the
+   * extrapolated edit counts bracket the true ones */
+  std::vector<std::string> Files;
+  std::vector<uint64_t> Edits;
+  uint64_t Truth = 0;
+  for (int Dir = 0; Dir < 10; Dir++)
+    for (int File = 0; File < 10 * (Dir + 1); File++) {
+      Files.push_back("d" + std::to_string(Dir) + "/f" + std::to_string(File) +
+                      ".c");
+      Edits.push_back(static_cast<uint64_t>(Dir * 3 + File % 5));
+      Truth += Edits.back();
+    }
+
+  const std::string Rule = (RuleCounterPrefix + "lac").str();
+  const std::vector<unsigned> Sample = selectStratifiedSample(Files, 0.2, 42);
+  EXPECT_EQ(Sample, selectStratifiedSample(Files, 0.2, 42));
+  EXPECT_EQ(Sample.size(), 110u);
+  EXPECT_TRUE(std::is_sorted(Sample.begin(), Sample.end()));
+
+  TypeCorrectSampleEstimate Estimate(Files, 0.2);
+  for (const unsigned Idx : Sample) {
+    TypeCorrectCounters Counts;
+    Counts.add(Rule, Edits[Idx]);
+    // Round trip through the form workers send
+    std::string Wire;
+    llvm::raw_string_ostream OS(Wire);
+    Counts.write(OS);
+    TypeCorrectCounters Received;
+    ASSERT_TRUE(Received.read(OS.str()));
+    Estimate.record(Idx, Received);
+  }
+  const TypeCorrectSampleEstimate::Estimate Total = Estimate.estimate(Rule);
+  EXPECT_GT(Total.HalfWidth, 0);
+  EXPECT_LE(Total.Total - Total.HalfWidth, static_cast<double>(Truth));
+  EXPECT_GE(Total.Total + Total.HalfWidth, static_cast<double>(Truth));
+  EXPECT_DOUBLE_EQ(Estimate.estimate().Total, Total.Total);
+
+  // A fully sampled population is known exactly
+  TypeCorrectSampleEstimate Census(Files, 1);
+  for (const unsigned Idx : selectStratifiedSample(Files, 1, 0)) {
+    TypeCorrectCounters Counts;
+    Counts.add(Rule, Edits[Idx]);
+    Census.record(Idx, Counts);
+  }
+  EXPECT_DOUBLE_EQ(Census.estimate(Rule).Total, static_cast<double>(Truth));
+  EXPECT_DOUBLE_EQ(Census.estimate(Rule).HalfWidth, 0);
+  EXPECT_DOUBLE_EQ(Census.estimateDirectory("d0").Total, 20);
+}
+
+GTEST_TEST(Sample, SmallDirectoriesMerged) {
+  /* Test that the sample is ceil(P * N) files however many directories
+   * there are, directories too small for a share of it being merged into
+   * their parent's stratum, and that the fraction sampled is reported */
+  std::vector<std::string> Files;
+  for (int File = 0; File < 100; File++)
+    Files.push_back("big/f" + std::to_string(File) + ".c");
+  Files.push_back("big/small/g.c");
+  Files.push_back("other/h.c");
+
+  const std::vector<unsigned> Sample = selectStratifiedSample(Files, 0.05, 7);
+  EXPECT_EQ(Sample.size(), 6u);
+
+  TypeCorrectSampleEstimate Estimate(Files, 0.05);
+  for (const unsigned Idx : Sample) {
+    TypeCorrectCounters Counts;
+    Counts.add((RuleCounterPrefix + "lac").str(), 1);
+    Estimate.record(Idx, Counts);
+  }
+  // Every file is in a sampled stratum: 1 edit each, without any variance
+  EXPECT_DOUBLE_EQ(Estimate.estimate().Total, 102);
+  EXPECT_DOUBLE_EQ(Estimate.estimate().HalfWidth, 0);
+  std::string Printed;
+  llvm::raw_string_ostream OS(Printed);
+  Estimate.print(OS);
+  EXPECT_NE(OS.str().find("sampled 6 of 102 TUs (5.9%) in 1 stratum"),
+            std::string::npos)
+      << Printed;
+  EXPECT_NE(Printed.find("big (3 directories)"), std::string::npos);
+}
+
+GTEST_TEST(Summary, ReducesPerRuleChangeAndDirectory) {
+  /* Test that per-TU counters are reduced per rule, type change and
+   * directory, and reported as JSON */
+  const auto Counters = [](uint64_t ToSize, uint64_t ToBool) {
+    TypeCorrectCounters Counts;
+    Counts.add((RuleCounterPrefix + "lac").str(), ToSize + ToBool);
+    Counts.add((ChangeCounterPrefix + "lac\tint\tsize_t").str(), ToSize);
+    Counts.add((ChangeCounterPrefix + "lac\tint\t_Bool").str(), ToBool);
+    return Counts;
+  };
+  TypeCorrectSummary Summary;
+  Summary.add("src/a.c", Counters(2, 1));
+  Summary.add("src/b.c", Counters(1, 0));
+  Summary.add("lib/c.c", Counters(0, 4));
+  EXPECT_EQ(Summary.getNumTUs(), 3u);
+  EXPECT_EQ(Summary.getNumEdits(), 8u);
+  EXPECT_EQ(Summary.getDirectoryEdits("src"), 4u);
+  EXPECT_EQ(Summary.getDirectoryEdits("lib"), 4u);
+
+  std::string JSON;
+  llvm::raw_string_ostream OS(JSON);
+  Summary.writeJSON(OS);
+  llvm::Expected<llvm::json::Value> Parsed = llvm::json::parse(OS.str());
+  ASSERT_TRUE(static_cast<bool>(Parsed));
+  const llvm::json::Object *Root = Parsed->getAsObject();
+  ASSERT_NE(Root, nullptr);
+  EXPECT_EQ(Root->getInteger("edits").getValueOr(0), 8);
+  EXPECT_EQ(Root->getObject("rules")->getInteger("lac").getValueOr(0), 8);
+  const llvm::json::Array *Changes = Root->getArray("changes");
+  ASSERT_EQ(Changes->size(), 2u);
+  const llvm::json::Object *ToBool = (*Changes)[0].getAsObject();
+  EXPECT_EQ(ToBool->getString("to").getValueOr(""), "_Bool");
+  EXPECT_EQ(ToBool->getInteger("edits").getValueOr(0), 5);
+}
+
+GTEST_TEST(History, LongestFirstWithSizeFallback) {
+  /* Test that recorded costs come first, unknown TUs are ordered by size, and
+   * the history survives a save/load round trip */
+  llvm::SmallString<128> Dir;
+  ASSERT_FALSE(llvm::sys::fs::createUniqueDirectory("type_correct", Dir));
+  const auto MakeFile = [&](llvm::StringRef Name, size_t Size) {
+    llvm::SmallString<128> Path(Dir);
+    llvm::sys::path::append(Path, Name);
+    std::error_code EC;
+    llvm::raw_fd_ostream(Path, EC) << std::string(Size, ' ');
+    return std::string(Path);
+  };
+  const std::vector<std::string> Files{
+      MakeFile("small.c", 10), MakeFile("big.c", 20000),
+      MakeFile("known.c", 10000), MakeFile("fast.c", 20000)};
+
+  // fast.c is as big as big.c, but its history says it's cheap
+  TypeCorrectHistory History;
+  History.record(Files[2], 0.9, 0.1, 300);
+  History.record(Files[3], 0.001, 0);
+  EXPECT_EQ(History.orderLongestFirst(Files),
+            (std::vector<unsigned>{2, 1, 3, 0}));
+
+  llvm::SmallString<128> HistoryPath(Dir);
+  llvm::sys::path::append(HistoryPath, "history.json");
+  ASSERT_TRUE(History.save(HistoryPath));
+  const TypeCorrectHistory Loaded = TypeCorrectHistory::load(HistoryPath);
+  ASSERT_NE(Loaded.lookup(Files[2]), nullptr);
+  EXPECT_DOUBLE_EQ(Loaded.lookup(Files[2])->ParseSeconds, 0.9);
+  EXPECT_DOUBLE_EQ(Loaded.estimateSeconds(Files[2]), 1);
+  EXPECT_EQ(Loaded.estimatePeakRSS(Files[2]), 300u);
+  EXPECT_EQ(Loaded.lookup(Files[0]), nullptr);
+
+  llvm::sys::fs::remove_directories(Dir);
+}
+
 /* // Annoying edge cases to explicitly ignore to reduce false positives
 
 ```c